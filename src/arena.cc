@@ -0,0 +1,118 @@
+#include "arena.h"
+
+#include "compilation.h"
+#include "error.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <mutex>
+#include <vector>
+
+
+thread_local Arena* Arena::regions_ = nullptr;
+
+
+const char* Arena::Name(Region region) {
+  static const char* names[NUM] = {
+    "token",
+    "ast",
+    "type",
+    "func",
+    "codegen",
+  };
+  return names[region];
+}
+
+
+void Arena::Grow(size_t size) {
+  auto slabSize = std::max<size_t>(SLAB_SIZE, HEADER + size);
+  auto slab = static_cast<Slab*>(malloc(slabSize));
+  if (slab == nullptr)
+    Error("out of memory");
+  slab->next_ = slab_;
+  slab->size_ = slabSize;
+  slab_ = slab;
+  cur_ = reinterpret_cast<char*>(slab) + HEADER;
+  end_ = reinterpret_cast<char*>(slab) + slabSize;
+  ++slabs_;
+  bytes_ += slabSize;
+  peakBytes_ = std::max(peakBytes_, bytes_);
+}
+
+
+Arena::~Arena() {
+  Finalize();
+  while (slab_) {
+    auto next = slab_->next_;
+    free(slab_);
+    slab_ = next;
+  }
+}
+
+
+// In the reverse order of construction
+void Arena::Finalize() {
+  for (auto iter = finalizers_.rbegin(); iter != finalizers_.rend(); ++iter)
+    iter->destroy_(iter->obj_);
+  finalizers_.clear();
+}
+
+
+void Arena::Release() {
+  Finalize();
+  if (slab_ == nullptr)
+    return;
+  while (slab_->next_) {
+    auto next = slab_->next_;
+    bytes_ -= slab_->size_;
+    --slabs_;
+    free(slab_);
+    slab_ = next;
+  }
+  cur_ = reinterpret_cast<char*>(slab_) + HEADER;
+  end_ = reinterpret_cast<char*>(slab_) + slab_->size_;
+}
+
+
+Arena* Arena::Acquire() {
+  auto comp = Compilation::Current();
+  std::lock_guard<std::mutex> lock(comp->funcMutex_);
+  auto& freeArenas = comp->freeFuncArenas_;
+  if (freeArenas.empty()) {
+    auto& all = comp->funcArenas_;
+    auto arena = all.empty() ? &regions_[FUNC]: new Arena;
+    all.push_back(arena);
+    return arena;
+  }
+  auto arena = freeArenas.back();
+  freeArenas.pop_back();
+  return arena;
+}
+
+
+void Arena::Recycle(Arena* arena) {
+  arena->Release();
+  auto comp = Compilation::Current();
+  std::lock_guard<std::mutex> lock(comp->funcMutex_);
+  comp->freeFuncArenas_.push_back(arena);
+}
+
+
+// The peak of 'FUNC' is that of its arenas added up, an upper bound
+Arena::Stats Arena::Usage(Region region) {
+  std::vector<Arena*> arenas {&regions_[region]};
+  if (region == FUNC) {
+    auto comp = Compilation::Current();
+    std::lock_guard<std::mutex> lock(comp->funcMutex_);
+    if (comp->funcArenas_.size())
+      arenas = comp->funcArenas_;
+  }
+  Stats stats;
+  for (auto arena: arenas) {
+    stats.slabs_ += arena->slabs_;
+    stats.bytes_ += arena->bytes_;
+    stats.peakBytes_ += arena->peakBytes_;
+    stats.objects_ += arena->objects_;
+  }
+  return stats;
+}
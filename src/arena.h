@@ -0,0 +1,122 @@
+#ifndef _WGTCC_ARENA_H_
+#define _WGTCC_ARENA_H_
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+
+/*
+ * Region based allocation. Objects are bumped from 1MB slabs and
+ * are never freed one by one, a region is released as a whole when
+ * the phase owning it ends. Destructors are run only for the objects
+ * handed to 'Own', those holding heap memory of their own. The regions
+ * are those of the compilation the thread works for.
+ */
+class Arena {
+public:
+  enum Region {
+    TOKEN,   // Tokens, identifiers and hide sets
+    AST,     // AST nodes and scopes
+    TYPE,    // Types
+    FUNC,    // Nodes of the function bodies being compiled
+    CODEGEN, // Nodes made by the code generator, per function
+    NUM,
+  };
+
+  Arena() {}
+  ~Arena();
+  Arena(const Arena& other) = delete;
+  Arena& operator=(const Arena& other) = delete;
+
+  static Arena& Get(Region region) { return regions_[region]; }
+  static void SetRegions(Arena* regions) { regions_ = regions; }
+  static const char* Name(Region region);
+
+  // Arenas of the function bodies in flight: the parser fills one
+  // while the generator may still read another. A recycled arena
+  // keeps its first slab. Thread safe.
+  static Arena* Acquire();
+  static void Recycle(Arena* arena);
+
+  void* Alloc(size_t size) {
+    size = (size + ALIGN - 1) & ~(ALIGN - 1);
+    if (size > static_cast<size_t>(end_ - cur_))
+      Grow(size);
+    auto ret = cur_;
+    cur_ += size;
+    ++objects_;
+    return ret;
+  }
+  // 'obj', allocated from the arena, is destroyed when it is released
+  template<typename T>
+  T* Own(T* obj) {
+    finalizers_.push_back({obj, [](void* addr) {
+      static_cast<T*>(addr)->~T();
+    }});
+    return obj;
+  }
+  // An object owned by the arena, of a type without placement 'new'
+  template<typename T, typename... Args>
+  T* Make(Args&&... args) {
+    return Own(new (Alloc(sizeof(T))) T(std::forward<Args>(args)...));
+  }
+  // Keeps the first slab for reuse
+  void Release();
+
+  // For '-fmem-report', the arenas of 'FUNC' are summed up
+  struct Stats {
+    size_t slabs_ {0};
+    size_t bytes_ {0};
+    size_t peakBytes_ {0};
+    size_t objects_ {0};
+  };
+  static Stats Usage(Region region);
+
+private:
+  struct Slab {
+    Slab* next_;
+    size_t size_;
+  };
+
+  enum {
+    ALIGN = alignof(std::max_align_t),
+    HEADER = (sizeof(Slab) + ALIGN - 1) & ~(ALIGN - 1),
+    SLAB_SIZE = 1 << 20,
+  };
+
+  struct Finalizer {
+    void* obj_;
+    void (*destroy_)(void*);
+  };
+
+  void Grow(size_t size);
+  void Finalize();
+
+  char* cur_ {nullptr};
+  char* end_ {nullptr};
+  Slab* slab_ {nullptr}; // The current slab, links to the previous ones
+  size_t slabs_ {0};
+  size_t bytes_ {0};
+  size_t peakBytes_ {0};
+  size_t objects_ {0};
+  std::vector<Finalizer> finalizers_;
+
+  static thread_local Arena* regions_;
+};
+
+
+inline void* operator new(size_t size, Arena::Region region) {
+  return Arena::Get(region).Alloc(size);
+}
+
+inline void operator delete(void* addr, Arena::Region region) {}
+
+inline void* operator new(size_t size, Arena& arena) {
+  return arena.Alloc(size);
+}
+
+inline void operator delete(void* addr, Arena& arena) {}
+
+#endif
@@ -0,0 +1,1313 @@
+#include "assembler.h"
+
+#include "error.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+
+#include <elf.h>
+
+
+/*
+ * Register encodings.
+ * The number is the 4 bits register number in ModRM/REX,
+ * 'width' is 0 for xmm registers.
+ */
+struct RegInfo {
+  int num_;
+  int width_;
+  bool rex_; // Byte register only addressable with REX prefix
+};
+
+static const std::unordered_map<std::string, RegInfo> regMap {
+  {"rax", {0, 8}}, {"rcx", {1, 8}}, {"rdx", {2, 8}}, {"rbx", {3, 8}},
+  {"rsp", {4, 8}}, {"rbp", {5, 8}}, {"rsi", {6, 8}}, {"rdi", {7, 8}},
+  {"r8", {8, 8}}, {"r9", {9, 8}}, {"r10", {10, 8}}, {"r11", {11, 8}},
+  {"r12", {12, 8}}, {"r13", {13, 8}}, {"r14", {14, 8}}, {"r15", {15, 8}},
+
+  {"eax", {0, 4}}, {"ecx", {1, 4}}, {"edx", {2, 4}}, {"ebx", {3, 4}},
+  {"esp", {4, 4}}, {"ebp", {5, 4}}, {"esi", {6, 4}}, {"edi", {7, 4}},
+  {"r8d", {8, 4}}, {"r9d", {9, 4}}, {"r10d", {10, 4}}, {"r11d", {11, 4}},
+  {"r12d", {12, 4}}, {"r13d", {13, 4}}, {"r14d", {14, 4}}, {"r15d", {15, 4}},
+
+  {"ax", {0, 2}}, {"cx", {1, 2}}, {"dx", {2, 2}}, {"bx", {3, 2}},
+  {"sp", {4, 2}}, {"bp", {5, 2}}, {"si", {6, 2}}, {"di", {7, 2}},
+  {"r8w", {8, 2}}, {"r9w", {9, 2}}, {"r10w", {10, 2}}, {"r11w", {11, 2}},
+  {"r12w", {12, 2}}, {"r13w", {13, 2}}, {"r14w", {14, 2}}, {"r15w", {15, 2}},
+
+  {"al", {0, 1}}, {"cl", {1, 1}}, {"dl", {2, 1}}, {"bl", {3, 1}},
+  {"spl", {4, 1, true}}, {"bpl", {5, 1, true}},
+  {"sil", {6, 1, true}}, {"dil", {7, 1, true}},
+  {"r8b", {8, 1}}, {"r9b", {9, 1}}, {"r10b", {10, 1}}, {"r11b", {11, 1}},
+  {"r12b", {12, 1}}, {"r13b", {13, 1}}, {"r14b", {14, 1}}, {"r15b", {15, 1}},
+
+  {"xmm0", {0, 0}}, {"xmm1", {1, 0}}, {"xmm2", {2, 0}}, {"xmm3", {3, 0}},
+  {"xmm4", {4, 0}}, {"xmm5", {5, 0}}, {"xmm6", {6, 0}}, {"xmm7", {7, 0}},
+  {"xmm8", {8, 0}}, {"xmm9", {9, 0}}, {"xmm10", {10, 0}},
+  {"xmm11", {11, 0}}, {"xmm12", {12, 0}}, {"xmm13", {13, 0}},
+  {"xmm14", {14, 0}}, {"xmm15", {15, 0}},
+};
+
+static const int RIP = 16;
+static const int NO_BASE = -1;
+
+
+// Condition codes of jcc/setcc
+static const std::unordered_map<std::string, int> ccMap {
+  {"o", 0}, {"no", 1}, {"b", 2}, {"c", 2}, {"nae", 2},
+  {"ae", 3}, {"nb", 3}, {"nc", 3}, {"e", 4}, {"z", 4},
+  {"ne", 5}, {"nz", 5}, {"be", 6}, {"na", 6}, {"a", 7}, {"nbe", 7},
+  {"s", 8}, {"ns", 9}, {"p", 10}, {"pe", 10}, {"np", 11}, {"po", 11},
+  {"l", 12}, {"nge", 12}, {"ge", 13}, {"nl", 13},
+  {"le", 14}, {"ng", 14}, {"g", 15}, {"nle", 15},
+};
+
+
+enum SSEKind {
+  SSE_MOVE,     // xmm <- xmm/mem, mem <- xmm
+  SSE_ARITHM,   // xmm <- xmm/mem
+  SSE_CVTSI2,   // xmm <- gp/mem
+  SSE_CVT2SI,   // gp <- xmm/mem
+};
+
+struct SSEInfo {
+  int prefix_;
+  uint8_t op_;
+  uint8_t storeOp_;
+  SSEKind kind_;
+};
+
+static const std::unordered_map<std::string, SSEInfo> sseMap {
+  {"movss", {0xF3, 0x10, 0x11, SSE_MOVE}},
+  {"movsd", {0xF2, 0x10, 0x11, SSE_MOVE}},
+  {"movaps", {0, 0x28, 0x29, SSE_MOVE}},
+  {"movups", {0, 0x10, 0x11, SSE_MOVE}},
+  {"movapd", {0x66, 0x28, 0x29, SSE_MOVE}},
+  {"addss", {0xF3, 0x58, 0, SSE_ARITHM}},
+  {"addsd", {0xF2, 0x58, 0, SSE_ARITHM}},
+  {"mulss", {0xF3, 0x59, 0, SSE_ARITHM}},
+  {"mulsd", {0xF2, 0x59, 0, SSE_ARITHM}},
+  {"subss", {0xF3, 0x5C, 0, SSE_ARITHM}},
+  {"subsd", {0xF2, 0x5C, 0, SSE_ARITHM}},
+  {"divss", {0xF3, 0x5E, 0, SSE_ARITHM}},
+  {"divsd", {0xF2, 0x5E, 0, SSE_ARITHM}},
+  {"sqrtss", {0xF3, 0x51, 0, SSE_ARITHM}},
+  {"sqrtsd", {0xF2, 0x51, 0, SSE_ARITHM}},
+  {"ucomiss", {0, 0x2E, 0, SSE_ARITHM}},
+  {"ucomisd", {0x66, 0x2E, 0, SSE_ARITHM}},
+  {"comiss", {0, 0x2F, 0, SSE_ARITHM}},
+  {"comisd", {0x66, 0x2F, 0, SSE_ARITHM}},
+  {"pxor", {0x66, 0xEF, 0, SSE_ARITHM}},
+  {"xorps", {0, 0x57, 0, SSE_ARITHM}},
+  {"xorpd", {0x66, 0x57, 0, SSE_ARITHM}},
+  {"cvtss2sd", {0xF3, 0x5A, 0, SSE_ARITHM}},
+  {"cvtsd2ss", {0xF2, 0x5A, 0, SSE_ARITHM}},
+  {"cvtsi2ss", {0xF3, 0x2A, 0, SSE_CVTSI2}},
+  {"cvtsi2sd", {0xF2, 0x2A, 0, SSE_CVTSI2}},
+  {"cvtsi2ssl", {0xF3, 0x2A, 0, SSE_CVTSI2}},
+  {"cvtsi2sdl", {0xF2, 0x2A, 0, SSE_CVTSI2}},
+  {"cvtsi2ssq", {0xF3, 0x2A, 0, SSE_CVTSI2}},
+  {"cvtsi2sdq", {0xF2, 0x2A, 0, SSE_CVTSI2}},
+  {"cvttss2si", {0xF3, 0x2C, 0, SSE_CVT2SI}},
+  {"cvttsd2si", {0xF2, 0x2C, 0, SSE_CVT2SI}},
+  {"cvtss2si", {0xF3, 0x2D, 0, SSE_CVT2SI}},
+  {"cvtsd2si", {0xF2, 0x2D, 0, SSE_CVT2SI}},
+};
+
+
+// Opcode extension of the group 1 (ALU) instructions
+static const std::unordered_map<std::string, int> aluMap {
+  {"add", 0}, {"or", 1}, {"adc", 2}, {"sbb", 3},
+  {"and", 4}, {"sub", 5}, {"xor", 6}, {"cmp", 7},
+};
+
+// Opcode extension of the group 2 (shift) instructions
+static const std::unordered_map<std::string, int> shiftMap {
+  {"rol", 0}, {"ror", 1}, {"sal", 4}, {"shl", 4}, {"shr", 5}, {"sar", 7},
+};
+
+// Opcode extension of the group 3 (unary) instructions
+static const std::unordered_map<std::string, int> unaryMap {
+  {"not", 2}, {"neg", 3}, {"mul", 4}, {"div", 6}, {"idiv", 7},
+};
+
+static const char* arithms[] = {
+  "add", "or", "adc", "sbb", "and", "sub", "xor", "cmp",
+  "rol", "ror", "sal", "shl", "shr", "sar",
+  "not", "neg", "mul", "div", "idiv", "imul",
+  "mov", "lea", "test",
+};
+
+
+static bool FitsInt8(long val) {
+  return SCHAR_MIN <= val && val <= SCHAR_MAX;
+}
+
+
+static bool FitsInt32(long val) {
+  return INT_MIN <= val && val <= INT_MAX;
+}
+
+
+// Sign-extend the low 'width' bytes of 'val'
+static long Truncate(long val, int width) {
+  switch (width) {
+  case 1: return static_cast<int8_t>(val);
+  case 2: return static_cast<int16_t>(val);
+  case 4: return static_cast<int32_t>(val);
+  default: return val;
+  }
+}
+
+
+static std::string Trim(const std::string& str) {
+  size_t begin = 0, end = str.size();
+  while (begin < end && isspace(str[begin]))
+    ++begin;
+  while (end > begin && isspace(str[end - 1]))
+    --end;
+  return str.substr(begin, end - begin);
+}
+
+
+// Split operands by ',', except those in parenthesis or string literal
+static std::vector<std::string> SplitOperands(const std::string& str) {
+  std::vector<std::string> ret;
+  std::string cur;
+  int depth = 0;
+  bool inStr = false;
+  for (size_t i = 0; i < str.size(); ++i) {
+    auto c = str[i];
+    if (inStr) {
+      cur.push_back(c);
+      if (c == '\\' && i + 1 < str.size())
+        cur.push_back(str[++i]);
+      else if (c == '"')
+        inStr = false;
+      continue;
+    }
+    if (c == '"') {
+      inStr = true;
+    } else if (c == '(') {
+      ++depth;
+    } else if (c == ')') {
+      --depth;
+    } else if (c == ',' && depth == 0) {
+      ret.push_back(Trim(cur));
+      cur.clear();
+      continue;
+    }
+    cur.push_back(c);
+  }
+  cur = Trim(cur);
+  if (cur.size() || ret.size())
+    ret.push_back(cur);
+  return ret;
+}
+
+
+static long ParseNumber(const std::string& str) {
+  char* end;
+  errno = 0;
+  auto val = strtoll(str.c_str(), &end, 0);
+  if (str.empty() || *end != 0) {
+    // Large unsigned value, like 18446744073709551615
+    val = strtoull(str.c_str(), &end, 0);
+    if (str.empty() || *end != 0)
+      Error("assembler: bad number '%s'", str.c_str());
+  }
+  return val;
+}
+
+
+Assembler::Assembler() {
+  sections_[SEC_TEXT].align_ = 1;
+}
+
+
+void Assembler::Emit(const std::string& line) {
+  size_t begin = 0;
+  while (begin < line.size() && isspace(line[begin]))
+    ++begin;
+  if (begin == line.size() || line[begin] == '#')
+    return;
+
+  auto end = begin;
+  while (end < line.size() && !isspace(line[end]))
+    ++end;
+  auto name = line.substr(begin, end - begin);
+  auto args = SplitOperands(line.substr(end));
+
+  if (name[0] == '.') {
+    EmitDirective(name, args);
+  } else {
+    ops_.clear();
+    for (const auto& arg: args)
+      ops_.push_back(GetOperand(arg));
+    EmitInst(Decode(name), ops_);
+  }
+}
+
+
+void Assembler::Emit(const std::string& inst,
+                     std::initializer_list<Operand> ops) {
+  ops_.assign(ops);
+  EmitInst(Decode(inst), ops_);
+}
+
+
+void Assembler::EmitLabel(const std::string& label) {
+  auto& sym = symbols_[GetSymbol(label)];
+  if (sym.section_ != SEC_UNDEF || sym.common_)
+    Error("assembler: symbol '%s' is already defined", label.c_str());
+  sym.section_ = cur_;
+  sym.value_ = cur_ == SEC_BSS ? sections_[cur_].size_: Offset();
+}
+
+
+int Assembler::GetSymbol(const std::string& name) {
+  auto iter = symbolMap_.find(name);
+  if (iter != symbolMap_.end())
+    return iter->second;
+  symbols_.push_back(Symbol());
+  symbols_.back().name_ = name;
+  symbolMap_[name] = symbols_.size() - 1;
+  return symbols_.size() - 1;
+}
+
+
+/*
+ * Directives
+ */
+
+void Assembler::EmitDirective(const std::string& name,
+                              const std::vector<std::string>& args) {
+  auto expect = [&](size_t n) {
+    if (args.size() != n)
+      Error("assembler: bad arguments of '%s'", name.c_str());
+  };
+
+  if (name == ".text") {
+    cur_ = SEC_TEXT;
+  } else if (name == ".data") {
+    cur_ = SEC_DATA;
+  } else if (name == ".bss") {
+    cur_ = SEC_BSS;
+  } else if (name == ".section") {
+    expect(1);
+    if (args[0] == ".text") cur_ = SEC_TEXT;
+    else if (args[0] == ".data") cur_ = SEC_DATA;
+    else if (args[0] == ".bss") cur_ = SEC_BSS;
+    else if (args[0] == ".rodata") cur_ = SEC_RODATA;
+    else Error("assembler: unsupported section '%s'", args[0].c_str());
+  } else if (name == ".file") {
+    // '.file 1 "name"' is debug information
+    if (args.size() == 1 && args[0].size() >= 2 && args[0][0] == '"')
+      filename_ = args[0].substr(1, args[0].size() - 2);
+  } else if (name == ".globl" || name == ".global") {
+    expect(1);
+    symbols_[GetSymbol(args[0])].global_ = true;
+  } else if (name == ".local") {
+    expect(1);
+    symbols_[GetSymbol(args[0])].local_ = true;
+  } else if (name == ".type") {
+    expect(2);
+    auto& sym = symbols_[GetSymbol(args[0])];
+    if (args[1] == "@function")
+      sym.type_ = STT_FUNC;
+    else if (args[1] == "@object")
+      sym.type_ = STT_OBJECT;
+  } else if (name == ".size") {
+    expect(2);
+    symbols_[GetSymbol(args[0])].size_ = ParseNumber(args[1]);
+  } else if (name == ".comm") {
+    EmitComm(args);
+  } else if (name == ".align" || name == ".p2align") {
+    expect(1);
+    auto align = ParseNumber(args[0]);
+    Align(name == ".align" ? align: 1L << align);
+  } else if (name == ".zero") {
+    expect(1);
+    auto size = ParseNumber(args[0]);
+    if (cur_ == SEC_BSS) {
+      sections_[cur_].size_ += size;
+    } else {
+      sections_[cur_].data_.resize(Offset() + size, 0);
+    }
+  } else if (name == ".byte") {
+    for (const auto& arg: args) EmitData(1, arg);
+  } else if (name == ".value" || name == ".short") {
+    for (const auto& arg: args) EmitData(2, arg);
+  } else if (name == ".long") {
+    for (const auto& arg: args) EmitData(4, arg);
+  } else if (name == ".quad") {
+    for (const auto& arg: args) EmitData(8, arg);
+  } else if (name == ".string" || name == ".asciz") {
+    for (const auto& arg: args) {
+      EmitString(arg);
+      Byte(0);
+    }
+  } else if (name == ".ascii") {
+    for (const auto& arg: args) EmitString(arg);
+  } else {
+    Error("assembler: unsupported directive '%s'", name.c_str());
+  }
+}
+
+
+void Assembler::Align(size_t align) {
+  if (align == 0 || (align & (align - 1)))
+    Error("assembler: alignment is not a power of 2");
+  auto& sec = sections_[cur_];
+  sec.align_ = std::max(sec.align_, align);
+  if (cur_ == SEC_BSS) {
+    sec.size_ = (sec.size_ + align - 1) / align * align;
+    return;
+  }
+  while (Offset() % align)
+    Byte(cur_ == SEC_TEXT ? 0x90: 0);
+}
+
+
+void Assembler::EmitComm(const std::vector<std::string>& args) {
+  if (args.size() < 2)
+    Error("assembler: bad arguments of '.comm'");
+  auto size = ParseNumber(args[1]);
+  auto align = args.size() > 2 ? ParseNumber(args[2]): 1;
+  auto& sym = symbols_[GetSymbol(args[0])];
+  if (sym.section_ != SEC_UNDEF || sym.common_)
+    Error("assembler: symbol '%s' is already defined", args[0].c_str());
+
+  if (sym.local_) {
+    // Local common symbol is allocated in .bss
+    auto cur = cur_;
+    cur_ = SEC_BSS;
+    Align(align);
+    EmitLabel(args[0]);
+    sections_[SEC_BSS].size_ += size;
+    cur_ = cur;
+  } else {
+    sym.common_ = true;
+    sym.align_ = align;
+  }
+  sym.size_ = size;
+  sym.type_ = STT_OBJECT;
+}
+
+
+void Assembler::EmitData(int width, const std::string& expr) {
+  if (cur_ == SEC_BSS)
+    Error("assembler: initialized data in .bss");
+  long val;
+  std::string sym;
+  ParseDisp(expr, val, sym);
+  if (sym.size()) {
+    AddReloc(sym, val, width == 8 ? R_ABS64: R_ABS32);
+    val = 0;
+  }
+  EmitImm(val, width);
+}
+
+
+void Assembler::EmitString(const std::string& literal) {
+  if (literal.size() < 2 || literal.front() != '"' || literal.back() != '"')
+    Error("assembler: bad string '%s'", literal.c_str());
+  auto end = literal.size() - 1;
+  for (size_t i = 1; i < end; ++i) {
+    int c = literal[i];
+    if (c != '\\') {
+      Byte(c);
+      continue;
+    }
+    c = literal[++i];
+    switch (c) {
+    case 'x': {
+      int val = 0;
+      while (i + 1 < end && isxdigit(literal[i + 1])) {
+        auto d = literal[++i];
+        val = (val << 4) + (isdigit(d) ? d - '0': tolower(d) - 'a' + 10);
+      }
+      Byte(val);
+    } break;
+    case '0' ... '7': {
+      int val = c - '0';
+      for (int n = 1; n < 3 && i + 1 < end && '0' <= literal[i + 1]
+           && literal[i + 1] <= '7'; ++n) {
+        val = (val << 3) + literal[++i] - '0';
+      }
+      Byte(val);
+    } break;
+    case 'n': Byte('\n'); break;
+    case 't': Byte('\t'); break;
+    case 'r': Byte('\r'); break;
+    case 'b': Byte('\b'); break;
+    case 'f': Byte('\f'); break;
+    case 'v': Byte('\v'); break;
+    case 'a': Byte('\a'); break;
+    default: Byte(c); break;
+    }
+  }
+}
+
+
+/*
+ * Operands
+ */
+
+void Assembler::ParseDisp(const std::string& str,
+                          long& val,
+                          std::string& sym) {
+  val = 0;
+  sym.clear();
+  if (str.empty())
+    return;
+  if (isdigit(str[0]) || str[0] == '-' || str[0] == '+') {
+    val = ParseNumber(str);
+    return;
+  }
+  auto pos = str.find_first_of("+-", 1);
+  sym = str.substr(0, pos);
+  if (pos != std::string::npos)
+    val = ParseNumber(str.substr(pos));
+}
+
+
+Assembler::Operand Assembler::ParseOperand(const std::string& str) {
+  Operand op;
+  auto s = str;
+  if (s.size() && s[0] == '*') {
+    op.indirect_ = true;
+    s = s.substr(1);
+  }
+  if (s.empty())
+    Error("assembler: missing operand");
+
+  if (s[0] == '%') {
+    auto iter = regMap.find(s.substr(1));
+    if (iter == regMap.end())
+      Error("assembler: bad register '%s'", s.c_str());
+    op.kind_ = iter->second.width_ ? Operand::REG: Operand::XMM;
+    op.reg_ = iter->second.num_;
+    op.width_ = iter->second.width_;
+    op.rex_ = iter->second.rex_;
+  } else if (s[0] == '$') {
+    op.kind_ = Operand::IMM;
+    ParseDisp(s.substr(1), op.val_, op.sym_);
+    if (op.sym_.size())
+      Error("assembler: symbolic immediate '%s' is not supported", s.c_str());
+  } else {
+    auto lpar = s.find('(');
+    long val;
+    std::string sym;
+    ParseDisp(s.substr(0, lpar), val, sym);
+    std::string base;
+    if (lpar != std::string::npos) {
+      auto rpar = s.find(')', lpar);
+      if (rpar == std::string::npos || s[lpar + 1] != '%')
+        Error("assembler: bad memory operand '%s'", s.c_str());
+      base = s.substr(lpar + 1, rpar - lpar - 1);
+    }
+    auto indirect = op.indirect_;
+    op = Mem(sym, base, val);
+    op.indirect_ = indirect;
+  }
+  return op;
+}
+
+
+const Assembler::Operand& Assembler::GetOperand(const std::string& str) {
+  auto iter = operands_.find(str);
+  if (iter == operands_.end())
+    iter = operands_.emplace(str, ParseOperand(str)).first;
+  return iter->second;
+}
+
+
+Assembler::Operand Assembler::Mem(const std::string& sym,
+                                  const std::string& base,
+                                  long disp) {
+  Operand op;
+  op.kind_ = Operand::MEM;
+  op.val_ = disp;
+  op.sym_ = sym;
+  if (base.empty()) {
+    op.reg_ = NO_BASE;
+  } else if (base == "%rip") {
+    op.reg_ = RIP;
+  } else {
+    auto iter = regMap.find(base.substr(1));
+    if (iter == regMap.end() || iter->second.width_ != 8)
+      Error("assembler: bad base register '%s'", base.c_str());
+    op.reg_ = iter->second.num_;
+  }
+  return op;
+}
+
+
+Assembler::Operand Assembler::Imm(long val) {
+  Operand op;
+  op.kind_ = Operand::IMM;
+  op.val_ = val;
+  return op;
+}
+
+
+/*
+ * Encoding
+ */
+
+void Assembler::EmitImm(long val, int width) {
+  for (int i = 0; i < width; ++i) {
+    Byte(val & 0xff);
+    val >>= 8;
+  }
+}
+
+
+void Assembler::AddReloc(const std::string& sym, long addend, RelocType type) {
+  sections_[cur_].relocs_.push_back({Offset(), type, GetSymbol(sym), addend});
+}
+
+
+void Assembler::EmitRel32(const std::string& sym, RelocType type) {
+  AddReloc(sym, -4, type);
+  EmitImm(0, 4);
+}
+
+
+/*
+ * Emit: [prefix] [REX] opcode ModRM [SIB] [disp]
+ * The immediate, if any, is emitted by the caller;
+ * 'immWidth' is needed by %rip relative addressing.
+ */
+void Assembler::EmitOp(int prefix, bool rexW,
+                       std::initializer_list<uint8_t> opcode,
+                       int reg, bool regRex, const Operand& rm, int immWidth) {
+  if (rm.kind_ == Operand::IMM)
+    Error("assembler: unexpected immediate operand");
+
+  int rex = 0;
+  if (rexW) rex |= 0x08;
+  if (reg >= 8) rex |= 0x04;
+  if (rm.kind_ != Operand::MEM) {
+    if (rm.reg_ >= 8) rex |= 0x01;
+  } else if (rm.reg_ >= 8 && rm.reg_ != RIP) {
+    rex |= 0x01;
+  }
+
+  if (prefix)
+    Byte(prefix);
+  if (rex || regRex || rm.rex_)
+    Byte(0x40 | rex);
+  for (auto b: opcode)
+    Byte(b);
+
+  reg = (reg & 7) << 3;
+  if (rm.kind_ != Operand::MEM) {
+    Byte(0xC0 | reg | (rm.reg_ & 7));
+  } else if (rm.reg_ == NO_BASE) {
+    // Absolute address: SIB with no base and no index
+    Byte(0x04 | reg);
+    Byte(0x25);
+    if (rm.sym_.size()) {
+      AddReloc(rm.sym_, rm.val_, R_ABS32S);
+      EmitImm(0, 4);
+    } else {
+      EmitImm(rm.val_, 4);
+    }
+  } else if (rm.reg_ == RIP) {
+    Byte(0x05 | reg);
+    if (rm.sym_.size()) {
+      AddReloc(rm.sym_, rm.val_ - 4 - immWidth, R_PC32);
+      EmitImm(0, 4);
+    } else {
+      EmitImm(rm.val_, 4);
+    }
+  } else {
+    if (rm.sym_.size())
+      Error("assembler: symbolic displacement with base register");
+    auto base = rm.reg_ & 7;
+    int mod = 2;
+    if (rm.val_ == 0 && base != 5)
+      mod = 0;
+    else if (FitsInt8(rm.val_))
+      mod = 1;
+    Byte((mod << 6) | reg | (base == 4 ? 4: base));
+    if (base == 4)
+      Byte(0x24);
+    if (mod == 1)
+      EmitImm(rm.val_, 1);
+    else if (mod == 2)
+      EmitImm(rm.val_, 4);
+  }
+}
+
+
+/*
+ * The kind of a mnemonic, tried in the order of: setcc, push and pop,
+ * instructions without operand, jumps, SSE, extensions, and then the
+ * arithmetic ones with their size suffix.
+ */
+const Assembler::Inst& Assembler::Decode(const std::string& name) {
+  auto iter = insts_.find(name);
+  if (iter != insts_.end())
+    return iter->second;
+
+  static const std::unordered_map<std::string, std::vector<uint8_t>> codes {
+    {"leave", {0xC9}}, {"leaveq", {0xC9}},
+    {"ret", {0xC3}}, {"retq", {0xC3}},
+    {"cltq", {0x48, 0x98}}, {"cwtl", {0x98}},
+    {"cltd", {0x99}}, {"cqto", {0x48, 0x99}},
+    {"nop", {0x90}},
+  };
+
+  Inst inst;
+  inst.name_ = name;
+  auto cc = ccMap.end();
+  auto code = codes.find(name);
+  auto sse = sseMap.find(name);
+  if (name.compare(0, 3, "set") == 0
+      && (cc = ccMap.find(name.substr(3))) != ccMap.end()) {
+    inst.kind_ = Inst::SETCC;
+    inst.code_ = cc->second;
+  } else if (name == "push" || name == "pushq") {
+    inst.kind_ = Inst::PUSH;
+  } else if (name == "pop" || name == "popq") {
+    inst.kind_ = Inst::POP;
+  } else if (code != codes.end()) {
+    inst.kind_ = Inst::CODES;
+    inst.bytes_ = code->second;
+  } else if (name == "jmp") {
+    inst.kind_ = Inst::JMP;
+  } else if (name == "call" || name == "callq") {
+    inst.kind_ = Inst::CALL;
+  } else if (name[0] == 'j'
+             && (cc = ccMap.find(name.substr(1))) != ccMap.end()) {
+    inst.kind_ = Inst::JCC;
+    inst.code_ = cc->second;
+  } else if (name == "movq" || name == "movd") {
+    // 'movq' between general purpose registers and memory is 'mov'
+    inst.kind_ = Inst::MOVQD;
+    inst.width_ = 8;
+  } else if (sse != sseMap.end()) {
+    inst.kind_ = Inst::SSE;
+    inst.sse_ = &sse->second;
+  } else if (name.size() == 6 && name.compare(0, 3, "mov") == 0
+             && (name[3] == 'z' || name[3] == 's')) {
+    // movzbw, movzbl, movzbq, movzwl, movzwq, movsbw, ..., movslq
+    inst.kind_ = Inst::EXTEND;
+  } else {
+    // Find the longest base mnemonic; the rest is the size suffix
+    std::string base;
+    for (auto arithm: arithms) {
+      auto len = strlen(arithm);
+      if (name.compare(0, len, arithm) == 0 && name.size() <= len + 1
+          && len > base.size()) {
+        base = arithm;
+      }
+    }
+    if (base.empty())
+      Error("assembler: unsupported instruction '%s'", name.c_str());
+    if (name.size() > base.size()) {
+      switch (name.back()) {
+      case 'b': inst.width_ = 1; break;
+      case 'w': inst.width_ = 2; break;
+      case 'l': inst.width_ = 4; break;
+      case 'q': inst.width_ = 8; break;
+      default:
+        Error("assembler: bad instruction suffix '%s'", name.c_str());
+      }
+    }
+
+    auto alu = aluMap.find(base);
+    auto shift = shiftMap.find(base);
+    auto unary = unaryMap.find(base);
+    if (alu != aluMap.end()) {
+      inst.kind_ = Inst::ALU;
+      inst.code_ = alu->second;
+    } else if (shift != shiftMap.end()) {
+      inst.kind_ = Inst::SHIFT;
+      inst.code_ = shift->second;
+    } else if (unary != unaryMap.end()) {
+      inst.kind_ = Inst::UNARY;
+      inst.code_ = unary->second;
+    } else if (base == "mov") {
+      inst.kind_ = Inst::MOV;
+    } else if (base == "imul") {
+      inst.kind_ = Inst::IMUL;
+    } else if (base == "lea") {
+      inst.kind_ = Inst::LEA;
+    } else {
+      inst.kind_ = Inst::TEST;
+    }
+  }
+  return insts_.emplace(name, inst).first->second;
+}
+
+
+void Assembler::EmitInst(const Inst& inst, OperandList& ops) {
+  switch (inst.kind_) {
+  case Inst::SETCC:
+  case Inst::PUSH:
+  case Inst::POP:
+  case Inst::CODES:
+    return EmitMisc(inst, ops);
+  case Inst::JCC:
+  case Inst::JMP:
+  case Inst::CALL:
+    return EmitJump(inst, ops);
+  case Inst::MOVQD:
+  case Inst::SSE:
+    return EmitSSE(inst, ops);
+  case Inst::EXTEND:
+    return EmitExtend(inst, ops);
+  default:
+    return EmitArithm(inst, ops);
+  }
+}
+
+
+// The suffix, else the destination register decides the width
+int Assembler::Width(const Inst& inst, const OperandList& ops) {
+  if (inst.width_)
+    return inst.width_;
+  for (auto iter = ops.rbegin(); iter != ops.rend(); ++iter) {
+    if (iter->kind_ == Operand::REG)
+      return iter->width_;
+  }
+  Error("assembler: ambiguous operand size '%s'", inst.name_.c_str());
+  return 0; // Make compiler happy
+}
+
+
+void Assembler::EmitArithm(const Inst& inst, OperandList& ops) {
+  auto width = Width(inst, ops);
+  auto prefix = width == 2 ? 0x66: 0;
+  auto rexW = width == 8;
+  auto expect = [&](size_t n) {
+    if (ops.size() != n)
+      Error("assembler: bad operands of '%s'", inst.name_.c_str());
+  };
+
+  switch (inst.kind_) {
+  case Inst::ALU:
+    expect(2);
+    return EmitALU(inst.code_, width, ops);
+  case Inst::SHIFT:
+    return EmitShift(inst.code_, width, ops);
+  case Inst::UNARY:
+    expect(1);
+    return EmitOp(prefix, rexW, {uint8_t(width == 1 ? 0xF6: 0xF7)},
+                  inst.code_, false, ops[0]);
+  case Inst::MOV:
+    expect(2);
+    return EmitMov(width, ops);
+  case Inst::IMUL:
+    return EmitImul(width, ops);
+  case Inst::LEA:
+    expect(2);
+    if (ops[0].kind_ != Operand::MEM || ops[1].kind_ != Operand::REG)
+      Error("assembler: bad operands of 'lea'");
+    return EmitOp(prefix, rexW, {0x8D}, ops[1].reg_, false, ops[0]);
+  default:
+    break;
+  }
+
+  // test
+  expect(2);
+  auto& src = ops[0];
+  auto& des = ops[1];
+  if (src.kind_ == Operand::IMM) {
+    EmitOp(prefix, rexW, {uint8_t(width == 1 ? 0xF6: 0xF7)},
+           0, false, des, std::min(width, 4));
+    EmitImm(src.val_, std::min(width, 4));
+  } else if (src.kind_ == Operand::REG) {
+    EmitOp(prefix, rexW, {uint8_t(width == 1 ? 0x84: 0x85)},
+           src.reg_, src.rex_, des);
+  } else {
+    EmitOp(prefix, rexW, {uint8_t(width == 1 ? 0x84: 0x85)},
+           des.reg_, des.rex_, src);
+  }
+}
+
+
+void Assembler::EmitALU(int ext, int width, OperandList& ops) {
+  auto prefix = width == 2 ? 0x66: 0;
+  auto rexW = width == 8;
+  auto& src = ops[0];
+  auto& des = ops[1];
+  if (src.kind_ == Operand::IMM) {
+    auto val = Truncate(src.val_, width);
+    if (!FitsInt32(val))
+      Error("assembler: immediate out of range");
+    if (width == 1) {
+      EmitOp(prefix, rexW, {0x80}, ext, false, des, 1);
+      EmitImm(val, 1);
+    } else if (FitsInt8(val)) {
+      EmitOp(prefix, rexW, {0x83}, ext, false, des, 1);
+      EmitImm(val, 1);
+    } else {
+      auto immWidth = width == 2 ? 2: 4;
+      EmitOp(prefix, rexW, {0x81}, ext, false, des, immWidth);
+      EmitImm(val, immWidth);
+    }
+  } else if (src.kind_ == Operand::MEM) {
+    if (des.kind_ != Operand::REG)
+      Error("assembler: bad operands");
+    uint8_t op = ext * 8 + (width == 1 ? 2: 3);
+    EmitOp(prefix, rexW, {op}, des.reg_, des.rex_, src);
+  } else {
+    uint8_t op = ext * 8 + (width == 1 ? 0: 1);
+    EmitOp(prefix, rexW, {op}, src.reg_, src.rex_, des);
+  }
+}
+
+
+void Assembler::EmitMov(int width, OperandList& ops) {
+  auto prefix = width == 2 ? 0x66: 0;
+  auto rexW = width == 8;
+  auto& src = ops[0];
+  auto& des = ops[1];
+  if (src.kind_ == Operand::IMM) {
+    if (des.kind_ == Operand::REG
+        && (width != 8 || !FitsInt32(src.val_))) {
+      // mov $imm, reg; movabs for 64 bits immediate
+      if (prefix)
+        Byte(prefix);
+      if (rexW || des.reg_ >= 8 || des.rex_)
+        Byte(0x40 | (rexW ? 0x08: 0) | (des.reg_ >= 8 ? 0x01: 0));
+      Byte((width == 1 ? 0xB0: 0xB8) + (des.reg_ & 7));
+      EmitImm(src.val_, width);
+    } else {
+      auto immWidth = std::min(width, 4);
+      EmitOp(prefix, rexW, {uint8_t(width == 1 ? 0xC6: 0xC7)},
+             0, false, des, immWidth);
+      EmitImm(src.val_, immWidth);
+    }
+  } else if (src.kind_ == Operand::MEM) {
+    if (des.kind_ != Operand::REG)
+      Error("assembler: bad operands of 'mov'");
+    EmitOp(prefix, rexW, {uint8_t(width == 1 ? 0x8A: 0x8B)},
+           des.reg_, des.rex_, src);
+  } else {
+    EmitOp(prefix, rexW, {uint8_t(width == 1 ? 0x88: 0x89)},
+           src.reg_, src.rex_, des);
+  }
+}
+
+
+void Assembler::EmitShift(int ext, int width, OperandList& ops) {
+  auto prefix = width == 2 ? 0x66: 0;
+  auto rexW = width == 8;
+  auto byte = width == 1;
+  if (ops.size() == 1) {
+    EmitOp(prefix, rexW, {uint8_t(byte ? 0xD0: 0xD1)}, ext, false, ops[0]);
+  } else if (ops.size() != 2) {
+    Error("assembler: bad operands of shift");
+  } else if (ops[0].kind_ == Operand::REG) {
+    if (ops[0].reg_ != 1 || ops[0].width_ != 1)
+      Error("assembler: shift count must be %%cl");
+    EmitOp(prefix, rexW, {uint8_t(byte ? 0xD2: 0xD3)}, ext, false, ops[1]);
+  } else if (ops[0].kind_ == Operand::IMM && ops[0].val_ == 1) {
+    EmitOp(prefix, rexW, {uint8_t(byte ? 0xD0: 0xD1)}, ext, false, ops[1]);
+  } else if (ops[0].kind_ == Operand::IMM) {
+    EmitOp(prefix, rexW, {uint8_t(byte ? 0xC0: 0xC1)}, ext, false, ops[1], 1);
+    EmitImm(ops[0].val_, 1);
+  } else {
+    Error("assembler: bad operands of shift");
+  }
+}
+
+
+void Assembler::EmitImul(int width, OperandList& ops) {
+  auto prefix = width == 2 ? 0x66: 0;
+  auto rexW = width == 8;
+  if (ops.size() == 1) {
+    EmitOp(prefix, rexW, {uint8_t(width == 1 ? 0xF6: 0xF7)}, 5, false, ops[0]);
+    return;
+  }
+  auto& des = ops.back();
+  if (des.kind_ != Operand::REG || width == 1)
+    Error("assembler: bad operands of 'imul'");
+  if (ops[0].kind_ == Operand::IMM) {
+    // imul $imm, reg is imul $imm, reg, reg
+    auto& src = ops.size() == 3 ? ops[1]: des;
+    auto val = Truncate(ops[0].val_, width);
+    if (FitsInt8(val)) {
+      EmitOp(prefix, rexW, {0x6B}, des.reg_, false, src, 1);
+      EmitImm(val, 1);
+    } else {
+      auto immWidth = width == 2 ? 2: 4;
+      EmitOp(prefix, rexW, {0x69}, des.reg_, false, src, immWidth);
+      EmitImm(val, immWidth);
+    }
+  } else if (ops.size() == 2) {
+    EmitOp(prefix, rexW, {0x0F, 0xAF}, des.reg_, false, ops[0]);
+  } else {
+    Error("assembler: bad operands of 'imul'");
+  }
+}
+
+
+void Assembler::EmitMisc(const Inst& inst, OperandList& ops) {
+  auto name = inst.name_.c_str();
+  if (inst.kind_ == Inst::SETCC) {
+    if (ops.size() != 1)
+      Error("assembler: bad operands of '%s'", name);
+    EmitOp(0, false, {0x0F, uint8_t(0x90 + inst.code_)}, 0, false, ops[0]);
+  } else if (inst.kind_ == Inst::CODES) {
+    for (auto b: inst.bytes_)
+      Byte(b);
+  } else {
+    if (ops.size() != 1 || ops[0].kind_ != Operand::REG)
+      Error("assembler: bad operands of '%s'", name);
+    if (ops[0].reg_ >= 8)
+      Byte(0x41);
+    Byte((inst.kind_ == Inst::PUSH ? 0x50: 0x58) + (ops[0].reg_ & 7));
+  }
+}
+
+
+void Assembler::EmitJump(const Inst& inst, OperandList& ops) {
+  auto name = inst.name_.c_str();
+  if (ops.size() != 1)
+    Error("assembler: bad operands of '%s'", name);
+
+  auto& target = ops[0];
+  if (target.indirect_) {
+    if (inst.kind_ == Inst::JCC)
+      Error("assembler: bad operands of '%s'", name);
+    // Default operand size is 64 bits
+    EmitOp(0, false, {0xFF}, inst.kind_ == Inst::JMP ? 4: 2, false, target);
+    return;
+  }
+  if (target.kind_ != Operand::MEM || target.reg_ != NO_BASE
+      || target.sym_.empty() || target.val_ != 0) {
+    Error("assembler: bad operands of '%s'", name);
+  }
+
+  if (inst.kind_ == Inst::JCC) {
+    Byte(0x0F);
+    Byte(0x80 + inst.code_);
+    EmitRel32(target.sym_, R_PC32);
+  } else if (inst.kind_ == Inst::JMP) {
+    Byte(0xE9);
+    EmitRel32(target.sym_, R_PC32);
+  } else {
+    Byte(0xE8);
+    EmitRel32(target.sym_, R_PLT32);
+  }
+}
+
+
+void Assembler::EmitExtend(const Inst& inst, OperandList& ops) {
+  auto name = inst.name_.c_str();
+  auto from = inst.name_[4];
+  auto to = inst.name_[5];
+  if (ops.size() != 2 || ops[1].kind_ != Operand::REG)
+    Error("assembler: bad operands of '%s'", name);
+
+  auto prefix = to == 'w' ? 0x66: 0;
+  auto rexW = to == 'q';
+  auto sign = inst.name_[3] == 's';
+  auto& src = ops[0];
+  auto& des = ops[1];
+  if (from == 'b') {
+    EmitOp(prefix, rexW, {0x0F, uint8_t(sign ? 0xBE: 0xB6)},
+           des.reg_, false, src);
+  } else if (from == 'w') {
+    EmitOp(prefix, rexW, {0x0F, uint8_t(sign ? 0xBF: 0xB7)},
+           des.reg_, false, src);
+  } else if (from == 'l' && sign && rexW) {
+    EmitOp(0, true, {0x63}, des.reg_, false, src);
+  } else {
+    Error("assembler: unsupported instruction '%s'", name);
+  }
+}
+
+
+void Assembler::EmitSSE(const Inst& inst, OperandList& ops) {
+  auto name = inst.name_.c_str();
+  if (inst.kind_ == Inst::MOVQD) {
+    if (ops.size() != 2 || (ops[0].kind_ != Operand::XMM
+                            && ops[1].kind_ != Operand::XMM)) {
+      if (inst.name_ == "movd")
+        Error("assembler: bad instruction suffix '%s'", name);
+      Inst mov;
+      mov.kind_ = Inst::MOV;
+      mov.name_ = inst.name_;
+      mov.width_ = 8;
+      return EmitArithm(mov, ops);
+    }
+    auto q = inst.name_ == "movq";
+    auto& src = ops[0];
+    auto& des = ops[1];
+    if (src.kind_ == Operand::XMM && des.kind_ == Operand::XMM) {
+      EmitOp(0xF3, false, {0x0F, 0x7E}, des.reg_, false, src);
+    } else if (des.kind_ == Operand::XMM && src.kind_ == Operand::REG) {
+      EmitOp(0x66, q, {0x0F, 0x6E}, des.reg_, false, src);
+    } else if (src.kind_ == Operand::XMM && des.kind_ == Operand::REG) {
+      EmitOp(0x66, q, {0x0F, 0x7E}, src.reg_, false, des);
+    } else if (des.kind_ == Operand::XMM) {
+      EmitOp(q ? 0xF3: 0x66, false, {0x0F, uint8_t(q ? 0x7E: 0x6E)},
+             des.reg_, false, src);
+    } else {
+      EmitOp(0x66, false, {0x0F, uint8_t(q ? 0xD6: 0x7E)},
+             src.reg_, false, des);
+    }
+    return;
+  }
+
+  const auto& info = *inst.sse_;
+  if (ops.size() != 2)
+    Error("assembler: bad operands of '%s'", name);
+  auto& src = ops[0];
+  auto& des = ops[1];
+
+  switch (info.kind_) {
+  case SSE_MOVE:
+    if (des.kind_ == Operand::XMM) {
+      EmitOp(info.prefix_, false, {0x0F, info.op_}, des.reg_, false, src);
+    } else if (src.kind_ == Operand::XMM) {
+      EmitOp(info.prefix_, false, {0x0F, info.storeOp_}, src.reg_, false, des);
+    } else {
+      Error("assembler: bad operands of '%s'", name);
+    }
+    break;
+  case SSE_ARITHM:
+    if (des.kind_ != Operand::XMM || src.kind_ == Operand::REG)
+      Error("assembler: bad operands of '%s'", name);
+    EmitOp(info.prefix_, false, {0x0F, info.op_}, des.reg_, false, src);
+    break;
+  case SSE_CVTSI2: {
+    if (des.kind_ != Operand::XMM || src.kind_ == Operand::XMM)
+      Error("assembler: bad operands of '%s'", name);
+    auto rexW = inst.name_.back() == 'q'
+        || (src.kind_ == Operand::REG && src.width_ == 8);
+    EmitOp(info.prefix_, rexW, {0x0F, info.op_}, des.reg_, false, src);
+  } break;
+  case SSE_CVT2SI:
+    if (des.kind_ != Operand::REG || src.kind_ == Operand::REG)
+      Error("assembler: bad operands of '%s'", name);
+    EmitOp(info.prefix_, des.width_ == 8, {0x0F, info.op_},
+           des.reg_, false, src);
+    break;
+  }
+}
+
+
+/*
+ * ELF64 relocatable object
+ */
+
+static void Append(std::vector<uint8_t>& buf, const void* data, size_t size) {
+  auto p = static_cast<const uint8_t*>(data);
+  buf.insert(buf.end(), p, p + size);
+}
+
+
+static size_t AddString(std::string& strtab, const std::string& str) {
+  auto ret = strtab.size();
+  strtab += str;
+  strtab.push_back(0);
+  return ret;
+}
+
+
+void Assembler::WriteObject(FILE* fp) {
+  static const char* secNames[SEC_NUM] = {
+    ".text", ".data", ".bss", ".rodata"
+  };
+  static const Elf64_Xword secFlags[SEC_NUM] = {
+    SHF_ALLOC | SHF_EXECINSTR,
+    SHF_ALLOC | SHF_WRITE,
+    SHF_ALLOC | SHF_WRITE,
+    SHF_ALLOC
+  };
+
+  // Resolve pc relative relocations to local symbols in the same section
+  for (int i = 0; i < SEC_NUM; ++i) {
+    auto& sec = sections_[i];
+    std::vector<Reloc> relocs;
+    for (const auto& reloc: sec.relocs_) {
+      const auto& sym = symbols_[reloc.sym_];
+      if ((reloc.type_ == R_PC32 || reloc.type_ == R_PLT32)
+          && sym.section_ == i && !sym.global_) {
+        long val = sym.value_ + reloc.addend_ - reloc.offset_;
+        for (int k = 0; k < 4; ++k)
+          sec.data_[reloc.offset_ + k] = (val >> (8 * k)) & 0xff;
+      } else {
+        relocs.push_back(reloc);
+      }
+    }
+    sec.relocs_.swap(relocs);
+  }
+
+  // Section headers, except the section name
+  std::vector<Elf64_Shdr> shdrs(1);
+  std::vector<std::string> shnames(1);
+  std::vector<std::vector<uint8_t>> contents(1);
+  int secIndex[SEC_NUM];
+  int relaOf[SEC_NUM];
+  auto addSection = [&](const std::string& name, Elf64_Word type,
+                        Elf64_Xword flags, Elf64_Xword align) {
+    Elf64_Shdr shdr;
+    memset(&shdr, 0, sizeof(shdr));
+    shdr.sh_type = type;
+    shdr.sh_flags = flags;
+    shdr.sh_addralign = align;
+    shdrs.push_back(shdr);
+    shnames.push_back(name);
+    contents.push_back(std::vector<uint8_t>());
+    return static_cast<int>(shdrs.size() - 1);
+  };
+
+  for (int i = 0; i < SEC_NUM; ++i) {
+    auto& sec = sections_[i];
+    auto type = i == SEC_BSS ? SHT_NOBITS: SHT_PROGBITS;
+    secIndex[i] = addSection(secNames[i], type, secFlags[i], sec.align_);
+    if (i == SEC_BSS) {
+      shdrs[secIndex[i]].sh_size = sec.size_;
+    } else {
+      contents[secIndex[i]] = sec.data_;
+    }
+    relaOf[i] = 0;
+    if (sec.relocs_.size()) {
+      relaOf[i] = addSection(std::string(".rela") + secNames[i],
+                             SHT_RELA, SHF_INFO_LINK, 8);
+    }
+  }
+  addSection(".note.GNU-stack", SHT_PROGBITS, 0, 1);
+  auto symtabIndex = addSection(".symtab", SHT_SYMTAB, 0, 8);
+  auto strtabIndex = addSection(".strtab", SHT_STRTAB, 0, 1);
+  auto shstrtabIndex = addSection(".shstrtab", SHT_STRTAB, 0, 1);
+
+  // Symbol table: locals first
+  std::string strtab(1, 0);
+  std::vector<Elf64_Sym> syms(1);
+  memset(&syms[0], 0, sizeof(syms[0]));
+  auto addSymbol = [&](const std::string& name, unsigned char bind,
+                       unsigned char type, Elf64_Section shndx,
+                       Elf64_Addr value, Elf64_Xword size) {
+    Elf64_Sym sym;
+    sym.st_name = name.size() ? AddString(strtab, name): 0;
+    sym.st_info = ELF64_ST_INFO(bind, type);
+    sym.st_other = STV_DEFAULT;
+    sym.st_shndx = shndx;
+    sym.st_value = value;
+    sym.st_size = size;
+    syms.push_back(sym);
+    return static_cast<int>(syms.size() - 1);
+  };
+
+  if (filename_.size())
+    addSymbol(filename_, STB_LOCAL, STT_FILE, SHN_ABS, 0, 0);
+  int secSym[SEC_NUM];
+  for (int i = 0; i < SEC_NUM; ++i)
+    secSym[i] = addSymbol("", STB_LOCAL, STT_SECTION, secIndex[i], 0, 0);
+
+  std::vector<int> symIndex(symbols_.size(), 0);
+  for (size_t i = 0; i < symbols_.size(); ++i) {
+    const auto& sym = symbols_[i];
+    if (sym.global_ || sym.common_ || sym.section_ == SEC_UNDEF)
+      continue;
+    // Local labels are referenced by section symbol
+    if (sym.name_.compare(0, 2, ".L") == 0)
+      continue;
+    symIndex[i] = addSymbol(sym.name_, STB_LOCAL, sym.type_,
+                            secIndex[sym.section_], sym.value_, sym.size_);
+  }
+  auto firstGlobal = syms.size();
+  for (size_t i = 0; i < symbols_.size(); ++i) {
+    const auto& sym = symbols_[i];
+    if (sym.common_) {
+      symIndex[i] = addSymbol(sym.name_, STB_GLOBAL, STT_OBJECT,
+                              SHN_COMMON, sym.align_, sym.size_);
+    } else if (sym.section_ == SEC_UNDEF) {
+      symIndex[i] = addSymbol(sym.name_, STB_GLOBAL, STT_NOTYPE,
+                              SHN_UNDEF, 0, 0);
+    } else if (sym.global_) {
+      symIndex[i] = addSymbol(sym.name_, STB_GLOBAL, sym.type_,
+                              secIndex[sym.section_], sym.value_, sym.size_);
+    }
+  }
+
+  // Relocations against local symbols go through the section symbol
+  for (int i = 0; i < SEC_NUM; ++i) {
+    if (!relaOf[i])
+      continue;
+    auto& buf = contents[relaOf[i]];
+    for (const auto& reloc: sections_[i].relocs_) {
+      const auto& sym = symbols_[reloc.sym_];
+      Elf64_Rela rela;
+      rela.r_offset = reloc.offset_;
+      rela.r_addend = reloc.addend_;
+      int index = symIndex[reloc.sym_];
+      if (!sym.global_ && !sym.common_ && sym.section_ != SEC_UNDEF) {
+        index = secSym[sym.section_];
+        rela.r_addend += sym.value_;
+      }
+      Elf64_Word type = R_X86_64_NONE;
+      switch (reloc.type_) {
+      case R_ABS64: type = R_X86_64_64; break;
+      case R_ABS32: type = R_X86_64_32; break;
+      case R_ABS32S: type = R_X86_64_32S; break;
+      case R_PC32: type = R_X86_64_PC32; break;
+      case R_PLT32: type = R_X86_64_PLT32; break;
+      }
+      rela.r_info = ELF64_R_INFO(index, type);
+      Append(buf, &rela, sizeof(rela));
+    }
+    shdrs[relaOf[i]].sh_link = symtabIndex;
+    shdrs[relaOf[i]].sh_info = secIndex[i];
+    shdrs[relaOf[i]].sh_entsize = sizeof(Elf64_Rela);
+  }
+
+  Append(contents[symtabIndex], syms.data(), syms.size() * sizeof(Elf64_Sym));
+  shdrs[symtabIndex].sh_link = strtabIndex;
+  shdrs[symtabIndex].sh_info = firstGlobal;
+  shdrs[symtabIndex].sh_entsize = sizeof(Elf64_Sym);
+  Append(contents[strtabIndex], strtab.data(), strtab.size());
+
+  std::string shstrtab(1, 0);
+  for (size_t i = 1; i < shdrs.size(); ++i)
+    shdrs[i].sh_name = AddString(shstrtab, shnames[i]);
+  Append(contents[shstrtabIndex], shstrtab.data(), shstrtab.size());
+
+  // Layout: ELF header, section contents, section header table
+  std::vector<uint8_t> out(sizeof(Elf64_Ehdr), 0);
+  for (size_t i = 1; i < shdrs.size(); ++i) {
+    auto align = std::max<size_t>(shdrs[i].sh_addralign, 1);
+    out.resize((out.size() + align - 1) / align * align, 0);
+    shdrs[i].sh_offset = out.size();
+    if (shdrs[i].sh_type != SHT_NOBITS) {
+      shdrs[i].sh_size = contents[i].size();
+      out.insert(out.end(), contents[i].begin(), contents[i].end());
+    }
+  }
+  out.resize((out.size() + 7) / 8 * 8, 0);
+
+  Elf64_Ehdr ehdr;
+  memset(&ehdr, 0, sizeof(ehdr));
+  memcpy(ehdr.e_ident, ELFMAG, SELFMAG);
+  ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+  ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+  ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+  ehdr.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+  ehdr.e_type = ET_REL;
+  ehdr.e_machine = EM_X86_64;
+  ehdr.e_version = EV_CURRENT;
+  ehdr.e_shoff = out.size();
+  ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+  ehdr.e_shentsize = sizeof(Elf64_Shdr);
+  ehdr.e_shnum = shdrs.size();
+  ehdr.e_shstrndx = shstrtabIndex;
+  memcpy(&out[0], &ehdr, sizeof(ehdr));
+  Append(out, shdrs.data(), shdrs.size() * sizeof(Elf64_Shdr));
+
+  if (fwrite(out.data(), 1, out.size(), fp) != out.size())
+    Error("assembler: failed to write object file");
+}
@@ -0,0 +1,178 @@
+#ifndef _WGTCC_ASSEMBLER_H_
+#define _WGTCC_ASSEMBLER_H_
+
+#include <cstdint>
+#include <cstdio>
+#include <initializer_list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+struct SSEInfo;
+
+
+/*
+ * Integrated assembler.
+ * It encodes the subset of AT&T x86-64 assembly that the Generator
+ * emits and writes an ELF64 relocatable object directly, so that
+ * neither the '.s' file nor an external assembler process is needed.
+ * The Generator hands instructions with their operands, only the
+ * directives are text. Unknown instructions or directives are
+ * internal errors.
+ */
+class Assembler {
+public:
+  struct Operand {
+    enum Kind {
+      REG,
+      XMM,
+      IMM,
+      MEM,
+    } kind_;
+    int reg_ {0};      // Register number; base register of MEM
+    int width_ {0};    // Width of general purpose register
+    long val_ {0};     // Immediate value or displacement
+    std::string sym_;  // Symbol of displacement
+    bool rex_ {false}; // Byte register that requires REX (%sil, etc.)
+    bool indirect_ {false};
+  };
+  typedef std::vector<Operand> OperandList;
+
+  Assembler();
+  ~Assembler() {}
+  Assembler(const Assembler& other) = delete;
+  Assembler& operator=(const Assembler& other) = delete;
+
+  // Feed one instruction or directive, formatted as the Generator emits
+  void Emit(const std::string& line);
+  // Feed one instruction without formatting it
+  void Emit(const std::string& inst, std::initializer_list<Operand> ops);
+  void EmitLabel(const std::string& label);
+  void WriteObject(FILE* fp);
+
+  // The operand formatted as 'str', parsed once
+  const Operand& GetOperand(const std::string& str);
+  // 'sym+disp(base)', the base register is '%rbp', '%rip', etc.
+  static Operand Mem(const std::string& sym, const std::string& base,
+                     long disp);
+  static Operand Imm(long val);
+
+private:
+  enum SectionId {
+    SEC_TEXT,
+    SEC_DATA,
+    SEC_BSS,
+    SEC_RODATA,
+    SEC_NUM,
+    SEC_UNDEF = -1,
+  };
+
+  enum RelocType {
+    R_ABS64,
+    R_ABS32,
+    R_ABS32S,
+    R_PC32,
+    R_PLT32,
+  };
+
+  // A mnemonic, decoded once
+  struct Inst {
+    enum Kind {
+      SETCC,
+      PUSH,
+      POP,
+      CODES,
+      JCC,
+      JMP,
+      CALL,
+      MOVQD,
+      SSE,
+      EXTEND,
+      ALU,
+      SHIFT,
+      UNARY,
+      MOV,
+      IMUL,
+      LEA,
+      TEST,
+    } kind_;
+    std::string name_;
+    int code_ {0};  // Condition code or opcode extension
+    int width_ {0}; // Width of the suffix, 0 if decided by the operands
+    const SSEInfo* sse_ {nullptr};
+    std::vector<uint8_t> bytes_; // Encoding of CODES
+  };
+
+  struct Reloc {
+    size_t offset_;
+    RelocType type_;
+    int sym_;
+    long addend_;
+  };
+
+  struct Section {
+    std::vector<uint8_t> data_;
+    size_t size_ {0}; // Only for .bss
+    size_t align_ {1};
+    std::vector<Reloc> relocs_;
+  };
+
+  struct Symbol {
+    std::string name_;
+    int section_ {SEC_UNDEF};
+    size_t value_ {0};
+    size_t size_ {0};
+    unsigned char type_ {0};
+    bool global_ {false};
+    bool local_ {false};
+    bool common_ {false};
+    size_t align_ {0}; // Only for common symbols
+  };
+
+  // Directives
+  void EmitDirective(const std::string& name,
+                     const std::vector<std::string>& args);
+  void EmitData(int width, const std::string& expr);
+  void EmitString(const std::string& literal);
+  void EmitComm(const std::vector<std::string>& args);
+  void Align(size_t align);
+
+  // Instructions
+  const Inst& Decode(const std::string& name);
+  void EmitInst(const Inst& inst, OperandList& ops);
+  void EmitMisc(const Inst& inst, OperandList& ops);
+  void EmitJump(const Inst& inst, OperandList& ops);
+  void EmitSSE(const Inst& inst, OperandList& ops);
+  void EmitExtend(const Inst& inst, OperandList& ops);
+  void EmitArithm(const Inst& inst, OperandList& ops);
+  void EmitALU(int ext, int width, OperandList& ops);
+  void EmitMov(int width, OperandList& ops);
+  void EmitShift(int ext, int width, OperandList& ops);
+  void EmitImul(int width, OperandList& ops);
+
+  // Encoding
+  void EmitOp(int prefix, bool rexW, std::initializer_list<uint8_t> opcode,
+              int reg, bool regRex, const Operand& rm, int immWidth=0);
+  void EmitImm(long val, int width);
+  void EmitRel32(const std::string& sym, RelocType type);
+  void AddReloc(const std::string& sym, long addend, RelocType type);
+
+  Operand ParseOperand(const std::string& str);
+  void ParseDisp(const std::string& str, long& val, std::string& sym);
+  int Width(const Inst& inst, const OperandList& ops);
+  void Byte(uint8_t b) { sections_[cur_].data_.push_back(b); }
+  size_t Offset() const { return sections_[cur_].data_.size(); }
+
+  int GetSymbol(const std::string& name);
+
+  Section sections_[SEC_NUM];
+  int cur_ {SEC_TEXT};
+  std::string filename_;
+  std::vector<Symbol> symbols_;
+  std::unordered_map<std::string, int> symbolMap_;
+  std::unordered_map<std::string, Inst> insts_;
+  std::unordered_map<std::string, Operand> operands_;
+  OperandList ops_;
+};
+
+#endif
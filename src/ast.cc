@@ -1,30 +1,14 @@
 #include "ast.h"
 
 #include "code_gen.h"
+#include "compilation.h"
 #include "error.h"
 #include "evaluator.h"
-#include "mem_pool.h"
 #include "parser.h"
 #include "token.h"
 
 
-static MemPoolImp<BinaryOp>         binaryOpPool;
-static MemPoolImp<ConditionalOp>    conditionalOpPool;
-static MemPoolImp<FuncCall>         funcCallPool;
-static MemPoolImp<Declaration>      initializationPool;
-static MemPoolImp<Object>           objectPool;
-static MemPoolImp<Identifier>       identifierPool;
-static MemPoolImp<Enumerator>       enumeratorPool;
-static MemPoolImp<Constant>         constantPool;
-static MemPoolImp<TempVar>          tempVarPool;
-static MemPoolImp<UnaryOp>          unaryOpPool;
-static MemPoolImp<EmptyStmt>        emptyStmtPool;
-static MemPoolImp<IfStmt>           ifStmtPool;
-static MemPoolImp<JumpStmt>         jumpStmtPool;
-static MemPoolImp<ReturnStmt>       returnStmtPool;
-static MemPoolImp<LabelStmt>        labelStmtPool;
-static MemPoolImp<CompoundStmt>     compoundStmtPool;
-static MemPoolImp<FuncDef>          funcDefPool;
+thread_local Arena* ASTNode::arena_ = nullptr;
 
 
 /*
@@ -170,8 +154,7 @@ BinaryOp* BinaryOp::New(const Token* tok, int op, Expr* lhs, Expr* rhs) {
     assert(0);
   }
 
-  auto ret = new (binaryOpPool.Alloc()) BinaryOp(tok, op, lhs, rhs);
-  ret->pool_ = &binaryOpPool;
+  auto ret = new (CurArena()) BinaryOp(tok, op, lhs, rhs);
   
   ret->TypeChecking();
   return ret;    
@@ -335,7 +318,7 @@ void BinaryOp::AdditiveOpTypeChecking() {
     std::swap(lhs_, rhs_); // To simplify code gen
   } else {
     if (!lhs_->Type()->ToArithm() || !rhs_->Type()->ToArithm()) {
-      Error(this, "invalid operands to binary %s", tok_->str_.c_str());
+      Error(this, "invalid operands to binary %s", tok_->Str().c_str());
     }
     type_ = Convert();
   }
@@ -371,7 +354,7 @@ void BinaryOp::EqualityOpTypeChecking() {
     EnsureCompatibleOrVoidPointer(lhs_->Type(), rhs_->Type());
   } else {
     if (!lhs_->Type()->ToArithm() || !rhs_->Type()->ToArithm())
-      Error(this, "invalid operands to binary %s", tok_->str_.c_str());
+      Error(this, "invalid operands to binary %s", tok_->Str().c_str());
     Convert();
   }
 
@@ -415,8 +398,7 @@ void BinaryOp::AssignOpTypeChecking() {
  */
 
 UnaryOp* UnaryOp::New(int op, Expr* operand, QualType type) {
-  auto ret = new (unaryOpPool.Alloc()) UnaryOp(op, operand, type);
-  ret->pool_ = &unaryOpPool;
+  auto ret = new (CurArena()) UnaryOp(op, operand, type);
   
   ret->TypeChecking();
   return ret;
@@ -542,9 +524,7 @@ ConditionalOp* ConditionalOp::New(const Token* tok,
                                   Expr* cond,
                                   Expr* exprTrue,
                                   Expr* exprFalse) {
-  auto ret = new (conditionalOpPool.Alloc())
-      ConditionalOp(cond, exprTrue, exprFalse);
-  ret->pool_ = &conditionalOpPool;
+  auto ret = new (CurArena()) ConditionalOp(cond, exprTrue, exprFalse);
 
   ret->TypeChecking();
   return ret;
@@ -588,8 +568,7 @@ void ConditionalOp::TypeChecking() {
  */
 
 FuncCall* FuncCall::New(Expr* designator, const ArgList& args) {
-  auto ret = new (funcCallPool.Alloc()) FuncCall(designator, args);
-  ret->pool_ = &funcCallPool;
+  auto ret = CurArena().Own(new (CurArena()) FuncCall(designator, args));
 
   ret->TypeChecking();
   return ret;
@@ -642,22 +621,19 @@ void FuncCall::TypeChecking() {
 Identifier* Identifier::New(const Token* tok,
                             QualType type,
                             enum Linkage linkage) {
-  auto ret = new (identifierPool.Alloc()) Identifier(tok, type, linkage);
-  ret->pool_ = &identifierPool;
+  auto ret = new (CurArena()) Identifier(tok, type, linkage);
   return ret;
 }
 
 
 Enumerator* Enumerator::New(const Token* tok, int val) {
-  auto ret = new (enumeratorPool.Alloc()) Enumerator(tok, val);
-  ret->pool_ = &enumeratorPool;
+  auto ret = new (CurArena()) Enumerator(tok, val);
   return ret;
 }
 
 
 Declaration* Declaration::New(Object* obj) {
-  auto ret = new (initializationPool.Alloc()) Declaration(obj);
-  ret->pool_ = &initializationPool;
+  auto ret = CurArena().Own(new (CurArena()) Declaration(obj));
   return ret;
 }
 
@@ -682,13 +658,11 @@ Object* Object::New(const Token* tok,
                     enum Linkage linkage,
                     unsigned char bitFieldBegin,
                     unsigned char bitFieldWidth) {
-  auto ret = new (objectPool.Alloc())
+  auto ret = new (CurArena())
              Object(tok, type, storage, linkage, bitFieldBegin, bitFieldWidth);
-  ret->pool_ = &objectPool;
 
-  static long id = 0;
   if (ret->IsStatic() || ret->Anonymous())
-    ret->id_ = ++id;
+    ret->id_ = ++Compilation::Current()->objectIds_;
   return ret;
 }
 
@@ -699,14 +673,12 @@ Object* Object::NewAnony(const Token* tok,
                          enum Linkage linkage,
                          unsigned char bitFieldBegin,
                          unsigned char bitFieldWidth) {
-  auto ret = new (objectPool.Alloc())
+  auto ret = new (CurArena())
              Object(tok, type, storage, linkage, bitFieldBegin, bitFieldWidth);
-  ret->pool_ = &objectPool;
   ret->anonymous_ = true;
 
-  static long id = 0;
   if (ret->IsStatic() || ret->anonymous_)
-    ret->id_ = ++id;
+    ret->id_ = ++Compilation::Current()->anonyIds_;
   return ret;
 }
 
@@ -717,16 +689,14 @@ Object* Object::NewAnony(const Token* tok,
 
 Constant* Constant::New(const Token* tok, int tag, long val) {
   auto type = ArithmType::New(tag);
-  auto ret = new (constantPool.Alloc()) Constant(tok, type, val);
-  ret->pool_ = &constantPool;
+  auto ret = new (CurArena()) Constant(tok, type, val);
   return ret;
 }
 
 
 Constant* Constant::New(const Token* tok, int tag, double val) {
   auto type = ArithmType::New(tag);
-  auto ret = new (constantPool.Alloc()) Constant(tok, type, val);
-  ret->pool_ = &constantPool;
+  auto ret = new (CurArena()) Constant(tok, type, val);
   return ret;
 }
 
@@ -735,11 +705,9 @@ Constant* Constant::New(const Token* tok, int tag, const std::string* val) {
   auto derived = ArithmType::New(tag);
   auto type = ArrayType::New(val->size() / derived->Width(), derived);
 
-  auto ret = new (constantPool.Alloc()) Constant(tok, type, val);
-  ret->pool_ = &constantPool;
+  auto ret = new (CurArena()) Constant(tok, type, val);
 
-  static long id = 0;
-  ret->id_ = ++id;
+  ret->id_ = ++Compilation::Current()->constantIds_;
   return ret;
 }
 
@@ -759,8 +727,7 @@ std::string Constant::SValRepr() const {
  */
 
 TempVar* TempVar::New(QualType type) {
-  auto ret = new (tempVarPool.Alloc()) TempVar(type);
-  ret->pool_ = &tempVarPool;
+  auto ret = new (CurArena()) TempVar(type);
   return ret;
 }
 
@@ -770,51 +737,44 @@ TempVar* TempVar::New(QualType type) {
  */
 
 EmptyStmt* EmptyStmt::New() {
-  auto ret = new (emptyStmtPool.Alloc()) EmptyStmt();
-  ret->pool_ = &emptyStmtPool;
+  auto ret = new (CurArena()) EmptyStmt();
   return ret;
 }
 
 
 // The else stmt could be null
 IfStmt* IfStmt::New(Expr* cond, Stmt* then, Stmt* els) {
-  auto ret = new (ifStmtPool.Alloc()) IfStmt(cond, then, els);
-  ret->pool_ = &ifStmtPool;
+  auto ret = new (CurArena()) IfStmt(cond, then, els);
   return ret;
 }
 
 
 CompoundStmt* CompoundStmt::New(std::list<Stmt*>& stmts, ::Scope* scope) {
-  auto ret = new (compoundStmtPool.Alloc()) CompoundStmt(stmts, scope);
-  ret->pool_ = &compoundStmtPool;
+  auto ret = CurArena().Own(new (CurArena()) CompoundStmt(stmts, scope));
   return ret;
 }
 
 
 JumpStmt* JumpStmt::New(LabelStmt* label) {
-  auto ret = new (jumpStmtPool.Alloc()) JumpStmt(label);
-  ret->pool_ = &jumpStmtPool;
+  auto ret = new (CurArena()) JumpStmt(label);
   return ret;
 }
 
 
 ReturnStmt* ReturnStmt::New(Expr* expr) {
-  auto ret = new (returnStmtPool.Alloc()) ReturnStmt(expr);
-  ret->pool_ = &returnStmtPool;
+  auto ret = new (CurArena()) ReturnStmt(expr);
   return ret;
 }
 
 
 LabelStmt* LabelStmt::New() {
-  auto ret = new (labelStmtPool.Alloc()) LabelStmt();
-  ret->pool_ = &labelStmtPool;
+  auto ret = new (CurArena()) LabelStmt();
   return ret;
 }
 
 
 FuncDef* FuncDef::New(Identifier* ident, LabelStmt* retLabel) {
-  auto ret = new (funcDefPool.Alloc()) FuncDef(ident, retLabel);
-  ret->pool_ = &funcDefPool;
+  auto ret = new (CurArena()) FuncDef(ident, retLabel);
 
   return ret;
 }
@@ -1,6 +1,7 @@
 #ifndef _WGTCC_AST_H_
 #define _WGTCC_AST_H_
 
+#include "arena.h"
 #include "error.h"
 #include "token.h"
 #include "type.h"
@@ -56,16 +57,43 @@ class ASTNode {
 public:
   virtual ~ASTNode() {}
   virtual void Accept(Visitor* v) = 0;
+  // Function bodies and the nodes made by the code generator
+  // go to arenas released after each function. Per thread, as
+  // the parser and the generator may run on their own threads.
+  static Arena& CurArena() {
+    return arena_ ? *arena_: Arena::Get(Arena::AST);
+  }
+  // Null falls back to 'AST'. Returns the previous arena.
+  static Arena* SetArena(Arena* arena) {
+    auto saved = arena_;
+    arena_ = arena;
+    return saved;
+  }
 
 protected:
   ASTNode() {}
 
-  MemPool* pool_ {nullptr};
+  static thread_local Arena* arena_;
 };
 
 typedef ASTNode ExtDecl;
 
 
+// Nodes are made in 'arena' while it is alive
+class ASTRegion {
+public:
+  explicit ASTRegion(Arena& arena): saved_(ASTNode::SetArena(&arena)) {}
+  explicit ASTRegion(Arena::Region region)
+      : ASTRegion(Arena::Get(region)) {}
+  ~ASTRegion() { ASTNode::SetArena(saved_); }
+  ASTRegion(const ASTRegion& other) = delete;
+  ASTRegion& operator=(const ASTRegion& other) = delete;
+
+private:
+  Arena* saved_;
+};
+
+
 /*
  * Statements
  */
@@ -103,18 +131,12 @@ public:
   static LabelStmt* New();
   ~LabelStmt() {}
   virtual void Accept(Visitor* v);
-  std::string Repr() const { return ".L" + std::to_string(tag_); }
 
 protected:
-  LabelStmt(): tag_(GenTag()) {}
+  LabelStmt() {}
 
 private:
-  static int GenTag() {
-    static int tag = 0;
-    return ++tag;
-  }
-  
-  int tag_; // 使用整型的tag值，而不直接用字符串
+  int tag_ {0}; // Given by the generator
 };
 
 
@@ -442,7 +464,7 @@ public:
   virtual bool IsLVal() { return false; }
   ArgList* Args() { return &args_; }
   Expr* Designator() { return designator_; }
-  const std::string& Name() const { return tok_->str_; }
+  const std::string& Name() const { return tok_->Str(); }
   ::FuncType* FuncType() { return designator_->Type()->ToFunc(); }
   virtual void TypeChecking();
 
@@ -508,15 +530,7 @@ public:
   virtual void TypeChecking() {}
 
 protected:
-  TempVar(QualType type): Expr(nullptr, type), tag_(GenTag()) {}
-  
-private:
-  static int GenTag() {
-    static int tag = 0;
-    return ++tag;
-  }
-
-  int tag_;
+  TempVar(QualType type): Expr(nullptr, type) {}
 };
 
 
@@ -550,15 +564,19 @@ public:
       return nullptr;
     return this;
   }
-  virtual const std::string Name() const { return tok_->str_; }
+  virtual const std::string Name() const { return *name_; }
   enum Linkage Linkage() const { return linkage_; }
   void SetLinkage(enum Linkage linkage) { linkage_ = linkage; }
   virtual void TypeChecking() {}
 
 protected:
   Identifier(const Token* tok, QualType type, enum Linkage linkage)
-      : Expr(tok, type), linkage_(linkage) {}
+      : Expr(tok, type), name_(tok ? &tok->Str(): nullptr),
+        linkage_(linkage) {}
 
+  // Not read from 'tok_': lookups point it at the latest use, for
+  // diagnostics, while the generator may read the name on its thread.
+  const std::string* name_;
   // An identifier has property linkage
   enum Linkage linkage_;
 };
@@ -725,7 +743,9 @@ class TranslationUnit : public ASTNode {
   friend class Generator;
 
 public:
-  static TranslationUnit* New() { return new TranslationUnit();}
+  static TranslationUnit* New() {
+    return CurArena().Own(new (CurArena()) TranslationUnit());
+  }
   virtual ~TranslationUnit() {}
   virtual void Accept(Visitor* v);
   void Add(ExtDecl* extDecl) { extDecls_.push_back(extDecl); }
@@ -0,0 +1,298 @@
+#include "cache.h"
+
+#include "error.h"
+#include "token.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+
+// Changes of the key or of the entries make the old entries unused
+static const uint32_t cacheVersion = 1;
+static const size_t defaultMaxBytes = 1024 * 1024 * 1024;
+
+
+/*
+ * Two 64 bits multiplicative hashes of the bytes, mixed at the end.
+ * Not cryptographic, but a collision needs both to collide.
+ */
+class Digest {
+public:
+  void Update(const void* data, size_t size) {
+    auto p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < size; ++i) {
+      a_ = (a_ ^ p[i]) * 0x100000001b3ULL;
+      b_ = (b_ ^ p[i]) * 0x9e3779b97f4a7c15ULL;
+    }
+  }
+
+  // The terminating null separates the strings
+  void Update(const std::string& str) { Update(str.c_str(), str.size() + 1); }
+
+  template<typename T>
+  void UpdateValue(const T& val) { Update(&val, sizeof(val)); }
+
+  std::string Hex() const {
+    char buf[33];
+    snprintf(buf, sizeof(buf), "%016llx%016llx",
+             static_cast<unsigned long long>(Mix(a_)),
+             static_cast<unsigned long long>(Mix(b_ ^ a_)));
+    return buf;
+  }
+
+private:
+  static uint64_t Mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 33);
+  }
+
+  uint64_t a_ {0xcbf29ce484222325ULL};
+  uint64_t b_ {0x84222325cbf29ce4ULL};
+};
+
+
+// 'N', 'NK', 'NM' or 'NG' bytes, false if 'str' isn't one of them
+static bool ParseSize(const char* str, size_t& val) {
+  char* end;
+  val = strtoull(str, &end, 10);
+  switch (*end) {
+  case 'G': case 'g': val *= 1024;
+  case 'M': case 'm': val *= 1024;
+  case 'K': case 'k': val *= 1024; ++end; break;
+  default: break;
+  }
+  return end != str && *end == 0;
+}
+
+
+CompileCache* CompileCache::Open() {
+  auto env = getenv("WGTCC_CACHE_DIR");
+  if (env == nullptr || *env == 0)
+    return nullptr;
+
+  auto size = getenv("WGTCC_CACHE_SIZE");
+  auto maxBytes = defaultMaxBytes;
+  if (size && *size && !ParseSize(size, maxBytes)) {
+    Warning("invalid WGTCC_CACHE_SIZE: '%s', the cache is not used", size);
+    return nullptr;
+  }
+
+  std::string dir = env;
+  if (dir.back() != '/')
+    dir += "/";
+  if (mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST)
+    return nullptr;
+  return new CompileCache(dir, maxBytes);
+}
+
+
+/*
+ * Whitespace and line numbers of the tokens don't change the output,
+ * but for '-g': the generator emits the file, the line and the source
+ * line of expressions then. A rebuilt compiler binary changes the key.
+ */
+void CompileCache::SetKey(TokenSequence ts, const std::string& filename,
+                          char ext, bool debug) {
+  Digest digest;
+  digest.UpdateValue(cacheVersion);
+  struct stat st;
+  if (stat("/proc/self/exe", &st) == 0) {
+    digest.UpdateValue(st.st_size);
+    digest.UpdateValue(st.st_mtim.tv_sec);
+    digest.UpdateValue(st.st_mtim.tv_nsec);
+  }
+  digest.Update(filename);
+  digest.UpdateValue(ext);
+  digest.UpdateValue(debug);
+
+  const std::string* lastFile = nullptr;
+  const char* lastLine = nullptr;
+  while (!ts.Empty()) {
+    auto tok = ts.Next();
+    digest.Update(tok->Str());
+    if (!debug)
+      continue;
+    const auto& loc = tok->loc_;
+    digest.UpdateValue(loc.line_);
+    bool newFile = loc.filename_ != lastFile;
+    digest.UpdateValue(newFile);
+    if (newFile) {
+      digest.Update(loc.filename_ ? *loc.filename_: "");
+      lastFile = loc.filename_;
+    }
+    bool newLine = loc.lineBegin_ != lastLine;
+    digest.UpdateValue(newLine);
+    if (newLine && loc.lineBegin_) {
+      auto end = loc.lineBegin_;
+      while (*end && *end != '\n')
+        ++end;
+      digest.Update(loc.lineBegin_, end - loc.lineBegin_);
+      lastLine = loc.lineBegin_;
+    }
+  }
+  entry_ = dir_ + digest.Hex() + "." + ext;
+}
+
+
+static bool Copy(int from, int to) {
+  char buf[65536];
+  ssize_t n;
+  while ((n = read(from, buf, sizeof(buf))) > 0) {
+    for (ssize_t done = 0; done < n; ) {
+      auto m = write(to, buf + done, n - done);
+      if (m < 0)
+        return false;
+      done += m;
+    }
+  }
+  return n == 0;
+}
+
+
+bool CompileCache::Fetch(const std::string& path) {
+  auto from = open(entry_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (from == -1) {
+    ++misses_;
+    return false;
+  }
+  auto to = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  auto ok = to != -1 && Copy(from, to);
+  close(from);
+  if (to != -1)
+    close(to);
+  if (!ok) {
+    ++misses_;
+    return false;
+  }
+  // The modification time orders the entries for eviction,
+  // access times are not kept by all mounts
+  utimes(entry_.c_str(), nullptr);
+  ++hits_;
+  return true;
+}
+
+
+void CompileCache::Store(const std::string& path) {
+  auto from = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (from == -1)
+    return;
+  auto tmp = dir_ + "tmp.XXXXXX";
+  auto to = mkstemp(&tmp[0]);
+  if (to == -1) {
+    close(from);
+    return;
+  }
+  fchmod(to, 0644);
+  auto ok = Copy(from, to);
+  close(from);
+  struct stat st;
+  ok = fstat(to, &st) == 0 && ok;
+  ok = close(to) == 0 && ok;
+
+  // Another compilation may have stored the key already
+  struct stat old;
+  auto replaced = stat(entry_.c_str(), &old) == 0 ? old.st_size: 0;
+  if (!ok || rename(tmp.c_str(), entry_.c_str()) != 0) {
+    unlink(tmp.c_str());
+    return;
+  }
+  ++stores_;
+  AddSize(static_cast<long long>(st.st_size) - replaced);
+}
+
+
+/*
+ * The size of the entries is kept in '.size' of the directory, locked
+ * while updated. The directory is scanned only when the file is
+ * missing or the size is over the bound, not on every store.
+ */
+void CompileCache::AddSize(long long bytes) {
+  auto path = dir_ + ".size";
+  auto fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+  if (fd == -1)
+    return;
+  if (flock(fd, LOCK_EX) != 0) {
+    close(fd);
+    return;
+  }
+
+  char buf[32];
+  auto n = pread(fd, buf, sizeof(buf) - 1, 0);
+  long long total = -1;
+  if (n > 0) {
+    buf[n] = 0;
+    total = strtoll(buf, nullptr, 10) + bytes;
+  }
+  if (total < 0 || static_cast<size_t>(total) > maxBytes_)
+    total = Evict();
+
+  n = snprintf(buf, sizeof(buf), "%lld\n", total);
+  if (ftruncate(fd, 0) != 0 || pwrite(fd, buf, n, 0) != n)
+    unlink(path.c_str());
+  close(fd);
+}
+
+
+// Removes the least recently used entries until the size is in bound,
+// returns the size of the entries left
+size_t CompileCache::Evict() {
+  struct Entry {
+    std::string path_;
+    timespec mtime_;
+    size_t size_;
+  };
+
+  auto dir = opendir(dir_.c_str());
+  if (dir == nullptr)
+    return 0;
+  std::vector<Entry> entries;
+  size_t total = 0;
+  while (auto ent = readdir(dir)) {
+    if (ent->d_name[0] == '.')
+      continue;
+    auto path = dir_ + ent->d_name;
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+      continue;
+    entries.push_back({path, st.st_mtim, static_cast<size_t>(st.st_size)});
+    total += st.st_size;
+  }
+  closedir(dir);
+  if (total <= maxBytes_)
+    return total;
+
+  std::sort(entries.begin(), entries.end(),
+            [](const Entry& lhs, const Entry& rhs) {
+    if (lhs.mtime_.tv_sec != rhs.mtime_.tv_sec)
+      return lhs.mtime_.tv_sec < rhs.mtime_.tv_sec;
+    return lhs.mtime_.tv_nsec < rhs.mtime_.tv_nsec;
+  });
+  for (const auto& entry: entries) {
+    if (total <= maxBytes_)
+      break;
+    // Another compilation may have removed it
+    if (unlink(entry.path_.c_str()) == 0)
+      ++evictions_;
+    total -= entry.size_;
+  }
+  return total;
+}
+
+
+void CompileCache::PrintStats(FILE* fp, const std::string& filename) const {
+  fprintf(fp, "%s: compilation cache: %zu hits, %zu misses, "
+          "%zu stored, %zu evicted\n", filename.c_str(),
+          hits_, misses_, stores_, evictions_);
+}
@@ -0,0 +1,58 @@
+#ifndef _WGTCC_CACHE_H_
+#define _WGTCC_CACHE_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+class TokenSequence;
+
+
+/*
+ * Compilation cache in the directory of 'WGTCC_CACHE_DIR'.
+ * An entry is the output file, '.s' or '.o', of a translation unit,
+ * named by the digest of its preprocessed tokens, of the options that
+ * change the output and of the compiler binary. Entries are written
+ * to a temporary file and renamed, concurrent compilations never see
+ * a partial one. Hits touch the entry; when the entries grow over
+ * 'WGTCC_CACHE_SIZE', the least recently used ones are removed.
+ * Failures of the cache, an invalid size included, never fail the
+ * compilation.
+ */
+class CompileCache {
+public:
+  // Null if 'WGTCC_CACHE_DIR' is not set or can't be created,
+  // or if 'WGTCC_CACHE_SIZE' is invalid
+  static CompileCache* Open();
+  ~CompileCache() {}
+  CompileCache(const CompileCache& other) = delete;
+  CompileCache& operator=(const CompileCache& other) = delete;
+
+  // The key of compiling 'ts' of 'filename' to the file type 'ext'
+  void SetKey(TokenSequence ts, const std::string& filename,
+              char ext, bool debug);
+  // Copies the cached output to 'path', returns false on miss
+  bool Fetch(const std::string& path);
+  // Adds 'path' as the output of the key
+  void Store(const std::string& path);
+
+  void PrintStats(FILE* fp, const std::string& filename) const;
+
+private:
+  CompileCache(const std::string& dir, size_t maxBytes)
+      : dir_(dir), maxBytes_(maxBytes) {}
+  void AddSize(long long bytes);
+  size_t Evict();
+
+  std::string dir_;
+  size_t maxBytes_;
+  std::string entry_; // Path of the entry of the key
+
+  size_t hits_ {0};
+  size_t misses_ {0};
+  size_t stores_ {0};
+  size_t evictions_ {0};
+};
+
+#endif
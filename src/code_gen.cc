@@ -1,26 +1,32 @@
 #include "code_gen.h"
 
+#include "assembler.h"
+#include "compilation.h"
 #include "evaluator.h"
 #include "parser.h"
+#include "report.h"
 #include "token.h"
 
+#include <atomic>
 #include <cstdarg>
+#include <exception>
 #include <queue>
 #include <set>
+#include <thread>
 
 
-extern std::string filename_in;
-extern std::string filename_out;
-extern bool debug;
+Generator::Generator(Parser* parser, FILE* outFile)
+    : ctx_(std::make_shared<GenContext>()) {
+  ctx_->parser_ = parser;
+  ctx_->outFile_ = outFile;
+}
+
 
-const std::string* Generator::last_file = nullptr;
-Parser* Generator::parser_ = nullptr;
-FILE* Generator::outFile_ = nullptr;
-RODataList Generator::rodatas_;
-std::vector<Declaration*> Generator::staticDecls_;
-int Generator::offset_ = 0;
-int Generator::retAddrOffset_ = 0;
-FuncDef* Generator::curFunc_ = nullptr;
+Generator::Generator(Parser* parser, Assembler* as)
+    : ctx_(std::make_shared<GenContext>()) {
+  ctx_->parser_ = parser;
+  ctx_->as_ = as;
+}
 
 
 /*
@@ -119,13 +125,13 @@ std::string Generator::ConsLabel(Constant* cons) {
     auto width = cons->Type()->Width();
     long val = (width == 4)? *reinterpret_cast<int*>(&valss):
                              *reinterpret_cast<long*>(&valsd);
-    const ROData& rodata = ROData(val, width);
-    rodatas_.push_back(rodata);
-    return rodata.label_;
+    auto label = ".LC" + std::to_string(ctx_->rodataLabels_++);
+    ctx_->rodatas_.push_back(ROData(val, width, label));
+    return label;
   } else { // Literal
-    const ROData& rodata = ROData(cons->SValRepr());
-    rodatas_.push_back(rodata);
-    return rodata.label_; // return address
+    auto label = ".LC" + std::to_string(ctx_->rodataLabels_++);
+    ctx_->rodatas_.push_back(ROData(cons->SValRepr(), label));
+    return label; // return address
   }
 }
 
@@ -198,10 +204,10 @@ static std::string GetSrc(int width, bool flt) {
 
 // The 'reg' always be 8 bytes  
 int Generator::Push(const std::string& reg) {
-  offset_ -= 8;
+  ctx_->offset_ -= 8;
   auto mov = reg[1] == 'x' ? "movsd": "movq";
-  Emit(mov, reg, ObjectAddr(offset_));
-  return offset_;
+  Emit(mov, reg, ObjectAddr(ctx_->offset_));
+  return ctx_->offset_;
 }
 
 
@@ -211,10 +217,10 @@ int Generator::Push(Type* type) {
   } else if (type->IsScalar()) {
     return Push("%rax");
   } else {
-    offset_ -= type->Width();
-    offset_ = Type::MakeAlign(offset_, 8);
-    CopyStruct({"", "%rbp", offset_}, type->Width());
-    return offset_;
+    ctx_->offset_ -= type->Width();
+    ctx_->offset_ = Type::MakeAlign(ctx_->offset_, 8);
+    CopyStruct({"", "%rbp", ctx_->offset_}, type->Width());
+    return ctx_->offset_;
   }
 }
 
@@ -222,9 +228,9 @@ int Generator::Push(Type* type) {
 // The 'reg' must be 8 bytes
 int Generator::Pop(const std::string& reg) {
   auto mov = reg[1] == 'x' ? "movsd": "movq";
-  Emit(mov, ObjectAddr(offset_), reg);
-  offset_ += 8;
-  return offset_;
+  Emit(mov, ObjectAddr(ctx_->offset_), reg);
+  ctx_->offset_ += 8;
+  return ctx_->offset_;
 }
 
 
@@ -334,7 +340,7 @@ void Generator::VisitBinaryOp(BinaryOp* binary) {
   case '^': inst = "xor"; break;
   case Token::LEFT: case Token::RIGHT:
     inst = op == Token::LEFT ? "sal": (sign ? "sar": "shr");
-    Emit("movq %r11, %rcx");
+    Emit("movq", "%r11", "%rcx");
     Emit(GetInst(inst, width, flt), "%cl", GetDes(width, flt));
     return;
   }
@@ -388,9 +394,9 @@ void Generator::GenAndOp(BinaryOp* andOp) {
   Emit("movq", "$1", "%rax");
   auto labelTrue = LabelStmt::New();
   Emit("jmp", labelTrue);
-  EmitLabel(labelFalse->Repr());
+  EmitLabel(Label(labelFalse));
   Emit("xorq", "%rax", "%rax"); // Set %rax to 0
-  EmitLabel(labelTrue->Repr());
+  EmitLabel(Label(labelTrue));
 }
 
 
@@ -409,16 +415,16 @@ void Generator::GenOrOp(BinaryOp* orOp) {
   Emit("xorq", "%rax", "%rax"); // Set %rax to 0
   auto labelFalse = LabelStmt::New();
   Emit("jmp", labelFalse);
-  EmitLabel(labelTrue->Repr());
+  EmitLabel(Label(labelTrue));
   Emit("movq", "$1", "%rax");
-  EmitLabel(labelFalse->Repr());    
+  EmitLabel(Label(labelFalse));    
 }
 
 
 void Generator::GenMemberRefOp(BinaryOp* ref) {
   // As the lhs will always be struct/union 
-  auto addr = LValGenerator().GenExpr(ref->lhs_);
-  const auto& name = ref->rhs_->Tok()->str_;
+  auto addr = LValGenerator(this).GenExpr(ref->lhs_);
+  const auto& name = ref->rhs_->Tok()->Str();
   auto structType = ref->lhs_->Type()->ToStruct();
   auto member = structType->GetMember(name);
 
@@ -455,7 +461,7 @@ void Generator::EmitLoadBitField(const std::string& addr, Object* bitField) {
 // has some side-effect, the rvalue will be evaluated twice!
 void Generator::GenAssignOp(BinaryOp* assign) {
   // The base register of addr is %r10, %rip, %rbp
-  auto addr = LValGenerator().GenExpr(assign->lhs_);
+  auto addr = LValGenerator(this).GenExpr(assign->lhs_);
   // Base register of static object maybe %rip
   // Visit rhs_ may changes r10
   if (addr.base_ == "%r10")
@@ -565,10 +571,12 @@ void Generator::GenPointerArithm(BinaryOp* binary) {
 }
 
 
-// Only objects Allocated on stack
+// Only objects Allocated on stack.
+// No location: the token of an identifier is that of its latest
+// use, which the parser may be changing. Locations come from
+// the enclosing expressions.
 void Generator::VisitObject(Object* obj) {
-  EmitLoc(obj);
-  auto addr = LValGenerator().GenExpr(obj).Repr();
+  auto addr = LValGenerator(this).GenExpr(obj).Repr();
 
   if (!obj->Type()->IsScalar()) {
     // Return the address of the object in rax
@@ -649,7 +657,7 @@ void Generator::VisitUnaryOp(UnaryOp* unary) {
   case Token::POSTFIX_DEC:
     return GenIncDec(unary->operand_, true, "sub");
   case Token::ADDR: {
-    auto addr = LValGenerator().GenExpr(unary->operand_).Repr();
+    auto addr = LValGenerator(this).GenExpr(unary->operand_).Repr();
     Emit("leaq", addr, "%rax");
   } return;
   case Token::DEREF:
@@ -709,7 +717,7 @@ void Generator::GenIncDec(Expr* operand,
   auto width = operand->Type()->Width();
   auto flt = operand->Type()->IsFloat();
   
-  auto addr = LValGenerator().GenExpr(operand).Repr();
+  auto addr = LValGenerator(this).GenExpr(operand).Repr();
   EmitLoad(addr, operand->Type());
   if (postfix) Save(flt);
 
@@ -746,15 +754,13 @@ void Generator::VisitConditionalOp(ConditionalOp* condOp) {
 
 
 void Generator::VisitEnumerator(Enumerator* enumer) {
-  EmitLoc(enumer);
-  auto cons = Constant::New(enumer->Tok(), T_INT, (long)enumer->Val());
+  auto cons = Constant::New(nullptr, T_INT, (long)enumer->Val());
   Visit(cons);
 }
 
 
 // Ident must be function
 void Generator::VisitIdentifier(Identifier* ident) {
-  EmitLoc(ident);
   Emit("leaq", ident->Name(), "%rax");
 }
 
@@ -785,10 +791,10 @@ void Generator::VisitTempVar(TempVar* tempVar) {
 
 
 void Generator::VisitDeclaration(Declaration* decl) {
-  EmitLoc(decl->obj_);
   auto obj = decl->obj_;
 
   if (!obj->IsStatic()) {
+    EmitLoc(obj); // Local, not shared with the parser
     // The object has no linkage and has 
     // no static storage(the object is on stack).
     // If it has no initialization,
@@ -820,7 +826,7 @@ void Generator::VisitDeclaration(Declaration* decl) {
   }
 
   if (obj->Linkage() == L_NONE)
-    staticDecls_.push_back(decl);
+    ctx_->staticDecls_.push_back(decl);
   else
     GenStaticDecl(decl);
 }
@@ -918,11 +924,11 @@ void Generator::VisitIfStmt(IfStmt* ifStmt) {
   
   if (ifStmt->else_) {
     Emit("jmp", endLabel);
-    EmitLabel(elseLabel->Repr());
+    EmitLabel(Label(elseLabel));
     VisitStmt(ifStmt->else_);
   }
   
-  EmitLabel(endLabel->Repr());
+  EmitLabel(Label(endLabel));
 }
 
 
@@ -932,7 +938,7 @@ void Generator::VisitJumpStmt(JumpStmt* jumpStmt) {
 
 
 void Generator::VisitLabelStmt(LabelStmt* labelStmt) {
-  EmitLabel(labelStmt->Repr());
+  EmitLabel(Label(labelStmt));
 }
 
 
@@ -942,14 +948,14 @@ void Generator::VisitReturnStmt(ReturnStmt* returnStmt) {
     Visit(expr);
     if (expr->Type()->ToStruct()) {
       // %rax now has the address of the struct/union
-      ObjectAddr addr = ObjectAddr(retAddrOffset_);
+      ObjectAddr addr = ObjectAddr(ctx_->retAddrOffset_);
       Emit("movq", addr, "%r11");
       addr = {"", "%r11", 0};
       CopyStruct(addr, expr->Type()->Width());
       Emit("movq", "%r11", "%rax");
     }
   }
-  Emit("jmp", curFunc_->retLabel_);
+  Emit("jmp", ctx_->curFunc_->retLabel_);
 }
 
 
@@ -962,7 +968,7 @@ public:
 
 
 void Generator::AllocObjects(Scope* scope, const FuncDef::ParamList& params) {
-  int offset = offset_;
+  int offset = ctx_->offset_;
 
   auto paramSet = std::set<Object*>(params.begin(), params.end());
   std::priority_queue<Object*, std::vector<Object*>, Comp> heap;
@@ -990,7 +996,7 @@ void Generator::AllocObjects(Scope* scope, const FuncDef::ParamList& params) {
     obj->SetOffset(offset);
   }
 
-  offset_ = offset;
+  ctx_->offset_ = offset;
 }
 
 
@@ -1037,7 +1043,7 @@ void Generator::GenBuiltin(FuncCall* funcCall) {
   } va_list_imp;
 
   auto ap = UnaryOp::New(Token::DEREF, funcCall->args_[0]);
-  auto addr = LValGenerator().GenExpr(ap);
+  auto addr = LValGenerator(this).GenExpr(ap);
   auto type = funcCall->FuncType();
   
   auto offset = offsetof(va_list_imp, reg_save_area);
@@ -1060,23 +1066,23 @@ void Generator::GenBuiltin(FuncCall* funcCall) {
   const auto& fpOffsetAddr = addr.Repr();
   addr.offset_ -= offset;
 
-  if (type == Parser::vaStartType_) {
+  if (type == ctx_->parser_->vaStartType_) {
     Emit("leaq", "-176(%rbp)", "%rax");
     Emit("movq", "%rax", saveAreaAddr);
     
     int gpOffset, fpOffset, overflowOffset;
     GetParamRegOffsets(gpOffset, fpOffset,
-                       overflowOffset, curFunc_->FuncType());
+                       overflowOffset, ctx_->curFunc_->FuncType());
     Emit("leaq", ObjectAddr(overflowOffset), "%rax");
     Emit("movq", "%rax", overflowAddr);
     Emit("movl", gpOffset, "%eax");
     Emit("movl", "%eax", gpOffsetAddr);
     Emit("movl", fpOffset, "%eax");
     Emit("movl", "%eax", fpOffsetAddr);
-  } else if (type == Parser::vaArgType_) {
-    static int cnt[2] = {0, 0};
-    auto overflowLabel = ".L_va_arg_overflow" + std::to_string(++cnt[0]);
-    auto endLabel = ".L_va_arg_end" + std::to_string(++cnt[1]);
+  } else if (type == ctx_->parser_->vaArgType_) {
+    auto tag = std::to_string(++ctx_->vaArgLabels_);
+    auto overflowLabel = ".L_va_arg_overflow" + tag;
+    auto endLabel = ".L_va_arg_end" + tag;
 
     auto argType = funcCall->args_[1]->Type()->ToPointer()->Derived();
     auto cls = Classify(argType.GetPtr());
@@ -1124,21 +1130,21 @@ void Generator::GenBuiltin(FuncCall* funcCall) {
 void Generator::VisitFuncCall(FuncCall* funcCall) {
   EmitLoc(funcCall);
   auto funcType = funcCall->FuncType();
-  if (Parser::IsBuiltin(funcType))
+  if (ctx_->parser_->IsBuiltin(funcType))
     return GenBuiltin(funcCall);
 
-  auto base = offset_;
+  auto base = ctx_->offset_;
   // Alloc memory for return value if it is struct/union
   int retStructOffset;
   auto retType = funcCall->Type()->ToStruct();
   if (retType) {
-    retStructOffset = offset_;
+    retStructOffset = ctx_->offset_;
     retStructOffset -= retType->Width();
     retStructOffset = Type::MakeAlign(retStructOffset, retType->Align());
     // No!!! you can't suppose that the 
     // visition of arguments won't change the value of %rdi
     //Emit("leaq %d(#rbp), #rdi", offset);
-    offset_ = retStructOffset;
+    ctx_->offset_ = retStructOffset;
   }
 
   TypeList types;
@@ -1151,7 +1157,8 @@ void Generator::VisitFuncCall(FuncCall* funcCall) {
   const auto& locs = locations.locs_;
   auto byMemCnt = locs.size() - locations.regCnt_ - locations.xregCnt_;
 
-  offset_ = Type::MakeAlign(offset_ - byMemCnt * 8, 16) + byMemCnt * 8;  
+  ctx_->offset_ = Type::MakeAlign(ctx_->offset_ - byMemCnt * 8, 16)
+                + byMemCnt * 8;
   for (int i = locs.size() - 1; i >=0; --i) {
     if (locs[i][1] == 'm') {
       Visit(funcCall->args_[i]);
@@ -1179,8 +1186,8 @@ void Generator::VisitFuncCall(FuncCall* funcCall) {
     Emit("leaq", ObjectAddr(retStructOffset), "%rdi");
   }
 
-  Emit("leaq", ObjectAddr(offset_), "%rsp");
-  auto addr = LValGenerator().GenExpr(funcCall->Designator());
+  Emit("leaq", ObjectAddr(ctx_->offset_), "%rsp");
+  auto addr = LValGenerator(this).GenExpr(funcCall->Designator());
   if (addr.base_.size() == 0 && addr.offset_ == 0) {
     Emit("call", addr.label_);
   } else {
@@ -1189,7 +1196,7 @@ void Generator::VisitFuncCall(FuncCall* funcCall) {
   }
 
   // Reset stack frame
-  offset_ = base;    
+  ctx_->offset_ = base;    
 }
 
 
@@ -1217,9 +1224,10 @@ ParamLocations Generator::GetParamLocations(const TypeList& types,
 
 
 void Generator::VisitFuncDef(FuncDef* funcDef) {
-  curFunc_ = funcDef;
+  ctx_->curFunc_ = funcDef;
 
   auto name = funcDef->Name();
+  TraceSpan span("codegen", name);
 
   Emit(".text");
   if (funcDef->Linkage() == L_INTERNAL) {
@@ -1233,7 +1241,7 @@ void Generator::VisitFuncDef(FuncDef* funcDef) {
   Emit("pushq", "%rbp");
   Emit("movq", "%rsp", "%rbp");
 
-  offset_ = 0;
+  ctx_->offset_ = 0;
 
   auto& params = funcDef->FuncType()->Params();
   // Arrange space to store params passed by registers
@@ -1248,11 +1256,11 @@ void Generator::VisitFuncDef(FuncDef* funcDef) {
   if (funcDef->FuncType()->Variadic()) {
     GenSaveArea(); // 'offset' is now the begin of save area
     if (retStruct) {
-      retAddrOffset_ = offset_;
-      offset_ += 8;
+      ctx_->retAddrOffset_ = ctx_->offset_;
+      ctx_->offset_ += 8;
     }
-    int regOffset = offset_;
-    int xregOffset = offset_ + 48;
+    int regOffset = ctx_->offset_;
+    int xregOffset = ctx_->offset_ + 48;
     int byMemOffset = 16;
     for (size_t i = 0; i < locs.size(); ++i) {
       if (locs[i][1] == 'm') {
@@ -1272,7 +1280,7 @@ void Generator::VisitFuncDef(FuncDef* funcDef) {
     }
   } else {
     if (retStruct) {
-      retAddrOffset_ = Push("%rdi");
+      ctx_->retAddrOffset_ = Push("%rdi");
     }
     int byMemOffset = 16;
     for (size_t i = 0; i < locs.size(); ++i) {
@@ -1293,9 +1301,12 @@ void Generator::VisitFuncDef(FuncDef* funcDef) {
     Visit(stmt);
   }
 
-  EmitLabel(funcDef->retLabel_->Repr());
+  EmitLabel(Label(funcDef->retLabel_));
   Emit("leaveq");
   Emit("retq");
+
+  // Nodes made for this function are dead
+  Arena::Get(Arena::CODEGEN).Release();
 }
 
 
@@ -1314,65 +1325,151 @@ void Generator::GenSaveArea() {
     offset += 16;
   }
   assert(offset == 0);
-  EmitLabel(label->Repr());
+  EmitLabel(Label(label));
 
-  offset_ = begin;
+  ctx_->offset_ = begin;
 }
 
 
 void Generator::VisitTranslationUnit(TranslationUnit* unit) {
-  for (auto extDecl: unit->ExtDecls()) {
-    Visit(extDecl);
-
-    // float and string literal
-    if (rodatas_.size())
-      Emit(".section", ".rodata");
-    for (auto rodata: rodatas_) {
-      if (rodata.align_ == 1) { // Literal
-        EmitLabel(rodata.label_);
-        Emit(".string", "\"" + rodata.sval_ + "\"");
-      } else if (rodata.align_ == 4) {
-        Emit(".align", "4");
-        EmitLabel(rodata.label_);
-        Emit(".long", std::to_string(static_cast<int>(rodata.ival_)));
-      } else {
-        Emit(".align", "8");
-        EmitLabel(rodata.label_);
-        Emit(".quad", std::to_string(rodata.ival_));
-      }
+  for (auto extDecl: unit->ExtDecls())
+    GenExtDecl(extDecl);
+}
+
+
+void Generator::GenExtDecl(ExtDecl* extDecl) {
+  ASTRegion region(Arena::CODEGEN);
+  Visit(extDecl);
+
+  // float and string literal
+  if (ctx_->rodatas_.size())
+    Emit(".section", ".rodata");
+  for (auto rodata: ctx_->rodatas_) {
+    if (rodata.align_ == 1) { // Literal
+      EmitLabel(rodata.label_);
+      Emit(".string", "\"" + rodata.sval_ + "\"");
+    } else if (rodata.align_ == 4) {
+      Emit(".align", "4");
+      EmitLabel(rodata.label_);
+      Emit(".long", std::to_string(static_cast<int>(rodata.ival_)));
+    } else {
+      Emit(".align", "8");
+      EmitLabel(rodata.label_);
+      Emit(".quad", std::to_string(rodata.ival_));
     }
-    rodatas_.clear();
+  }
+  ctx_->rodatas_.clear();
 
-    for (auto staticDecl: staticDecls_) {
-      GenStaticDecl(staticDecl);
-    }
-    staticDecls_.clear();
+  for (auto staticDecl: ctx_->staticDecls_) {
+    GenStaticDecl(staticDecl);
   }
+  ctx_->staticDecls_.clear();
 }
 
 
-void Generator::Gen() {
-  Emit(".file", "\"" + filename_in + "\"");
-  VisitTranslationUnit(parser_->Unit());
+/*
+ * Bounded single producer single consumer queue, from the parser
+ * thread to the generator thread. Lock free, a full or empty queue
+ * yields the waiting thread.
+ */
+class ExtDeclQueue {
+public:
+  struct Item {
+    ExtDecl* extDecl_;
+    Arena* arena_;
+  };
+
+  void Push(const Item& item) {
+    auto tail = tail_.load(std::memory_order_relaxed);
+    while (tail - head_.load(std::memory_order_acquire) == SIZE)
+      std::this_thread::yield();
+    items_[tail % SIZE] = item;
+    tail_.store(tail + 1, std::memory_order_release);
+  }
+
+  Item Pop() {
+    auto head = head_.load(std::memory_order_relaxed);
+    while (tail_.load(std::memory_order_acquire) == head)
+      std::this_thread::yield();
+    auto item = items_[head % SIZE];
+    head_.store(head + 1, std::memory_order_release);
+    return item;
+  }
+
+private:
+  // Every function in flight holds an arena
+  enum { SIZE = 16 };
+
+  Item items_[SIZE];
+  alignas(64) std::atomic<size_t> head_ {0};
+  alignas(64) std::atomic<size_t> tail_ {0};
+};
+
+
+// Functions are generated as soon as they are parsed, in order
+void Generator::Gen(bool pipeline) {
+  auto comp = Compilation::Current();
+  Emit(".file", "\"" + comp->filename_ + "\"");
+  auto gen = [this](ExtDecl* extDecl, Arena* arena) {
+    PhaseTimer timer(PhaseTimer::CODEGEN);
+    GenExtDecl(extDecl);
+    if (arena)
+      Arena::Recycle(arena);
+  };
+  if (!pipeline) {
+    PhaseTimer timer(PhaseTimer::PARSE);
+    ctx_->parser_->Parse(gen);
+    return;
+  }
+
+  // A null declaration ends the unit. After an error of the
+  // library, the queue is drained until the parser stops.
+  ExtDeclQueue queue;
+  std::exception_ptr error;
+  std::thread generator([&gen, &queue, &error, comp]() {
+    UseCompilation use(comp);
+    for (auto item = queue.Pop(); item.extDecl_; item = queue.Pop()) {
+      if (error)
+        continue;
+      try {
+        gen(item.extDecl_, item.arena_);
+      } catch (...) {
+        error = std::current_exception();
+      }
+    }
+  });
+  try {
+    PhaseTimer timer(PhaseTimer::PARSE);
+    ctx_->parser_->Parse([&queue](ExtDecl* extDecl, Arena* arena) {
+      queue.Push({extDecl, arena});
+    });
+  } catch (...) {
+    queue.Push({nullptr, nullptr});
+    generator.join();
+    throw;
+  }
+  queue.Push({nullptr, nullptr});
+  generator.join();
+  if (error)
+    std::rethrow_exception(error);
 }
 
 
 void Generator::EmitLoc(Expr* expr) {
-  if (!debug) {
+  if (!Compilation::Current()->debug_) {
     return;
   }
 
-  static int fileno = 0;
   if (expr->tok_ == nullptr) {
     return;
   }
 
   const auto loc = &expr->tok_->loc_;
-  if (loc->filename_ != last_file) {
-    Emit(".file", std::to_string(++fileno) + " \"" + *loc->filename_ + "\"");
-    last_file = loc->filename_;
+  if (loc->filename_ != ctx_->lastFile_) {
+    Emit(".file", std::to_string(++ctx_->fileno_) + " \"" + *loc->filename_ + "\"");
+    ctx_->lastFile_ = loc->filename_;
   }
-  Emit(".loc", std::to_string(fileno) + " " +
+  Emit(".loc", std::to_string(ctx_->fileno_) + " " +
                std::to_string(loc->line_) + " 0");
   
   std::string line;
@@ -1416,8 +1513,29 @@ void Generator::EmitStore(const std::string& addr, int width, bool flt) {
 }
 
 
+void Generator::Emit(const std::string& str) {
+  if (ctx_->as_ && str[0] != '.')
+    ctx_->as_->Emit(str, {});
+  else if (ctx_->as_)
+    ctx_->as_->Emit(str);
+  else
+    fprintf(ctx_->outFile_, "\t%s\n", str.c_str());
+}
+
+
+// Numbered when first referred to
+std::string Generator::Label(LabelStmt* label) {
+  if (label->tag_ == 0)
+    label->tag_ = ++ctx_->labels_;
+  return ".L" + std::to_string(label->tag_);
+}
+
+
 void Generator::EmitLabel(const std::string& label) {
-  fprintf(outFile_, "%s:\n", label.c_str());
+  if (ctx_->as_)
+    ctx_->as_->EmitLabel(label);
+  else
+    fprintf(ctx_->outFile_, "%s:\n", label.c_str());
 }
 
 
@@ -1438,8 +1556,8 @@ void LValGenerator::VisitBinaryOp(BinaryOp* binary) {
   EmitLoc(binary);
   assert(binary->op_ == '.');
 
-  addr_ = LValGenerator().GenExpr(binary->lhs_);
-  const auto& name = binary->rhs_->Tok()->str_;
+  addr_ = LValGenerator(this).GenExpr(binary->lhs_);
+  const auto& name = binary->rhs_->Tok()->Str();
   auto structType = binary->lhs_->Type()->ToStruct();
   auto member = structType->GetMember(name);
 
@@ -1452,17 +1570,16 @@ void LValGenerator::VisitBinaryOp(BinaryOp* binary) {
 void LValGenerator::VisitUnaryOp(UnaryOp* unary) {
   EmitLoc(unary);
   assert(unary->op_ == Token::DEREF);
-  Generator().VisitExpr(unary->operand_);
+  Generator(this).VisitExpr(unary->operand_);
   Emit("movq", "%rax", "%r10");
   addr_ = {"", "%r10", 0};
 }
 
 
 void LValGenerator::VisitObject(Object* obj) {
-  EmitLoc(obj);
   if (!obj->IsStatic() && obj->Anonymous()) {
     assert(obj->Decl());
-    Generator().Visit(obj->Decl());
+    Generator(this).Visit(obj->Decl());
     obj->SetDecl(nullptr);
   }
 
@@ -1477,7 +1594,6 @@ void LValGenerator::VisitObject(Object* obj) {
 // The identifier must be function
 void LValGenerator::VisitIdentifier(Identifier* ident) {
   assert(!ident->ToTypeName());
-  EmitLoc(ident);
   // Function address
   addr_ = {ident->Name(), "", 0};
 }
@@ -1512,6 +1628,14 @@ std::string ObjectAddr::Repr() const {
 }
 
 
+// Without base register, the label is a register or a function
+Assembler::Operand Generator::AsOperand(const ObjectAddr& addr) {
+  if (addr.base_.empty())
+    return ctx_->as_->GetOperand(addr.Repr());
+  return Assembler::Mem(addr.label_, addr.base_, addr.offset_);
+}
+
+
 StaticInitializer Generator::GetStaticInit(InitList::iterator& iter,
                                            InitList::iterator end,
                                            int offset) {
@@ -1553,7 +1677,7 @@ StaticInitializer Generator::GetStaticInit(InitList::iterator& iter,
     auto lval = *reinterpret_cast<long*>(&val);
     return {init->offset_, width, lval, ""};
   } else if (init->type_->ToPointer()) {
-    auto addr = Evaluator<Addr>().Eval(init->expr_);
+    auto addr = Evaluator<Addr>(this).Eval(init->expr_);
     return {init->offset_, width, addr.offset_, addr.label_};
   } else { // Struct initializer
     Error(init->expr_, "initializer element is not constant");
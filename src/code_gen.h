@@ -1,9 +1,12 @@
 #ifndef _WGTCC_CODE_GEN_H_
 #define _WGTCC_CODE_GEN_H_
 
+#include "assembler.h"
 #include "ast.h"
 #include "visitor.h"
 
+#include <memory>
+
 
 class Parser;
 struct Addr;
@@ -35,13 +38,11 @@ struct ParamLocations {
 };
 
 struct ROData {
-  ROData(long ival, int align): ival_(ival), align_(align) {
-    label_ = ".LC" + std::to_string(GenTag());
-  }
+  ROData(long ival, int align, const std::string& label)
+      : ival_(ival), align_(align), label_(label) {}
 
-  explicit ROData(const std::string& sval): sval_(sval), align_(1) {
-    label_ = ".LC" + std::to_string(GenTag());
-  }
+  ROData(const std::string& sval, const std::string& label)
+      : sval_(sval), align_(1), label_(label) {}
 
   ~ROData() {}
 
@@ -49,12 +50,6 @@ struct ROData {
   long ival_;
   int align_;
   std::string label_;
-
-private:
-  static long GenTag() {
-    static long tag = 0;
-    return tag++;
-  }
 };
 
 
@@ -83,10 +78,40 @@ struct StaticInitializer {
 };
 
 
+/*
+ * The state of generating a translation unit, shared by a generator
+ * and the sub-generators it makes. Labels are numbered per unit, in
+ * the order they are emitted.
+ */
+struct GenContext {
+  Parser* parser_ {nullptr};
+  FILE* outFile_ {nullptr};
+  Assembler* as_ {nullptr};
+  RODataList rodatas_;
+  std::vector<Declaration*> staticDecls_;
+  int offset_ {0};
+
+  // The address that store the register %rdi,
+  // when the return value is a struct/union
+  int retAddrOffset_ {0};
+  FuncDef* curFunc_ {nullptr};
+
+  const std::string* lastFile_ {nullptr};
+  int fileno_ {0};
+  int labels_ {0};
+  long rodataLabels_ {0};
+  int vaArgLabels_ {0};
+};
+
+
 class Generator: public Visitor {
   friend class Evaluator<Addr>;
 public:
-  Generator() {}
+  Generator(Parser* parser, FILE* outFile);
+  // Encode into the integrated assembler instead of writing text
+  Generator(Parser* parser, Assembler* as);
+  // A sub-generator, sharing the state of 'gen'
+  explicit Generator(Generator* gen): ctx_(gen->ctx_) {}
 
   virtual void Visit(ASTNode* node) { node->Accept(this); }
   void VisitExpr(Expr* expr) { expr->Accept(this); }
@@ -115,13 +140,10 @@ public:
   virtual void VisitFuncDef(FuncDef* funcDef);
   virtual void VisitTranslationUnit(TranslationUnit* unit);
 
-
-  static void SetInOut(Parser* parser, FILE* outFile) {
-    parser_ = parser;
-    outFile_ = outFile;
-  }
-
-  void Gen();
+  // With 'pipeline', the functions are generated on another thread
+  // while the parser goes on
+  void Gen(bool pipeline=false);
+  void GenExtDecl(ExtDecl* extDecl);
   
 protected:
   // Binary
@@ -165,50 +187,42 @@ protected:
       int& overflow, FuncType* funcType);
 
   //void Emit(const char* format, ...);
-  void Emit(const std::string& str) {
-    fprintf(outFile_, "\t%s\n", str.c_str());
-  }
-
-  void Emit(const std::string& inst,
-            const std::string& src,
-            const std::string& des) {
-    Emit(inst + "\t" + src + ", " + des);
-  }
-
-  void Emit(const std::string& inst,
-            int imm,
-            const std::string& reg) {
-    Emit(inst + "\t$" + std::to_string(imm) + ", " + reg);
-  }
-
-  void Emit(const std::string& inst,
-            const std::string& des) {
-    Emit(inst + "\t" + des);
+  // Instructions are handed to the integrated assembler with their
+  // operands, or written for '-S'; directives are text for both.
+  void Emit(const std::string& str);
+
+  template<typename Des>
+  void Emit(const std::string& inst, const Des& des) {
+    if (ctx_->as_ && inst[0] != '.')
+      ctx_->as_->Emit(inst, {AsOperand(des)});
+    else
+      Emit(inst + "\t" + Repr(des));
   }
 
-  void Emit(const std::string& inst,
-            const LabelStmt* label) {
-    Emit(inst + "\t" + label->Repr());
+  template<typename Src, typename Des>
+  void Emit(const std::string& inst, const Src& src, const Des& des) {
+    if (ctx_->as_ && inst[0] != '.')
+      ctx_->as_->Emit(inst, {AsOperand(src), AsOperand(des)});
+    else
+      Emit(inst + "\t" + Repr(src) + ", " + Repr(des));
   }
 
-  void Emit(const std::string& inst,
-            const ObjectAddr& src,
-            const ObjectAddr& des) {
-    Emit(inst, src.Repr(), des.Repr());
+  // Operands: registers and labels as 'std::string', memory as
+  // 'ObjectAddr', immediates as 'int' and jump targets as labels
+  Assembler::Operand AsOperand(const std::string& str) {
+    return ctx_->as_->GetOperand(str);
   }
-
-  void Emit(const std::string& inst,
-            const std::string& src,
-            const ObjectAddr& des) {
-    Emit(inst, src, des.Repr());
-  }
-
-  void Emit(const std::string& inst,
-            const ObjectAddr& src,
-            const std::string& des) {
-    Emit(inst, src.Repr(), des);
+  Assembler::Operand AsOperand(const ObjectAddr& addr);
+  Assembler::Operand AsOperand(int imm) { return Assembler::Imm(imm); }
+  Assembler::Operand AsOperand(LabelStmt* label) {
+    return ctx_->as_->GetOperand(Label(label));
   }
+  static const std::string& Repr(const std::string& str) { return str; }
+  static std::string Repr(const ObjectAddr& addr) { return addr.Repr(); }
+  static std::string Repr(int imm) { return "$" + std::to_string(imm); }
+  std::string Repr(LabelStmt* label) { return Label(label); }
 
+  std::string Label(LabelStmt* label);
   void EmitLabel(const std::string& label);
   void EmitZero(ObjectAddr addr, int width);
   void EmitLoad(const std::string& addr, Type* type);
@@ -233,24 +247,13 @@ protected:
   void Exchange(bool flt);
 
 protected:
-  static const std::string* last_file;
-  static Parser* parser_;
-  static FILE* outFile_;
-  static RODataList rodatas_;
-  static int offset_;
-
-  // The address that store the register %rdi,
-  // when the return value is a struct/union
-  static int retAddrOffset_;
-  static FuncDef* curFunc_;
-
-  static std::vector<Declaration*> staticDecls_;
+  std::shared_ptr<GenContext> ctx_;
 };
 
 
 class LValGenerator: public Generator {
 public:
-  LValGenerator() {}
+  explicit LValGenerator(Generator* gen): Generator(gen) {}
   
   //Expression
   virtual void VisitBinaryOp(BinaryOp* binaryOp);
@@ -0,0 +1,26 @@
+#include "compilation.h"
+
+#include "token.h"
+
+#include <cstdlib>
+
+#include <sys/mman.h>
+
+
+thread_local Compilation* Compilation::current_ = nullptr;
+
+
+// Identifiers and hide sets own heap memory of their own, their destructors
+// are run before the slabs are freed. The arenas destroy the objects they own.
+Compilation::~Compilation() {
+  for (auto& ident: idents_)
+    ident.second->~Ident();
+  for (auto& hs: hideSets_)
+    hs.second->~HideSet();
+  for (size_t i = 1; i < funcArenas_.size(); ++i)
+    delete funcArenas_[i];
+  for (auto& mapping: mappings_)
+    munmap(mapping.first, mapping.second);
+  for (auto buf: buffers_)
+    free(buf);
+}
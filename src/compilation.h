@@ -0,0 +1,109 @@
+#ifndef _WGTCC_COMPILATION_H_
+#define _WGTCC_COMPILATION_H_
+
+#include "arena.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+class HideSet;
+class Ident;
+class Token;
+
+
+struct IdentListHash {
+  size_t operator()(const std::vector<const Ident*>& idents) const {
+    size_t h = idents.size();
+    for (auto ident: idents)
+      h = h * 31 + std::hash<const Ident*>()(ident);
+    return h;
+  }
+};
+
+
+// The text of a source file, see 'SourceManager'
+struct SourceBuffer {
+  const char* end_; // The terminating NUL
+  bool splices_;    // Contains a backslash-newline
+};
+
+
+/*
+ * The state of the compilation of one translation unit: arenas,
+ * identifiers, hide sets and source buffers, released all together
+ * when it ends. A thread works for the compilation it is using,
+ * compilations on different threads are independent.
+ */
+struct Compilation {
+  Compilation() {}
+  ~Compilation();
+  Compilation(const Compilation& other) = delete;
+  Compilation& operator=(const Compilation& other) = delete;
+
+  // Null outside of a compilation
+  static Compilation* Current() { return current_; }
+
+  std::string filename_;
+  bool debug_ {false};
+
+  // Diagnostics go to 'diag_'. An error ends the compilation: the
+  // command line driver exits, the library throws 'CompileError'.
+  FILE* diag_ {stderr};
+  bool throwOnError_ {false};
+
+  Arena regions_[Arena::NUM];
+  std::mutex funcMutex_;
+  std::vector<Arena*> funcArenas_; // The first is the 'FUNC' region
+  std::vector<Arena*> freeFuncArenas_;
+
+  std::unordered_map<std::string, Ident*> idents_;
+  std::unordered_map<std::vector<const Ident*>,
+                     const HideSet*, IdentListHash> hideSets_;
+  Token* eof_ {nullptr};
+
+  // Numbers of static and anonymous objects, and of constants
+  long objectIds_ {0};
+  long anonyIds_ {0};
+  long constantIds_ {0};
+
+  // Source files read by 'SourceManager'
+  std::vector<std::pair<void*, size_t>> mappings_;
+  std::vector<char*> buffers_;
+  std::map<const char*, SourceBuffer> sources_; // By the text
+  size_t mappedBytes_ {0};
+  size_t readBytes_ {0};
+
+private:
+  friend class UseCompilation;
+
+  static thread_local Compilation* current_;
+};
+
+
+// Makes the calling thread work for 'comp' in the scope
+class UseCompilation {
+public:
+  explicit UseCompilation(Compilation* comp)
+      : saved_(Compilation::current_) {
+    Set(comp);
+  }
+  ~UseCompilation() { Set(saved_); }
+  UseCompilation(const UseCompilation& other) = delete;
+  UseCompilation& operator=(const UseCompilation& other) = delete;
+
+private:
+  static void Set(Compilation* comp) {
+    Compilation::current_ = comp;
+    Arena::SetRegions(comp ? comp->regions_: nullptr);
+  }
+
+  Compilation* saved_;
+};
+
+#endif
@@ -0,0 +1,86 @@
+#include "compiler.h"
+
+#include "assembler.h"
+#include "code_gen.h"
+#include "compilation.h"
+#include "cpp.h"
+#include "error.h"
+#include "parser.h"
+
+#include <cstdlib>
+
+
+bool CompilerInstance::Compile(const std::string& filename,
+                               const std::string& source) {
+  output_.clear();
+  diagnostics_.clear();
+  char* out = nullptr;
+  char* diag = nullptr;
+  size_t outSize = 0;
+  size_t diagSize = 0;
+  auto outFile = open_memstream(&out, &outSize);
+  auto diagFile = open_memstream(&diag, &diagSize);
+  if (outFile == nullptr || diagFile == nullptr) {
+    if (outFile)
+      fclose(outFile);
+    if (diagFile)
+      fclose(diagFile);
+    free(out);
+    free(diag);
+    diagnostics_ = "wgtcc: error: cannot open memory stream\n";
+    return false;
+  }
+
+  bool ok = true;
+  {
+    Compilation comp;
+    UseCompilation use(&comp);
+    comp.filename_ = filename;
+    comp.debug_ = options_.debug_;
+    comp.diag_ = diagFile;
+    comp.throwOnError_ = true;
+    try {
+      Run(&comp.filename_, source, outFile);
+    } catch (const CompileError&) {
+      ok = false;
+    }
+  }
+
+  fclose(outFile);
+  fclose(diagFile);
+  if (ok)
+    output_.assign(out, outSize);
+  diagnostics_.assign(diag, diagSize);
+  free(out);
+  free(diag);
+  return ok;
+}
+
+
+void CompilerInstance::Run(const std::string* filename,
+                           const std::string& source, FILE* fp) {
+  Preprocessor cpp(filename, &source);
+  for (const auto& def: options_.defines_)
+    cpp.DefineMacro(def);
+  // The first path is searched first
+  for (auto iter = options_.includePaths_.rbegin();
+       iter != options_.includePaths_.rend(); ++iter) {
+    cpp.AddSearchPath(*iter);
+  }
+
+  TokenSequence ts;
+  cpp.Process(ts);
+  if (options_.output_ == CompilerOptions::PREPROCESSED) {
+    ts.Print(fp);
+    return;
+  }
+
+  Parser parser(ts);
+  if (options_.output_ == CompilerOptions::OBJECT) {
+    Assembler as;
+    Generator(&parser, &as).Gen(options_.pipeline_);
+    as.WriteObject(fp);
+  } else {
+    Generator(&parser, fp).Gen(options_.pipeline_);
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef _WGTCC_COMPILER_H_
+#define _WGTCC_COMPILER_H_
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+struct CompilerOptions {
+  enum Output {
+    PREPROCESSED, // '-E'
+    ASSEMBLY,     // '-S'
+    OBJECT,       // '-c', by the integrated assembler
+  };
+
+  Output output_ {ASSEMBLY};
+  std::vector<std::string> defines_;      // 'NAME' or 'NAME=value'
+  std::vector<std::string> includePaths_; // Searched before the system's
+  bool debug_ {false};    // '-g', the integrated assembler ignores it
+  bool pipeline_ {false}; // Generate code on another thread
+};
+
+
+/*
+ * The compiler as a library. An instance compiles a translation unit
+ * given in memory on the calling thread, every compilation has its
+ * own state: instances compile concurrently on different threads.
+ * Headers are read from the file system. The first error stops the
+ * compilation, diagnostics are collected instead of printed.
+ */
+class CompilerInstance {
+public:
+  explicit CompilerInstance(const CompilerOptions& options)
+      : options_(options) {}
+
+  // 'filename' names the source in diagnostics and debug
+  // information, and its directory is searched for "header.h".
+  // Returns false on error.
+  bool Compile(const std::string& filename, const std::string& source);
+
+  // The preprocessed source, the assembly or the ELF object
+  const std::string& Output() const { return output_; }
+  const std::string& Diagnostics() const { return diagnostics_; }
+
+private:
+  void Run(const std::string* filename, const std::string& source,
+           FILE* fp);
+
+  CompilerOptions options_;
+  std::string output_;
+  std::string diagnostics_;
+};
+
+#endif
@@ -1,35 +1,29 @@
 #include "cpp.h"
 
-#include "evaluator.h"
-#include "parser.h"
+#include "arena.h"
+#include "report.h"
 
+#include <cerrno>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdlib>
 #include <ctime>
 #include <fcntl.h>
 #include <unistd.h>
 #include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
 
 
-extern std::string filename_in;
-extern std::string filename_out;
-
-typedef std::unordered_map<std::string, int> DirectiveMap;
-
-static const DirectiveMap directiveMap {
-  {"if", Token::PP_IF},
-  {"ifdef", Token::PP_IFDEF},
-  {"ifndef", Token::PP_IFNDEF},
-  {"elif", Token::PP_ELIF},
-  {"else", Token::PP_ELSE},
-  {"endif", Token::PP_ENDIF},
-  {"include", Token::PP_INCLUDE},
-  // Non-standard GNU extension
-  {"include_next", Token::PP_INCLUDE},
-  {"define", Token::PP_DEFINE},
-  {"undef", Token::PP_UNDEF},
-  {"line", Token::PP_LINE},
-  {"error", Token::PP_ERROR},
-  {"pragma", Token::PP_PRAGMA}
-};
+
+// Function-like macros that take longer are traced
+static const Trace::Time traceMacroThreshold = 100000;
+
+
+// Texts scanned for tokens live as long as the tokens
+static std::string* NewText(const std::string& text) {
+  return Arena::Get(Arena::TOKEN).Make<std::string>(text);
+}
 
 
 /*
@@ -41,9 +35,15 @@ void Preprocessor::Expand(TokenSequence& os, TokenSequence is, bool inCond) {
   Macro* macro = nullptr;
   int direcitve;
   while (!is.Empty()) {
+    if (is.Test(Token::UNSCANNED) && NeedExpand()) {
+      ScanGroup(is);
+      continue;
+    }
     UpdateFirstTokenLine(is);
     auto tok = is.Peek();
-    const auto& name = tok->str_;
+    const auto& name = tok->Str();
+    if (Trace::Enabled())
+      TraceInclude(tok);
 
     if ((direcitve = GetDirective(is)) != Token::INVALID) {
       ParseDirective(os, is, direcitve);
@@ -53,9 +53,13 @@ void Preprocessor::Expand(TokenSequence& os, TokenSequence is, bool inCond) {
     } else if (inCond && name == "defined") {
       is.Next();
       os.InsertBack(EvalDefOp(is));
-    } else if (tok->hs_ && tok->hs_->find(name) != tok->hs_->end()) {
+    } else if (inCond && (name == "__has_include"
+                          || name == "__has_include_next")) {
+      is.Next();
+      os.InsertBack(EvalHasInclude(is, name == "__has_include_next"));
+    } else if (HideSet::Contains(tok->hs_, tok->ident_)) {
       os.InsertBack(is.Next());
-    } else if ((macro = FindMacro(name))) {
+    } else if ((macro = FindMacro(tok))) {
       is.Next();
 
       if (name == "__FILE__") {
@@ -63,33 +67,34 @@ void Preprocessor::Expand(TokenSequence& os, TokenSequence is, bool inCond) {
       } else if (name == "__LINE__") {
         HandleTheLineMacro(os, tok);
       } else if (macro->ObjLike()) {
-        // Make a copy, as subst will change repSeq
-        auto repSeq = macro->RepSeq(tok->loc_.filename_, tok->loc_.line_);
-
         TokenList tokList;
         TokenSequence repSeqSubsted(&tokList);
         ParamMap paramMap;
         // TODO(wgtdkp): hideset is not right
-        // Make a copy of hideset
         // HS U {name}
-        auto hs = tok->hs_ ? *tok->hs_: HideSet();
-        hs.insert(name);
-        Subst(repSeqSubsted, repSeq, tok->ws_, hs, paramMap);
+        auto hs = HideSet::Insert(tok->hs_, tok->ident_);
+        Subst(repSeqSubsted, macro->RepSeq(), tok->loc_,
+              tok->ws_, hs, paramMap);
         is.InsertFront(repSeqSubsted);
       } else if (is.Try('(')) {
+        auto begin = Trace::Enabled() ? Trace::Now(): 0;
+        TokenList args;
         ParamMap paramMap;
-        auto rpar = ParseActualParam(is, macro, paramMap);
-        auto repSeq = macro->RepSeq(tok->loc_.filename_, tok->loc_.line_);
-        //const_cast<Token*>(repSeq.Peek())->ws_ = tok->ws_;
+        auto rpar = ParseActualParam(is, macro, args, paramMap);
         TokenList tokList;
         TokenSequence repSeqSubsted(&tokList);
 
         // (HS ^ HS') U {name}
         // Use HS' U {name} directly                
-        auto hs = rpar->hs_ ? *rpar->hs_: HideSet();
-        hs.insert(name);
-        Subst(repSeqSubsted, repSeq, tok->ws_, hs, paramMap);
+        auto hs = HideSet::Insert(rpar->hs_, tok->ident_);
+        Subst(repSeqSubsted, macro->RepSeq(), tok->loc_,
+              tok->ws_, hs, paramMap);
         is.InsertFront(repSeqSubsted);
+        if (Trace::Enabled()) {
+          auto end = Trace::Now();
+          if (end - begin >= traceMacroThreshold)
+            Trace::AddSpan("macro", name, begin, end);
+        }
       } else {
         os.InsertBack(tok);
       }
@@ -100,59 +105,73 @@ void Preprocessor::Expand(TokenSequence& os, TokenSequence is, bool inCond) {
 }
 
 
-static bool FindActualParam(TokenSequence& ap,
-                            ParamMap& params,
-                            const std::string& fp) {
+static const TokenSequence* FindActualParam(const ParamMap& params,
+                                            const std::string& fp) {
   auto res = params.find(fp);
-  if (res == params.end()) {
-    return false;
-  }
-  ap.Copy(res->second);
-  return true;
+  return res == params.end() ? nullptr: &res->second;
+}
+
+
+// Arguments are shared by all uses of their parameter,
+// the substitution gets copies of the tokens
+static void CopyBack(TokenSequence& os, TokenSequence is) {
+  while (!is.Empty())
+    os.InsertBack(Token::New(*is.Next()));
 }
 
 
+/*
+ * 'is' is the replacement list of the macro, shared by all its
+ * expansions and never modified: its tokens are copied to 'os'
+ * with the location 'loc' of the expansion.
+ */
 void Preprocessor::Subst(TokenSequence& os,
                          TokenSequence is,
+                         const SourceLocation& loc,
                          bool leadingWS,
-                         const HideSet& hs,
+                         const HideSet* hs,
                          ParamMap& params) {
-  TokenSequence ap;
+  const TokenSequence* ap;
 
   while (!is.Empty()) {
-    if (is.Test('#') && FindActualParam(ap, params, is.Peek2()->str_)) {
+    if (is.Test('#') && (ap = FindActualParam(params, is.Peek2()->Str()))) {
       is.Next(); is.Next();
-      auto tok = Stringize(ap);
+      auto tok = Stringize(*ap);
       os.InsertBack(tok);
     } else if (is.Test(Token::DSHARP) &&
-               FindActualParam(ap, params, is.Peek2()->str_)) {
+               (ap = FindActualParam(params, is.Peek2()->Str()))) {
       is.Next(); is.Next();
-      if (!ap.Empty())
-        Glue(os, ap);
+      if (!ap->Empty())
+        Glue(os, *ap);
     } else if (is.Test(Token::DSHARP)) {
       is.Next();
       auto tok = is.Next();
       Glue(os, tok);
     } else if (is.Peek2()->tag_ == Token::DSHARP &&
-               FindActualParam(ap, params, is.Peek()->str_)) {
+               (ap = FindActualParam(params, is.Peek()->Str()))) {
       is.Next();
 
-      if (ap.Empty()) {
+      if (ap->Empty()) {
         is.Next();
-        if (FindActualParam(ap, params, is.Peek()->str_)) {
+        if ((ap = FindActualParam(params, is.Peek()->Str()))) {
           is.Next();
-          os.InsertBack(ap);
+          CopyBack(os, *ap);
         }
       } else {
-        os.InsertBack(ap);
+        CopyBack(os, *ap);
       }
-    } else if (FindActualParam(ap, params, is.Peek()->str_)) {
+    } else if ((ap = FindActualParam(params, is.Peek()->Str()))) {
       auto tok = is.Next();
-      const_cast<Token*>(ap.Peek())->ws_ = tok->ws_;
-      Expand(os, ap);
+      TokenList tokList;
+      TokenSequence arg(&tokList);
+      CopyBack(arg, *ap);
+      const_cast<Token*>(arg.Peek())->ws_ = tok->ws_;
+      Expand(os, arg);
     } else {
-      os.InsertBack(is.Peek());
-      is.Next();
+      auto tok = Token::New(*is.Next());
+      tok->loc_.filename_ = loc.filename_;
+      tok->loc_.line_ = loc.line_;
+      os.InsertBack(tok);
     }
   }
 
@@ -171,7 +190,7 @@ void Preprocessor::Glue(TokenSequence& os, TokenSequence is) {
   auto lhs = os.Back();
   auto rhs = is.Peek();
 
-  auto str = new std::string(lhs->str_ + rhs->str_);
+  auto str = NewText(lhs->Str() + rhs->Str());
   TokenSequence ts;
   Scanner scanner(str, lhs->loc_);
   scanner.Tokenize(ts);
@@ -194,7 +213,7 @@ void Preprocessor::Glue(TokenSequence& os, TokenSequence is) {
     Error(lhs, "macro expansion failed: cannot concatenate");
   }
 
-  os.InsertBack(is);
+  CopyBack(os, is);
 }
 
 
@@ -209,20 +228,20 @@ const Token* Preprocessor::Stringize(TokenSequence is) {
     // and is not the first token of the sequence
     str.append(tok->ws_ && str.size() > 1, ' ');
     if (tok->tag_ == Token::LITERAL || tok->tag_ == Token::C_CONSTANT) {
-      for (auto c: tok->str_) {
+      for (auto c: tok->Str()) {
         if (c == '"' || c == '\\')
           str.push_back('\\');
         str.push_back(c);
       }
     } else {
-      str += tok->str_;
+      str += tok->Str();
     }
   }
   str.push_back('\"');
 
   auto ret = Token::New(*is.Peek());
   ret->tag_ = Token::LITERAL;
-  ret->str_ = str;
+  ret->SetStr(str);
   return ret;
 }
 
@@ -233,11 +252,12 @@ void Preprocessor::Finalize(TokenSequence os) {
     if (tok->tag_ == Token::INVALID) {
       Error(tok, "stray token in program");
     } else if (tok->tag_ == Token::IDENTIFIER) {
-      auto tag = Token::KeyWordTag(tok->str_);
+      auto tag = tok->ident_->KeyWordTag();
       if (Token::IsKeyWord(tag)) {
         const_cast<Token*>(tok)->tag_ = tag;
-      } else {
-        const_cast<Token*>(tok)->str_ = Scanner(tok).ScanIdentifier();
+      } else if (tok->Str().find('\\') != std::string::npos) {
+        // Universal character names
+        const_cast<Token*>(tok)->SetStr(Scanner(tok).ScanIdentifier());
       }
     }
     if (!tok->loc_.filename_) {
@@ -252,21 +272,34 @@ void Preprocessor::Process(TokenSequence& os) {
   TokenSequence is;
 
   // Add source file
-  IncludeFile(is, &filename_in);
+  if (source_)
+    IncludeSource(is, filename_, source_);
+  else
+    IncludeFile(is, filename_);
 
   // Becareful about the include order, as include file always puts
   // the file to the header of the token sequence
-  auto wgtccHeaderFile = SearchFile("wgtcc.h", true, false, filename_in);
-  if (!wgtccHeaderFile)
-    Error("can't find header files, try reinstall wgtcc");
-  IncludeFile(is, wgtccHeaderFile);
+  // The precompiled header has included it already
+  if (!pchIncluded_) {
+    auto wgtccHeaderFile = SearchFile("wgtcc.h", true, false, *filename_);
+    if (!wgtccHeaderFile)
+      Error("can't find header files, try reinstall wgtcc");
+    IncludeFile(is, wgtccHeaderFile);
+  }
   Expand(os, is);
+  EndIncludeSpans(0);
   Finalize(os);
 }
 
 
+/*
+ * The tokens of the arguments are put in 'args', every argument
+ * followed by the ',' or ')' that ends it. The sequences of
+ * 'paramMap' are ranges of 'args'.
+ */
 const Token* Preprocessor::ParseActualParam(TokenSequence& is,
                                             Macro* macro,
+                                            TokenList& args,
                                             ParamMap& paramMap) {
   const Token* ret;
   if (macro->Params().size() == 0 && !macro->Variadic()) {
@@ -277,10 +310,26 @@ const Token* Preprocessor::ParseActualParam(TokenSequence& is,
   }
 
   auto fp = macro->Params().begin();
-  TokenSequence ap;
+  auto begin = args.End(); // First token of the argument
+  auto append = [&](const Token* tok) {
+    auto pos = args.Insert(args.End(), tok);
+    if (begin == args.End())
+      begin = pos;
+    return pos;
+  };
+  auto endArg = [&](const std::string& name, const Token* tok) {
+    auto end = append(tok);
+    paramMap.insert({name, TokenSequence(&args, begin, end)});
+    begin = args.End();
+  };
 
   int cnt = 1;
   while (cnt > 0) {
+    // Arguments may span conditional directives
+    if (is.Test(Token::UNSCANNED)) {
+      ScanGroup(is);
+      continue;
+    }
     if (is.Empty())
       Error(is.Peek(), "premature end of input");
     else if (is.Test('('))
@@ -294,16 +343,15 @@ const Token* Preprocessor::ParseActualParam(TokenSequence& is,
         if (!macro->Variadic())
           Error(is.Peek(), "too many arguments");
         if (cnt == 0)
-          paramMap.insert(std::make_pair("__VA_ARGS__", ap));
+          endArg("__VA_ARGS__", is.Peek());
         else
-          ap.InsertBack(is.Peek());
+          append(is.Peek());
       } else {
-        paramMap.insert(std::make_pair(*fp, ap));
-        ap = TokenSequence();
+        endArg(*fp, is.Peek());
         ++fp;
       }
     } else {
-      ap.InsertBack(is.Peek());
+      append(is.Peek());
     }
     ret = is.Next();
   }
@@ -320,25 +368,54 @@ const Token* Preprocessor::EvalDefOp(TokenSequence& is) {
   auto cons = Token::New(*macro);
   if (hasPar) is.Expect(')');
   cons->tag_ = Token::I_CONSTANT;
-  cons->str_ = FindMacro(macro->str_) ? "1": "0";
+  cons->SetStr(Defined(macro->Str()) ? "1": "0");
   return cons;
 }
 
 
-void Preprocessor::ReplaceIdent(TokenSequence& is) {
-  TokenSequence os;
-  while (!is.Empty()) {
-    auto tok = is.Next();
-    if (tok->tag_ == Token::IDENTIFIER) {
-      auto cons = Token::New(*tok);
-      cons->tag_ = Token::I_CONSTANT;
-      cons->str_ = "0";
-      os.InsertBack(cons);
-    } else {
-      os.InsertBack(tok);
+// '__has_include("file")' or '__has_include(<file>)', other operands
+// are macro expanded up to the matching ')', as that of '#include'
+const Token* Preprocessor::EvalHasInclude(TokenSequence& is, bool next) {
+  auto lparen = is.Expect('(');
+  auto ls = is;
+  bool expanded = !is.Test(Token::LITERAL) && !is.Test('<');
+  if (expanded) {
+    int depth = 0;
+    while (!is.Empty() && (depth || !is.Test(')'))) {
+      auto tag = is.Next()->tag_;
+      depth += (tag == '(') - (tag == ')');
     }
+    TokenSequence ts;
+    Expand(ts, TokenSequence(ls.tokList_, ls.begin_, is.begin_));
+    ls = ts;
   }
-  is = os;
+
+  auto tok = ls.Next();
+  std::string filename;
+  bool libHeader = tok->tag_ == '<';
+  if (tok->tag_ == Token::LITERAL) {
+    Scanner(tok).ScanLiteral(filename);
+  } else if (libHeader) {
+    auto rhs = tok;
+    while (!(rhs = ls.Next())->IsEOF() && rhs->tag_ != '>')
+      continue;
+    if (rhs->tag_ != '>')
+      Error(rhs, "expect '>'");
+    filename = Scanner::ScanHeadName(tok, rhs);
+  } else {
+    Error(tok, "expect filename(string or in '<>')");
+  }
+  if (!expanded)
+    is = ls;
+  else if (!ls.Empty())
+    Error(ls.Peek(), "expect ')'");
+  is.Expect(')');
+
+  auto path = SearchFile(filename, libHeader, next, *lparen->loc_.filename_);
+  auto cons = Token::New(*tok);
+  cons->tag_ = Token::I_CONSTANT;
+  cons->SetStr(path ? "1": "0");
+  return cons;
 }
 
 
@@ -352,11 +429,7 @@ int Preprocessor::GetDirective(TokenSequence& is) {
 
   auto tag = is.Peek()->tag_;
   if (tag == Token::IDENTIFIER || Token::IsKeyWord(tag)) {
-    auto str = is.Peek()->str_;
-    auto res = directiveMap.find(str);
-    if (res == directiveMap.end())
-      return Token::PP_NONE;
-    return res->second;
+    return is.Peek()->ident_->DirectiveTag();
   }
   return Token::PP_NONE;
 }
@@ -410,12 +483,124 @@ void Preprocessor::ParseDirective(TokenSequence& os,
   default:
     assert(false);
   }
+
+  if (Token::PP_IF <= directive && directive <= Token::PP_ENDIF
+      && !NeedExpand()) {
+    SkipGroup(is);
+  }
+}
+
+
+/*
+ * Drops an inactive group up to the '#' of its '#elif', '#else' or
+ * '#endif', looking at the directive names only. Nested conditionals
+ * are counted, not evaluated nor checked. Lines of other directives
+ * and text are 'UNSCANNED' tokens, dropped without being scanned.
+ */
+void Preprocessor::SkipGroup(TokenSequence& is) {
+  auto tokList = is.tokList_;
+  auto pre = is.begin_ == tokList->Begin() ?
+             nullptr: tokList->At(tokList->Prev(is.begin_));
+  int depth = 0;
+  for (auto pos = is.begin_; pos != is.end_; pos = tokList->Next(pos)) {
+    auto tok = tokList->At(pos);
+    auto beginOfLine = pre == nullptr || pre->tag_ == Token::NEW_LINE
+                    || pre->loc_.filename_ != tok->loc_.filename_;
+    pre = tok;
+    if (tok->tag_ != '#' || !beginOfLine)
+      continue;
+    auto next = tokList->Next(pos);
+    if (next == is.end_)
+      break;
+    auto name = tokList->At(next);
+    if (name->tag_ != Token::IDENTIFIER && !Token::IsKeyWord(name->tag_))
+      continue;
+    switch (name->ident_->DirectiveTag()) {
+    case Token::PP_IF:
+    case Token::PP_IFDEF:
+    case Token::PP_IFNDEF:
+      ++depth;
+      break;
+    case Token::PP_ELIF:
+    case Token::PP_ELSE:
+      if (depth == 0) {
+        is.begin_ = pos;
+        return;
+      }
+      break;
+    case Token::PP_ENDIF:
+      if (depth-- == 0) {
+        is.begin_ = pos;
+        return;
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  is.begin_ = is.end_;
+}
+
+
+/*
+ * Replaces the 'UNSCANNED' token at the front of 'is' with the
+ * tokens of its lines. Most groups, as the main file, are expanded
+ * once and take the tokens of their scan. A group expanded again is
+ * cached then, every later expansion gets its own copy.
+ */
+void Preprocessor::ScanGroup(TokenSequence& is) {
+  auto group = is.Peek();
+  auto text = group->loc_.lineBegin_;
+  auto scan = [group, text](TokenList* tokList) {
+    PhaseTimer timer(PhaseTimer::SCAN);
+    TokenSequence ts(tokList);
+    Scanner scanner(SourceManager::Find(text), text,
+                    group->loc_.filename_, group->loc_.line_);
+    scanner.TokenizeGroup(ts);
+  };
+
+  TokenList scanned;
+  TokenList* tokList = &scanned;
+  auto iter = groups_.find(text);
+  if (iter == groups_.end()) {
+    groups_[text] = nullptr;
+    scan(tokList);
+  } else {
+    if (iter->second == nullptr) {
+      iter->second = new TokenList();
+      scan(iter->second);
+    }
+    tokList = iter->second;
+  }
+
+  // The first token takes the place of the group
+  auto next = is.tokList_->Next(is.begin_);
+  auto ws = group->ws_;
+  bool replaced = false;
+  for (auto tok: *tokList) {
+    auto t = tokList == &scanned ? const_cast<Token*>(tok):
+                                   Token::New(*tok);
+    if (t->tag_ != Token::NEW_LINE) {
+      t->ws_ = t->ws_ || ws;
+      ws = false;
+    }
+    if (replaced)
+      is.tokList_->Insert(next, t);
+    else
+      is.tokList_->Set(is.begin_, t);
+    replaced = true;
+  }
 }
 
 
 void Preprocessor::ParsePragma(TokenSequence ls) {
-  // TODO(wgtdkp):  
-  ls.Next();
+  auto directive = ls.Next();
+  if (ls.Test(Token::IDENTIFIER) && ls.Peek()->Str() == "once") {
+    struct stat st;
+    if (stat(directive->loc_.filename_->c_str(), &st) == 0)
+      onceFiles_.insert({st.st_dev, st.st_ino});
+  }
+  // TODO(wgtdkp): other pragmas
 }
 
 
@@ -437,11 +622,11 @@ void Preprocessor::ParseLine(TokenSequence ls) {
   int line = 0;
   size_t end = 0;
   try {
-    line = stoi(tok->str_, &end, 10);
+    line = stoi(tok->Str(), &end, 10);
   } catch (const std::out_of_range oor) {
     Error(tok, "line number out of range");
   }
-  if (line == 0 || end != tok->str_.size()) {
+  if (line == 0 || end != tok->Str().size()) {
     Error(tok, "illegal line number");
   }
   
@@ -452,12 +637,256 @@ void Preprocessor::ParseLine(TokenSequence ls) {
   tok = ts.Expect(Token::LITERAL);
   
   // Enusure "s-char-sequence"
-  if (tok->str_.front() != '"' || tok->str_.back() != '"') {
+  if (tok->Str().front() != '"' || tok->Str().back() != '"') {
     Error(tok, "expect s-char-sequence");
   }
 }
 
 
+/*
+ * Evaluates the expression of '#if' and '#elif' on its macro expanded
+ * tokens, by precedence climbing (C11 6.10.1). Signed values are
+ * 'intmax_t', unsigned ones 'uintmax_t'. Identifiers left after the
+ * expansion are 0. Operands that are not evaluated, as the right one
+ * of '0 && x', are parsed but never fail. Nothing is allocated.
+ */
+class CondEvaluator {
+public:
+  explicit CondEvaluator(TokenSequence& ts): ts_(ts) {}
+
+  bool Eval() {
+    auto val = EvalExpr(true);
+    if (!ts_.Empty())
+      Error(ts_.Peek(), "unexpected extra expression");
+    return val.bits_ != 0;
+  }
+
+private:
+  // The bits in two's complement
+  struct Value {
+    uintmax_t bits_;
+    bool unsigned_;
+  };
+
+  static Value Signed(intmax_t val) {
+    return {static_cast<uintmax_t>(val), false};
+  }
+  static bool Less(const Value& lhs, const Value& rhs, bool isUnsigned) {
+    if (isUnsigned)
+      return lhs.bits_ < rhs.bits_;
+    return static_cast<intmax_t>(lhs.bits_) < static_cast<intmax_t>(rhs.bits_);
+  }
+  static int Precedence(int tag);
+
+  Value EvalExpr(bool eval);
+  Value EvalConditional(bool eval);
+  Value EvalBinary(int minPrec, bool eval);
+  Value EvalUnary(bool eval);
+  Value EvalInteger(const Token* tok);
+  Value EvalCharacter(const Token* tok);
+  Value Apply(const Token* op, Value lhs, Value rhs, bool eval);
+  static Value Shift(Value lhs, Value rhs, bool left);
+
+  TokenSequence& ts_;
+};
+
+
+int CondEvaluator::Precedence(int tag) {
+  switch (tag) {
+  case '*': case '/': case '%': return 10;
+  case '+': case '-': return 9;
+  case Token::LEFT: case Token::RIGHT: return 8;
+  case '<': case '>': case Token::LE: case Token::GE: return 7;
+  case Token::EQ: case Token::NE: return 6;
+  case '&': return 5;
+  case '^': return 4;
+  case '|': return 3;
+  case Token::LOGICAL_AND: return 2;
+  case Token::LOGICAL_OR: return 1;
+  default: return 0;
+  }
+}
+
+
+CondEvaluator::Value CondEvaluator::EvalExpr(bool eval) {
+  auto val = EvalConditional(eval);
+  while (ts_.Try(','))
+    val = EvalConditional(eval);
+  return val;
+}
+
+
+CondEvaluator::Value CondEvaluator::EvalConditional(bool eval) {
+  auto cond = EvalBinary(1, eval);
+  if (!ts_.Try('?'))
+    return cond;
+  auto lhs = EvalExpr(eval && cond.bits_);
+  ts_.Expect(':');
+  auto rhs = EvalConditional(eval && !cond.bits_);
+  return {cond.bits_ ? lhs.bits_: rhs.bits_, lhs.unsigned_ || rhs.unsigned_};
+}
+
+
+CondEvaluator::Value CondEvaluator::EvalBinary(int minPrec, bool eval) {
+  auto lhs = EvalUnary(eval);
+  while (true) {
+    auto op = ts_.Peek();
+    auto prec = Precedence(op->tag_);
+    if (prec < minPrec || prec == 0)
+      return lhs;
+    ts_.Next();
+    if (op->tag_ == Token::LOGICAL_AND) {
+      auto rhs = EvalBinary(prec + 1, eval && lhs.bits_);
+      lhs = Signed(lhs.bits_ && rhs.bits_);
+    } else if (op->tag_ == Token::LOGICAL_OR) {
+      auto rhs = EvalBinary(prec + 1, eval && !lhs.bits_);
+      lhs = Signed(lhs.bits_ || rhs.bits_);
+    } else {
+      auto rhs = EvalBinary(prec + 1, eval);
+      lhs = Apply(op, lhs, rhs, eval);
+    }
+  }
+}
+
+
+CondEvaluator::Value CondEvaluator::EvalUnary(bool eval) {
+  auto tok = ts_.Next();
+  switch (tok->tag_) {
+  case '+': return EvalUnary(eval);
+  case '-': {
+    auto val = EvalUnary(eval);
+    return {0 - val.bits_, val.unsigned_};
+  }
+  case '~': {
+    auto val = EvalUnary(eval);
+    return {~val.bits_, val.unsigned_};
+  }
+  case '!': return Signed(!EvalUnary(eval).bits_);
+  case '(': {
+    auto val = EvalExpr(eval);
+    ts_.Expect(')');
+    return val;
+  }
+  case Token::I_CONSTANT: return EvalInteger(tok);
+  case Token::C_CONSTANT: return EvalCharacter(tok);
+  case Token::IDENTIFIER: return Signed(0);
+  case Token::F_CONSTANT:
+    Error(tok, "floating constant in preprocessor expression");
+    break;
+  case Token::END:
+    Error(tok, "expect expression");
+    break;
+  default:
+    Error(tok, "'%s' unexpected", tok->Str().c_str());
+    break;
+  }
+  return Signed(0); // Unreachable
+}
+
+
+// Too large for 'intmax_t', a constant is unsigned
+CondEvaluator::Value CondEvaluator::EvalInteger(const Token* tok) {
+  auto str = tok->Str().c_str();
+  char* end;
+  errno = 0;
+  auto bits = strtoumax(str, &end, 0);
+  if (errno == ERANGE)
+    Error(tok, "integer out of range");
+
+  bool suffixU = false, suffixL = false;
+  for (; *end; ++end) {
+    if ((*end == 'u' || *end == 'U') && !suffixU) {
+      suffixU = true;
+    } else if ((*end == 'l' || *end == 'L') && !suffixL) {
+      suffixL = true;
+      if (end[1] == end[0])
+        ++end;
+    } else {
+      Error(tok, "invalid suffix");
+    }
+  }
+  return {bits, suffixU || bits > INTMAX_MAX};
+}
+
+
+// As 'Parser::ParseCharacter()'
+CondEvaluator::Value CondEvaluator::EvalCharacter(const Token* tok) {
+  int val;
+  auto enc = Scanner(tok).ScanCharacter(val);
+  switch (enc) {
+  case Encoding::NONE: return Signed(static_cast<char>(val));
+  case Encoding::CHAR16: return Signed(static_cast<char16_t>(val));
+  default: return {static_cast<unsigned>(val), true};
+  }
+}
+
+
+CondEvaluator::Value CondEvaluator::Apply(const Token* op,
+                                          Value lhs, Value rhs, bool eval) {
+  auto isUnsigned = lhs.unsigned_ || rhs.unsigned_;
+  auto a = lhs.bits_, b = rhs.bits_;
+  switch (op->tag_) {
+  case '*': return {a * b, isUnsigned};
+  case '/': case '%': {
+    if (b == 0) {
+      if (eval)
+        Error(op, "division by zero");
+      return {0, isUnsigned};
+    }
+    auto sa = static_cast<intmax_t>(a), sb = static_cast<intmax_t>(b);
+    if (isUnsigned)
+      return {op->tag_ == '/' ? a / b: a % b, true};
+    // Overflows, wraps as the other signed operations
+    if (sa == INTMAX_MIN && sb == -1)
+      return {op->tag_ == '/' ? a: 0, false};
+    return Signed(op->tag_ == '/' ? sa / sb: sa % sb);
+  }
+  case '+': return {a + b, isUnsigned};
+  case '-': return {a - b, isUnsigned};
+  case Token::LEFT: return Shift(lhs, rhs, true);
+  case Token::RIGHT: return Shift(lhs, rhs, false);
+  case '<': return Signed(Less(lhs, rhs, isUnsigned));
+  case '>': return Signed(Less(rhs, lhs, isUnsigned));
+  case Token::LE: return Signed(!Less(rhs, lhs, isUnsigned));
+  case Token::GE: return Signed(!Less(lhs, rhs, isUnsigned));
+  case Token::EQ: return Signed(a == b);
+  case Token::NE: return Signed(a != b);
+  case '&': return {a & b, isUnsigned};
+  case '^': return {a ^ b, isUnsigned};
+  case '|': return {a | b, isUnsigned};
+  default: assert(false); return lhs;
+  }
+}
+
+
+// The type is that of 'lhs'. A negative count shifts the other way,
+// a count of the width or more shifts all bits out, as GCC does.
+CondEvaluator::Value CondEvaluator::Shift(Value lhs, Value rhs, bool left) {
+  auto count = rhs.bits_;
+  if (!rhs.unsigned_ && static_cast<intmax_t>(count) < 0) {
+    left = !left;
+    count = 0 - count;
+  }
+  const uintmax_t width = sizeof(uintmax_t) * 8;
+  auto negative = !lhs.unsigned_ && static_cast<intmax_t>(lhs.bits_) < 0;
+  if (count >= width)
+    return {left || !negative ? 0: ~static_cast<uintmax_t>(0), lhs.unsigned_};
+  if (left)
+    return {lhs.bits_ << count, lhs.unsigned_};
+  if (negative)
+    return Signed(static_cast<intmax_t>(lhs.bits_) >> count);
+  return {lhs.bits_ >> count, lhs.unsigned_};
+}
+
+
+bool Preprocessor::EvalCond(TokenSequence ls) {
+  TokenList tokList;
+  TokenSequence ts(&tokList);
+  Expand(ts, ls, true);
+  return CondEvaluator(ts).Eval();
+}
+
+
 void Preprocessor::ParseIf(TokenSequence ls) {
   if (!NeedExpand()) {
     ppCondStack_.push({Token::PP_IF, false, false});
@@ -470,21 +899,7 @@ void Preprocessor::ParseIf(TokenSequence ls) {
     Error(tok, "expect expression in 'if' directive");
   }
 
-  TokenSequence ts;
-  Expand(ts, ls, true);
-  ReplaceIdent(ts);
-
-  Parser parser(ts);
-  auto expr = parser.ParseExpr();
-  if (!parser.ts().Empty()) {
-    Error(parser.ts().Peek(), "unexpected extra expression");
-  }
-  bool cond;
-  if (expr->Type()->IsFloat()) {
-    cond = static_cast<bool>(Evaluator<double>().Eval(expr));
-  } else {
-    cond = static_cast<bool>(Evaluator<long>().Eval(expr));
-  }
+  auto cond = EvalCond(ls);
   ppCondStack_.push({Token::PP_IF, NeedExpand(), cond});
 }
 
@@ -501,7 +916,7 @@ void Preprocessor::ParseIfdef(TokenSequence ls) {
     Error(ls.Peek(), "expect new line");
   }
 
-  auto cond = FindMacro(ident->str_) != nullptr;
+  auto cond = Defined(ident->Str());
   ppCondStack_.push({Token::PP_IFDEF, NeedExpand(), cond});
 }
 
@@ -548,23 +963,7 @@ void Preprocessor::ParseElif(TokenSequence ls) {
     Error(ls.Peek(), "expect expression in 'elif' directive");
   }
 
-  TokenSequence ts;
-  Expand(ts, ls, true);
-  ReplaceIdent(ts);
-
-  Parser parser(ts);
-  auto expr = parser.ParseExpr();
-  if (!parser.ts().Empty()) {
-    Error(parser.ts().Peek(), "unexpected extra expression");
-  }
-  bool cond;
-  if (expr->Type()->IsFloat()) {
-    std::cout << Evaluator<double>().Eval(expr) << std::endl;
-    cond = static_cast<bool>(Evaluator<double>().Eval(expr));
-  } else {
-    cond = static_cast<bool>(Evaluator<long>().Eval(expr));
-  }
-  cond = cond && !top.cond_;
+  auto cond = EvalCond(ls) && !top.cond_;
   ppCondStack_.push({Token::PP_ELIF, true, cond});
 }
 
@@ -622,7 +1021,7 @@ void Preprocessor::ParseEndif(TokenSequence ls) {
 
 // Have Read the '#'
 void Preprocessor::ParseInclude(TokenSequence& is, TokenSequence ls) {
-  bool next = ls.Next()->str_ == "include_next"; // Skip 'include'
+  bool next = ls.Next()->Str() == "include_next"; // Skip 'include'
   if (!ls.Test(Token::LITERAL) && !ls.Test('<')) {
     TokenSequence ts;
     Expand(ts, ls, true);
@@ -677,14 +1076,14 @@ void Preprocessor::ParseUndef(TokenSequence ls) {
   if (!ls.Empty())
     Error(ls.Peek(), "expect new line");
 
-  RemoveMacro(ident->str_);
+  RemoveMacro(ident->Str());
 }
 
 
 void Preprocessor::ParseDef(TokenSequence ls) {
   ls.Next();
   auto ident = ls.Expect(Token::IDENTIFIER);
-  if (ident->str_ == "defined") {
+  if (ident->Str() == "defined") {
     Error(ident, "'defined' cannot be used as a macro name");
   }
   auto tok = ls.Peek();
@@ -697,9 +1096,9 @@ void Preprocessor::ParseDef(TokenSequence ls) {
     ParamList params;
     auto variadic = ParseIdentList(params, ls);
     const auto& macro = Macro(variadic, params, ls);
-    AddMacro(ident->str_, macro);
+    AddMacro(ident->Str(), macro);
   } else {
-    AddMacro(ident->str_, Macro(ls));
+    AddMacro(ident->Str(), Macro(ls));
   }
 }
 
@@ -718,10 +1117,10 @@ bool Preprocessor::ParseIdentList(ParamList& params, TokenSequence& is) {
     }
 
     for (const auto& param: params) {
-      if (param == tok->str_)
+      if (param == tok->Str())
         Error(tok, "duplicated param");
     }
-    params.push_back(tok->str_);
+    params.push_back(tok->Str());
 
     if (!is.Try(',')) {
       is.Expect(')');
@@ -734,14 +1133,193 @@ bool Preprocessor::ParseIdentList(ParamList& params, TokenSequence& is) {
 }
 
 
+bool CachedFile::Match(const struct stat& st) const {
+  return valid_ && dev_ == st.st_dev && ino_ == st.st_ino
+      && mtime_.tv_sec == st.st_mtim.tv_sec
+      && mtime_.tv_nsec == st.st_mtim.tv_nsec;
+}
+
+
+void CachedFile::Reset(const struct stat& st) {
+  valid_ = true;
+  dev_ = st.st_dev;
+  ino_ = st.st_ino;
+  mtime_ = st.st_mtim;
+  tokList_ = nullptr;
+  guard_.clear();
+}
+
+
+typedef std::vector<std::vector<const Token*>> LineList;
+
+static LineList SplitLines(const TokenList& tokList) {
+  LineList lines(1);
+  for (auto tok: tokList) {
+    if (tok->tag_ == Token::NEW_LINE) {
+      if (lines.back().size())
+        lines.emplace_back();
+    } else {
+      lines.back().push_back(tok);
+    }
+  }
+  if (lines.back().empty())
+    lines.pop_back();
+  return lines;
+}
+
+
+static const std::string* DirectiveName(const std::vector<const Token*>& line) {
+  if (line.size() < 2 || line[0]->tag_ != '#')
+    return nullptr;
+  return &line[1]->Str();
+}
+
+
+// The 'X' of '#ifndef X', '#if !defined X' or '#if !defined(X)'
+static const Token* GuardOpen(const std::vector<const Token*>& line) {
+  auto name = DirectiveName(line);
+  if (name == nullptr)
+    return nullptr;
+  if (*name == "ifndef" && line.size() == 3)
+    return line[2];
+  if (*name != "if" || line.size() < 5 || line[2]->tag_ != '!'
+      || line[3]->Str() != "defined") {
+    return nullptr;
+  }
+  if (line.size() == 5)
+    return line[4];
+  if (line.size() == 7 && line[4]->tag_ == '(' && line[6]->tag_ == ')')
+    return line[5];
+  return nullptr;
+}
+
+
+/*
+ * A file is guarded if all of it, except empty lines and comments,
+ * is in one '#ifndef X ... #endif' without '#else' or '#elif'.
+ * Including it again is then a no-op as long as 'X' is defined.
+ */
+static std::string DetectGuard(const TokenList& tokList) {
+  auto lines = SplitLines(tokList);
+  if (lines.empty())
+    return "";
+  auto guard = GuardOpen(lines[0]);
+  if (guard == nullptr || guard->tag_ != Token::IDENTIFIER)
+    return "";
+
+  int depth = 1;
+  for (size_t i = 1; i < lines.size(); ++i) {
+    auto name = DirectiveName(lines[i]);
+    if (name == nullptr)
+      continue;
+    if (*name == "if" || *name == "ifdef" || *name == "ifndef") {
+      ++depth;
+    } else if (*name == "endif") {
+      if (--depth == 0)
+        return i + 1 == lines.size() ? guard->Str(): "";
+    } else if ((*name == "else" || *name == "elif") && depth == 1) {
+      return "";
+    }
+  }
+  return "";
+}
+
+
+static const int maxIncludeTimes = 1024;
+
+
 void Preprocessor::IncludeFile(TokenSequence& is,
                                const std::string* filename) {
+  auto begin = Trace::Enabled() ? Trace::Now(): 0;
+  struct stat st;
+  if (stat(filename->c_str(), &st) != 0)
+    Error("%s: No such file or directory", filename->c_str());
+  // A file reached by several paths is listed once, by the first
+  if (depSet_.insert({st.st_dev, st.st_ino}).second)
+    deps_.push_back(filename);
+
+  auto& cached = headerCache_[*filename];
+  if (!cached.Match(st))
+    cached.Reset(st);
+
+  // The guard may be known without the tokens (precompiled header)
+  if (onceFiles_.count({st.st_dev, st.st_ino})
+      || (cached.guard_.size() && FindMacro(cached.guard_))) {
+    ++headerSkips_;
+    return;
+  }
+
+  // Recursive include without guard never ends. Skipped inclusions
+  // are not counted, a guarded header can be included any times.
+  if (++includeTimes_[*filename] > maxIncludeTimes)
+    Error("%s: may recursive include", filename->c_str());
+
+  if (cached.tokList_) {
+    ++headerCacheHits_;
+  } else {
+    ++headerCacheMisses_;
+    PhaseTimer timer(PhaseTimer::SCAN);
+    cached.tokList_ = new TokenList();
+    TokenSequence ts(cached.tokList_);
+    auto text = SourceManager::Load(*filename);
+    Scanner scanner(SourceManager::Find(text), text, filename);
+    scanner.TokenizeConditionals(ts);
+    cached.guard_ = DetectGuard(*cached.tokList_);
+  }
+
   TokenSequence ts {is.tokList_, is.begin_, is.begin_};
-  Scanner scanner(ReadFile(*filename), filename);
-  scanner.Tokenize(ts);
+  for (auto tok: *cached.tokList_)
+    ts.InsertBack(Token::New(*tok));
   
   // We done including header file
   is.begin_ = ts.begin_;
+
+  // The span lasts until the tokens of the file are expanded.
+  // Cached tokens keep the filename they were scanned with.
+  if (Trace::Enabled()) {
+    auto& tokList = *cached.tokList_;
+    if (!tokList.Empty())
+      filename = tokList.At(tokList.Begin())->loc_.filename_;
+    includeSpans_.push_back({filename, begin});
+  }
+}
+
+
+// The file is not cached, nor traced
+void Preprocessor::IncludeSource(TokenSequence& is,
+                                 const std::string* filename,
+                                 const std::string* source) {
+  PhaseTimer timer(PhaseTimer::SCAN);
+  TokenSequence ts {is.tokList_, is.begin_, is.begin_};
+  Scanner scanner(source->c_str(), filename);
+  scanner.TokenizeConditionals(ts);
+  is.begin_ = ts.begin_;
+}
+
+
+// A token of an including file ends the spans of the files it included
+void Preprocessor::TraceInclude(const Token* tok) {
+  auto filename = tok->loc_.filename_;
+  if (includeSpans_.empty() || includeSpans_.back().filename_ == filename)
+    return;
+  for (auto depth = includeSpans_.size() - 1; depth > 0; --depth) {
+    if (includeSpans_[depth - 1].filename_ == filename) {
+      EndIncludeSpans(depth);
+      return;
+    }
+  }
+}
+
+
+void Preprocessor::EndIncludeSpans(size_t depth) {
+  if (includeSpans_.size() <= depth)
+    return;
+  auto end = Trace::Now();
+  while (includeSpans_.size() > depth) {
+    const auto& span = includeSpans_.back();
+    Trace::AddSpan("include", *span.filename_, span.begin_, end);
+    includeSpans_.pop_back();
+  }
 }
 
 
@@ -753,48 +1331,78 @@ static std::string GetDir(const std::string& path) {
 }
 
 
+// Returns -1 if 'dir' can't be opened
+int Preprocessor::GetDirFd(const std::string& dir) {
+  auto iter = dirFds_.find(dir);
+  if (iter != dirFds_.end())
+    return iter->second;
+  auto dd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  dirFds_[dir] = dd;
+  return dd;
+}
+
+
+bool Preprocessor::FileExists(const std::string& dir,
+                              const std::string& name) {
+  auto dd = GetDirFd(dir);
+  if (dd == -1)
+    return false;
+  struct stat st;
+  return fstatat(dd, name.c_str(), &st, 0) == 0 && !S_ISDIR(st.st_mode);
+}
+
+
+/*
+ * Resolutions, including the failed ones, are cached by the name,
+ * the include form and the path of the including file.
+ * The returned path is shared by all includes that resolve to it.
+ */
 std::string* Preprocessor::SearchFile(const std::string& name,
                                       const bool libHeader,
                                       bool next,
                                       const std::string& curPath) {
+  auto key = name + '\0' + (libHeader ? '<': '"')
+           + (next ? '1': '0') + curPath;
+  auto iter = searchCache_.find(key);
+  if (iter != searchCache_.end())
+    return iter->second;
+
+  // The directory of current file is searched first for "file.h",
+  // and last for <file.h>
+  PathList paths = searchPaths_;
   if (libHeader && !next) {
-    searchPaths_.push_back(GetDir(curPath));
+    paths.push_back(GetDir(curPath));
   } else {
-    searchPaths_.push_front(GetDir(curPath));
+    paths.push_front(GetDir(curPath));
   }
 
-  PathList::iterator begin, end;
-  auto iter = searchPaths_.begin();
-  for (; iter != searchPaths_.end(); ++iter) {
-    auto dd = open(iter->c_str(), O_RDONLY);
-    if (dd == -1) // TODO(wgtdkp): or ensure it before preprocessing
+  std::string* ret = nullptr;
+  for (const auto& dir: paths) {
+    if (!FileExists(dir, name))
       continue;
-    auto fd = openat(dd, name.c_str(), O_RDONLY);
-    close(dd);
-    if (fd != -1) {
-      // Intentional, so that recursive include
-      // will result in running out of file descriptor
-      //close(fd);
-      auto path = *iter + name;
-      if (next) {
-        if (path != curPath)
-          continue;
-        else
-          next = false;
-      } else {
-        if (path == curPath)
-          continue;
-        if (libHeader && !next)
-          searchPaths_.pop_back();
-        else
-          searchPaths_.pop_front();
-        return new std::string(path);
-      }
-    } else if (errno == EMFILE) {
-      Error("may recursive include");
+    auto path = dir + name;
+    if (next) {
+      if (path == curPath)
+        next = false;
+    } else if (path != curPath) {
+      auto& interned = paths_[path];
+      if (interned == nullptr)
+        interned = new std::string(path);
+      ret = interned;
+      break;
     }
   }
-  return nullptr;
+  searchCache_[key] = ret;
+  return ret;
+}
+
+
+void Preprocessor::DefineMacro(const std::string& def) {
+  auto pos = def.find('=');
+  if (pos == std::string::npos)
+    AddMacro(def, NewText(""));
+  else
+    AddMacro(def.substr(0, pos), NewText(def.substr(pos + 1)));
 }
 
 
@@ -812,12 +1420,31 @@ void Preprocessor::AddMacro(const std::string& name,
 
 static std::string* Date() {
   time_t t = time(NULL);
-  struct tm* tm = localtime(&t);
-  auto buf = new char[14];
-  strftime(buf, 14, "\"%a %M %Y\"", tm);
-  auto ret = new std::string(buf);
-  delete[] buf;
-  return ret;
+  struct tm tm;
+  localtime_r(&t, &tm);
+  char buf[14];
+  strftime(buf, sizeof(buf), "\"%a %M %Y\"", &tm);
+  return NewText(buf);
+}
+
+
+Preprocessor::~Preprocessor() {
+  // Definitions are attached to the identifiers of the compilation
+  for (auto ident: macros_) {
+    delete ident->macro_;
+    ident->macro_ = nullptr;
+  }
+
+  for (const auto& dir: dirFds_) {
+    if (dir.second != -1)
+      close(dir.second);
+  }
+  for (const auto& path: paths_)
+    delete path.second;
+  for (const auto& file: headerCache_)
+    delete file.second.tokList_;
+  for (const auto& group: groups_)
+    delete group.second;
 }
 
 
@@ -828,6 +1455,7 @@ void Preprocessor::Init() {
   AddSearchPath("/usr/include/linux/");
   AddSearchPath("/usr/include/");
   AddSearchPath("/usr/local/wgtcc/include/");
+  sysSearchPaths_ = searchPaths_;
   
   // The __FILE__ and __LINE__ macro is empty
   // They are handled seperately
@@ -835,16 +1463,16 @@ void Preprocessor::Init() {
   AddMacro("__LINE__", Macro(TokenSequence(), true));
 
   AddMacro("__DATE__", Date(), true);
-  AddMacro("__STDC__", new std::string("1"), true);
-  AddMacro("__STDC__HOSTED__", new std::string("0"), true);
-  AddMacro("__STDC_VERSION__", new std::string("201103L"), true);
+  AddMacro("__STDC__", NewText("1"), true);
+  AddMacro("__STDC__HOSTED__", NewText("0"), true);
+  AddMacro("__STDC_VERSION__", NewText("201103L"), true);
 }
 
 
 void Preprocessor::HandleTheFileMacro(TokenSequence& os, const Token* macro) {
   auto file = Token::New(*macro);
   file->tag_ = Token::LITERAL;
-  file->str_ = "\"" + *macro->loc_.filename_ + "\"";
+  file->SetStr("\"" + *macro->loc_.filename_ + "\"");
   os.InsertBack(file);
 }
 
@@ -852,7 +1480,7 @@ void Preprocessor::HandleTheFileMacro(TokenSequence& os, const Token* macro) {
 void Preprocessor::HandleTheLineMacro(TokenSequence& os, const Token* macro) {
   auto line = Token::New(*macro);
   line->tag_ = Token::I_CONSTANT;
-  line->str_ = std::to_string(macro->loc_.line_);
+  line->SetStr(std::to_string(macro->loc_.line_));
   os.InsertBack(line);
 }
 
@@ -864,20 +1492,13 @@ void Preprocessor::UpdateFirstTokenLine(TokenSequence ts) {
 }
 
 
-TokenSequence Macro::RepSeq(const std::string* filename, unsigned line) {
-  // Update line
-  TokenList tl;
-  TokenSequence ret(&tl);
-  ret.Copy(repSeq_);
-  auto ts = ret;
-  while (!ts.Empty()) {
-    auto loc = ts.Peek()->loc_;
-    loc.filename_ = filename;
-    loc.line_ = line;
-    ts.UpdateHeadLocation(loc);
-    ts.Next();
+// Found in a directory of the system, as '-MM' omits them
+bool Preprocessor::IsSystemHeader(const std::string& path) const {
+  for (const auto& dir: sysSearchPaths_) {
+    if (path.compare(0, dir.size(), dir) == 0)
+      return true;
   }
-  return ret;
+  return false;
 }
 
 
@@ -887,4 +1508,5 @@ void Preprocessor::AddSearchPath(std::string path) {
   if (path[0] != '/')
     path = "./" + path;
   searchPaths_.push_front(path);
+  searchCache_.clear();
 }
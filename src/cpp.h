@@ -1,6 +1,7 @@
 #ifndef _WGTCC_CPP_H_
 #define _WGTCC_CPP_H_
 
+#include "report.h"
 #include "scanner.h"
 
 #include <cstdio>
@@ -9,18 +10,32 @@
 #include <set>
 #include <stack>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+#include <sys/types.h>
 
 class Macro;
 struct CondDirective;
+struct CachedFile;
+class PCHReader;
+class PCHWriter;
 
-typedef std::map<std::string, Macro> MacroMap; 
+typedef std::unordered_set<Ident*> IdentSet;
 typedef std::list<std::string> ParamList;
 typedef std::map<std::string, TokenSequence> ParamMap;
 typedef std::stack<CondDirective> PPCondStack;
 typedef std::list<std::string> PathList;
+typedef std::set<std::pair<dev_t, ino_t>> FileIdSet;
+typedef std::unordered_map<std::string, CachedFile> HeaderCache;
 
 
 class Macro {
+  friend class PCHWriter;
+
 public:
   Macro(const TokenSequence& repSeq, bool preDef=false)
       : funcLike_(false), variadic_(false),
@@ -37,7 +52,8 @@ public:
   bool Variadic() { return variadic_; }
   bool PreDef() { return preDef_; }
   ParamList& Params() { return params_; }
-  TokenSequence RepSeq(const std::string* filename, unsigned line);
+  // Shared by all expansions, never modified
+  TokenSequence RepSeq() const { return repSeq_; }
 
 private:
   bool funcLike_;
@@ -55,29 +71,58 @@ struct CondDirective {
 };
 
 
+/*
+ * The raw tokens of a file, as the scanner produced them.
+ * They are never preprocessed themselves, every include
+ * gets its own copy, as preprocessing modifies the tokens.
+ * The entry is stale if the file has been replaced or modified.
+ */
+struct CachedFile {
+  bool valid_ {false};
+  dev_t dev_;
+  ino_t ino_;
+  struct timespec mtime_;
+  TokenList* tokList_ {nullptr}; // Null if not tokenized yet
+  std::string guard_; // Include guard macro, empty if none
+
+  bool Match(const struct stat& st) const;
+  void Reset(const struct stat& st);
+};
+
+
 class Preprocessor {
+  friend class PCHReader;
+  friend class PCHWriter;
+
 public:
-  Preprocessor(const std::string* filename)
-      : curLine_(1), lineLine_(0), curCond_(true) {
+  // 'source' is the text of the file if given in memory
+  Preprocessor(const std::string* filename, const std::string* source=nullptr)
+      : filename_(filename), source_(source),
+        curLine_(1), lineLine_(0), curCond_(true) {
     // Add predefined
     Init();
   }
 
-  ~Preprocessor() {}
+  ~Preprocessor();
   void Finalize(TokenSequence os);
   void Process(TokenSequence& os);
   void Expand(TokenSequence& os, TokenSequence is, bool inCond=false);
   void Subst(TokenSequence& os, TokenSequence is,
-             bool leadingWS, const HideSet& hs, ParamMap& params);
+             const SourceLocation& loc, bool leadingWS,
+             const HideSet* hs, ParamMap& params);
   void Glue(TokenSequence& os, TokenSequence is);
   void Glue(TokenSequence& os, const Token* tok);
   const Token* Stringize(TokenSequence is);
   void Stringize(std::string& str, TokenSequence is);
-  const Token* ParseActualParam(TokenSequence& is, Macro* macro, ParamMap& paramMap);
+  const Token* ParseActualParam(TokenSequence& is, Macro* macro,
+                                TokenList& args, ParamMap& paramMap);
   int GetDirective(TokenSequence& is);
   const Token* EvalDefOp(TokenSequence& is);
-  void ReplaceIdent(TokenSequence& is);
+  const Token* EvalHasInclude(TokenSequence& is, bool next);
+  bool EvalCond(TokenSequence ls);
   void ParseDirective(TokenSequence& os, TokenSequence& is, int directive);
+  void SkipGroup(TokenSequence& is);
+  void ScanGroup(TokenSequence& is);
   void ParseIf(TokenSequence ls);
   void ParseIfdef(TokenSequence ls);
   void ParseIfndef(TokenSequence ls);
@@ -91,41 +136,74 @@ public:
   void ParseError(TokenSequence ls);
   void ParsePragma(TokenSequence ls);
   void IncludeFile(TokenSequence& is, const std::string* filename);
+  void IncludeSource(TokenSequence& is, const std::string* filename,
+                     const std::string* source);
+  void TraceInclude(const Token* tok);
+  void EndIncludeSpans(size_t depth);
   bool ParseIdentList(ParamList& params, TokenSequence& is);
   
 
   Macro* FindMacro(const std::string& name) {
-    auto res = macroMap_.find(name);
-    if (res == macroMap_.end())
+    auto ident = Ident::Find(name);
+    return ident ? ident->macro_: nullptr;
+  }
+
+  // '__has_include' is defined as a macro would be
+  bool Defined(const std::string& name) {
+    return FindMacro(name) || name == "__has_include"
+        || name == "__has_include_next";
+  }
+
+  Macro* FindMacro(const Token* tok) {
+    if (tok->tag_ != Token::IDENTIFIER)
       return nullptr;
-    return &res->second;
+    if (tok->ident_)
+      return tok->ident_->macro_;
+    return FindMacro(tok->Str());
   }
 
+  // 'NAME' or 'NAME=value', as given by '-D'
+  void DefineMacro(const std::string& def);
   void AddMacro(const std::string& name,
                 std::string* text, bool preDef=false);
 
   void AddMacro(const std::string& name, const Macro& macro) {
-    auto res = macroMap_.find(name);
-    if (res != macroMap_.end()) {
-      // TODO(wgtdkp): give warning
-      macroMap_.erase(res);
-    }
-    macroMap_.insert(std::make_pair(name, macro));
+    auto ident = Ident::Get(name);
+    // TODO(wgtdkp): give warning if redefined
+    delete ident->macro_;
+    ident->macro_ = new Macro(macro);
+    macros_.insert(ident);
   }
 
   void RemoveMacro(const std::string& name) {
-    auto res = macroMap_.find(name);
-    if (res == macroMap_.end())
+    auto ident = Ident::Find(name);
+    if (ident == nullptr || ident->macro_ == nullptr)
       return;
-    if(res->second.PreDef()) // cannot undef predefined macro
+    if(ident->macro_->PreDef()) // cannot undef predefined macro
       return;
-    macroMap_.erase(res);
+    delete ident->macro_;
+    ident->macro_ = nullptr;
+    macros_.erase(ident);
+  }
+
+  // Tokenize-once cache of included files
+  size_t HeaderCacheHits() const { return headerCacheHits_; }
+  size_t HeaderCacheMisses() const { return headerCacheMisses_; }
+  // Includes skipped by include guard or '#pragma once'
+  size_t HeaderSkips() const { return headerSkips_; }
+
+  // Files opened by includes, the source file first, for '-M'
+  const std::vector<const std::string*>& Dependencies() const {
+    return deps_;
   }
+  bool IsSystemHeader(const std::string& path) const;
 
   std::string* SearchFile(const std::string& name,
                           const bool libHeader,
                           bool next,
                           const std::string& curPath);
+  int GetDirFd(const std::string& dir);
+  bool FileExists(const std::string& dir, const std::string& name);
 
   void AddSearchPath(std::string path);
   void HandleTheFileMacro(TokenSequence& os, const Token* macro);
@@ -142,13 +220,39 @@ public:
 private:
   void Init();
 
+  const std::string* filename_;
+  const std::string* source_;
   PPCondStack ppCondStack_;
   unsigned curLine_;
   unsigned lineLine_;
   bool curCond_;
   
-  MacroMap macroMap_;
+  IdentSet macros_; // Identifiers defined as macro
   PathList searchPaths_;  
+  PathList sysSearchPaths_; // Those not given by '-I'
+  FileIdSet onceFiles_; // Files with '#pragma once'
+  std::unordered_map<std::string, std::string*> searchCache_;
+  std::unordered_map<std::string, std::string*> paths_; // Interned
+  std::unordered_map<std::string, int> dirFds_;
+  std::unordered_map<std::string, int> includeTimes_;
+  bool pchIncluded_ {false};
+
+  // Files being included, for '-ftrace'
+  struct IncludeSpan {
+    const std::string* filename_;
+    Trace::Time begin_;
+  };
+  std::vector<IncludeSpan> includeSpans_;
+
+  std::vector<const std::string*> deps_;
+  FileIdSet depSet_;
+
+  size_t headerCacheHits_ {0};
+  size_t headerCacheMisses_ {0};
+  size_t headerSkips_ {0};
+  HeaderCache headerCache_;
+  // Tokens of the groups expanded more than once, by their text
+  std::unordered_map<const char*, TokenList*> groups_;
 };
 
 #endif
@@ -1,6 +1,7 @@
 #include "error.h"
 
 #include "ast.h"
+#include "compilation.h"
 #include "token.h"
 
 #include <cstdarg>
@@ -18,22 +19,57 @@
 #define ANSI_COLOR_RESET   "\x1b[0m"
 
 
-extern std::string program;
+// The name in diagnostics without location, set by the driver
+std::string program = "wgtcc";
+
+
+static FILE* DiagFile() {
+  auto comp = Compilation::Current();
+  return comp ? comp->diag_: stderr;
+}
+
+
+// Escapes are for the terminal, not the diagnostics of the library
+static const char* Color(const char* color) {
+  return DiagFile() == stderr ? color: "";
+}
+
+
+[[noreturn]] static void Fail() {
+  auto comp = Compilation::Current();
+  if (comp && comp->throwOnError_)
+    throw CompileError();
+  exit(-1);
+}
 
 
 void Error(const char* format, ...) {
-  fprintf(stderr,
-          "%s: " ANSI_COLOR_RED "error: " ANSI_COLOR_RESET,
-          program.c_str());
+  auto fp = DiagFile();
+  fprintf(fp, "%s: %serror: %s", program.c_str(),
+          Color(ANSI_COLOR_RED), Color(ANSI_COLOR_RESET));
   
   va_list args;
   va_start(args, format);
-  vfprintf(stderr, format, args);
+  vfprintf(fp, format, args);
   va_end(args);
   
-  fprintf(stderr, "\n");
+  fprintf(fp, "\n");
 
-  exit(-1);
+  Fail();
+}
+
+
+void Warning(const char* format, ...) {
+  auto fp = DiagFile();
+  fprintf(fp, "%s: %swarning: %s", program.c_str(),
+          Color(ANSI_COLOR_YELLOW), Color(ANSI_COLOR_RESET));
+
+  va_list args;
+  va_start(args, format);
+  vfprintf(fp, format, args);
+  va_end(args);
+
+  fprintf(fp, "\n");
 }
 
 
@@ -41,13 +77,15 @@ static void VError(const SourceLocation& loc,
                    const char* format,
                    va_list args) {
   assert(loc.filename_);
-  fprintf(stderr,
-          "%s:%d:%d: " ANSI_COLOR_RED "error: " ANSI_COLOR_RESET,
+  auto fp = DiagFile();
+  fprintf(fp, "%s:%d:%d: %serror: %s",
           loc.filename_->c_str(),
           loc.line_,
-          loc.column_);
-  vfprintf(stderr, format, args);
-  fprintf(stderr, "\n    ");
+          loc.column_,
+          Color(ANSI_COLOR_RED),
+          Color(ANSI_COLOR_RESET));
+  vfprintf(fp, format, args);
+  fprintf(fp, "\n    ");
 
   bool sawNoSpace = false;
   int nspaces = 0;
@@ -56,15 +94,15 @@ static void VError(const SourceLocation& loc,
       ++nspaces;
     } else {
       sawNoSpace = true;
-      fputc(*p, stderr);
+      fputc(*p, fp);
     }
   }
   
-  fprintf(stderr, "\n    ");
+  fprintf(fp, "\n    ");
   for (unsigned i = 1; i + nspaces < loc.column_; ++i)
-    fputc(' ', stderr);
-  fprintf(stderr, ANSI_COLOR_GREEN "^\n");
-  exit(-1);	
+    fputc(' ', fp);
+  fprintf(fp, "%s^%s\n", Color(ANSI_COLOR_GREEN), Color(ANSI_COLOR_RESET));
+  Fail();
 }
 
 
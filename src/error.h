@@ -1,15 +1,27 @@
 #ifndef _WGTCC_ERROR_H_
 #define _WGTCC_ERROR_H_
 
+#include <exception>
+
 
 struct SourceLocation;
 class Token;
 class Expr;
 
 
+// Thrown by 'Error()' when the compilation asks for it,
+// the message has been written to the diagnostics already
+class CompileError: public std::exception {
+public:
+  const char* what() const noexcept override { return "compile error"; }
+};
+
+
 void Error(const char* format, ...);
 void Error(const SourceLocation& loc, const char* format, ...);
 void Error(const Token* tok, const char* format, ...);
 void Error(const Expr* expr, const char* format, ...);
+// The compilation goes on after a warning
+void Warning(const char* format, ...);
 
 #endif
@@ -126,9 +126,9 @@ void Evaluator<T>::VisitConditionalOp(ConditionalOp* condOp) {
 
 void Evaluator<Addr>::VisitBinaryOp(BinaryOp* binary) {
 #define LR   Evaluator<long>().Eval(binary->rhs_)
-#define R   Evaluator<Addr>().Eval(binary->rhs_)
+#define R   Evaluator<Addr>(gen_).Eval(binary->rhs_)
   
-  auto l = Evaluator<Addr>().Eval(binary->lhs_);
+  auto l = Evaluator<Addr>(gen_).Eval(binary->lhs_);
   
   int width = 1;
   auto pointerType = binary->Type()->ToPointer();
@@ -149,7 +149,7 @@ void Evaluator<Addr>::VisitBinaryOp(BinaryOp* binary) {
   case '.': {
     addr_.label_ = l.label_;
     auto type = binary->lhs_->Type()->ToStruct();
-    auto offset = type->GetMember(binary->rhs_->tok_->str_)->Offset();
+    auto offset = type->GetMember(binary->rhs_->tok_->Str())->Offset();
     addr_.offset_ = l.offset_ + offset;
     break;
   }
@@ -161,7 +161,7 @@ void Evaluator<Addr>::VisitBinaryOp(BinaryOp* binary) {
 
 
 void Evaluator<Addr>::VisitUnaryOp(UnaryOp* unary) {
-  auto addr = Evaluator<Addr>().Eval(unary->operand_);
+  auto addr = Evaluator<Addr>(gen_).Eval(unary->operand_);
 
   switch (unary->op_) {
   case Token::CAST:
@@ -183,16 +183,16 @@ void Evaluator<Addr>::VisitConditionalOp(ConditionalOp* condOp) {
     auto val = Evaluator<double>().Eval(condOp->cond_);
     cond  = val != 0.0;
   } else if (condType->ToPointer()) {
-    auto val = Evaluator<Addr>().Eval(condOp->cond_);
+    auto val = Evaluator<Addr>(gen_).Eval(condOp->cond_);
     cond = val.label_.size() || val.offset_;
   } else {
     assert(false);
   }
 
   if (cond) {
-    addr_ = Evaluator<Addr>().Eval(condOp->exprTrue_);
+    addr_ = Evaluator<Addr>(gen_).Eval(condOp->exprTrue_);
   } else {
-    addr_ = Evaluator<Addr>().Eval(condOp->exprFalse_);
+    addr_ = Evaluator<Addr>(gen_).Eval(condOp->exprFalse_);
   }
 }
 
@@ -201,8 +201,8 @@ void Evaluator<Addr>::VisitConstant(Constant* cons)  {
   if (cons->Type()->IsInteger()) {
     addr_ = {"", static_cast<int>(cons->IVal())};
   } else if (cons->Type()->ToArray()) {
-    Generator().ConsLabel(cons); // Add the literal to rodatas_.
-    addr_.label_ = Generator::rodatas_.back().label_;
+    // Without a generator, only whether there is a label matters
+    addr_.label_ = gen_ ? gen_->ConsLabel(cons): cons->Repr();
     addr_.offset_ = 0;
   } else {
     assert(false);
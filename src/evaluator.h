@@ -7,6 +7,7 @@
 
 
 class Expr;
+class Generator;
 
 template<typename T>
 class Evaluator: public Visitor {
@@ -71,7 +72,8 @@ struct Addr {
 template<>
 class Evaluator<Addr>: public Visitor {
 public:
-  Evaluator<Addr>() {}
+  // Literals go to the read only data of 'gen'
+  explicit Evaluator<Addr>(Generator* gen=nullptr): gen_(gen) {}
   virtual ~Evaluator<Addr>() {}
   virtual void VisitBinaryOp(BinaryOp* binary);
   virtual void VisitUnaryOp(UnaryOp* unary);
@@ -114,6 +116,7 @@ public:
   }
 
 private:
+  Generator* gen_;
   Addr addr_;
 };
 
@@ -1,13 +1,21 @@
+#include "assembler.h"
+#include "cache.h"
 #include "code_gen.h"
+#include "compilation.h"
 #include "cpp.h"
 #include "error.h"
 #include "parser.h"
+#include "pch.h"
+#include "report.h"
 #include "scanner.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <list>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -16,13 +24,31 @@
 #include <sys/wait.h>
 
 
-std::string program;
-std::string filename_in;
-std::string filename_out;
-bool debug = false;
+extern std::string program;
+static std::string filename_in;
+static std::string filename_out;
+static bool debug = false;
 static bool only_preprocess = false;
 static bool only_compile = false;
+static bool only_assemble = false;
+static bool no_integrated_as = false;
+static bool pipeline = false;
+static bool header_cache_stats = false;
+static bool cache_stats = false;
+static bool time_report = false;
+static bool mem_report = false;
+static bool json_report = false;
+static size_t num_tokens = 0;
+static std::string trace_out;
+static bool emit_pch = false;
+static std::string pch_in;
 static bool specified_out_name = false;
+static bool deps_only = false;      // '-M', '-MM'
+static bool deps_side = false;      // '-MD', '-MMD'
+static bool deps_user_only = false; // '-MM', '-MMD'
+static bool deps_phony = false;     // '-MP'
+static std::string deps_out;        // '-MF'
+static long max_jobs = 0;
 static std::list<std::string> filenames_in;
 static std::list<std::string> gcc_filenames_in;
 static std::list<std::string> gcc_args;
@@ -38,7 +64,36 @@ static void Usage() {
        "  -I        Add search path\n"
        "  -E        Preprocess only; do not compile, assemble or link\n"
        "  -S        Compile only; do not assemble or link\n"
-       "  -o        specify output file\n");
+       "  -c        Compile and assemble, but do not link\n"
+       "  -o        specify output file\n"
+       "  -j N      Compile at most N files in parallel\n"
+       "            (default: number of online CPUs)\n"
+       "  -M        Output the make rule of the included files\n"
+       "            instead of preprocessing\n"
+       "  -MM       Like '-M', without the system headers\n"
+       "  -MD, -MMD Write the rule as '-M', '-MM' while compiling\n"
+       "  -MF <file>\n"
+       "            Write the rule to file\n"
+       "  -MP       Add a phony target for each header\n"
+       "  -emit-pch Precompile the header file\n"
+       "  -include-pch <file>\n"
+       "            Start from the precompiled header\n"
+       "  -fno-integrated-as\n"
+       "            Assemble with the system assembler\n"
+       "  -fpipeline\n"
+       "            Generate code on another thread while parsing\n"
+       "  -fcache-stats\n"
+       "            Print hits and misses of the compilation cache\n"
+       "            of WGTCC_CACHE_DIR\n"
+       "  -fheader-cache-stats\n"
+       "            Print hits and misses of the header token cache\n"
+       "  -ftime-report[=json]\n"
+       "            Print time spent in each compilation phase\n"
+       "  -fmem-report[=json]\n"
+       "            Print arena regions, token count and peak RSS\n"
+       "  -ftrace=<file.json>\n"
+       "            Write Chrome trace events of includes, macros\n"
+       "            and functions\n");
   
   exit(-2);
 }
@@ -51,26 +106,11 @@ static std::string GetExtension(const std::string& filename) {
 
 static void ValidateFileName(const std::string& filename) {
   auto ext = GetExtension(filename);
-  if (ext != ".c" && ext != ".s" && ext != ".o" && ext != ".a")
+  if (ext != ".c" && ext != ".h" && ext != ".s" && ext != ".o" && ext != ".a")
     Error("bad file name format:'%s'", filename.c_str());
 }
 
 
-static void DefineMacro(Preprocessor& cpp, const std::string& def) {
-  auto pos = def.find('=');
-  std::string macro;
-  std::string* replace;
-  if (pos == std::string::npos) {
-    macro = def;
-    replace = new std::string();
-  } else {
-    macro = def.substr(0, pos);
-    replace = new std::string(def.substr(pos + 1));
-  }
-  cpp.AddMacro(macro, replace); 
-}
-
-
 static std::string GetName(const std::string& path) {
   auto pos = path.rfind('/');
   if (pos == std::string::npos)
@@ -78,42 +118,242 @@ static std::string GetName(const std::string& path) {
   return path.substr(pos + 1);
 }
 
+
+// The '.s' or '.o' file in current directory for a '.c' file
+static std::string GetOutName(const std::string& path, char ext) {
+  auto name = GetName(path);
+  name.back() = ext;
+  return name;
+}
+
+
+/*
+ * The integrated assembler can't emit debug information,
+ * '-g' falls back to the system assembler.
+ */
+static bool UseIntegratedAs() {
+  return !only_compile && !debug && !no_integrated_as;
+}
+
+
+// Escapes the characters special to make
+static std::string MakeQuote(const std::string& path) {
+  std::string ret;
+  for (auto c: path) {
+    if (c == ' ' || c == '#')
+      ret.push_back('\\');
+    else if (c == '$')
+      ret.push_back('$');
+    ret.push_back(c);
+  }
+  return ret;
+}
+
+
+// The rule of '-MD' is for the output file, that of '-M' for the object
+static std::string GetDepsTarget() {
+  if (deps_side && specified_out_name)
+    return filename_out;
+  return GetOutName(filename_in, 'o');
+}
+
+
+// 'x.d' beside the output file of '-MD', or in current directory
+static std::string GetDepsName() {
+  if (deps_out.size())
+    return deps_out;
+  auto name = specified_out_name ? filename_out: GetName(filename_in);
+  auto pos = name.rfind('.');
+  if (pos == std::string::npos || pos < name.rfind('/') + 1)
+    return name + ".d";
+  return name.substr(0, pos) + ".d";
+}
+
+
+/*
+ * Writes the rule as 'gcc -M' does: the source file then the headers,
+ * lines are continued after 75 columns.
+ */
+static void WriteDeps(FILE* fp, const Preprocessor& cpp) {
+  std::vector<std::string> deps;
+  for (auto path: cpp.Dependencies()) {
+    if (deps.size() && deps_user_only && cpp.IsSystemHeader(*path))
+      continue;
+    // Headers of current directory are found as './name'
+    if (deps.size() && path->compare(0, 2, "./") == 0)
+      deps.push_back(MakeQuote(path->substr(2)));
+    else
+      deps.push_back(MakeQuote(*path));
+  }
+  if (pch_in.size())
+    deps.push_back(MakeQuote(pch_in));
+
+  auto line = MakeQuote(GetDepsTarget()) + ":";
+  for (const auto& dep: deps) {
+    if (line.size() + dep.size() + 1 > 75) {
+      fprintf(fp, "%s \\\n", line.c_str());
+      line.clear();
+    }
+    line += " " + dep;
+  }
+  fprintf(fp, "%s\n", line.c_str());
+  if (deps_phony) {
+    for (size_t i = 1; i < deps.size(); ++i)
+      fprintf(fp, "%s:\n", deps[i].c_str());
+  }
+}
+
+
 static int RunWgtcc() {
-  if (GetExtension(filename_in) != ".c")
+  if (GetExtension(filename_in) != (emit_pch ? ".h": ".c"))
     return 0;
 
+  PhaseTimer cppTimer(PhaseTimer::PREPROCESS);
   Preprocessor cpp(&filename_in);
+  TokenSequence ts;
+  // Macros defined in command line override the precompiled ones
+  if (pch_in.size())
+    PCHReader(pch_in).Read(cpp, ts);
   for (auto& def: defines)
-    DefineMacro(cpp, def);
+    cpp.DefineMacro(def);
   for (auto& path: include_paths)
     cpp.AddSearchPath(path);
 
+  // '-o' is the output of '-E' and '-M', the final output otherwise
   FILE* fp = stdout;
-  if (specified_out_name) {
+  if (specified_out_name && (only_preprocess || deps_only)) {
     fp = fopen(filename_out.c_str(), "w");
   }
-  TokenSequence ts;
   cpp.Process(ts);
-  if (only_preprocess) {
+  if (deps_side || (deps_only && deps_out.size())) {
+    auto name = GetDepsName();
+    auto depsFp = fopen(name.c_str(), "w");
+    if (depsFp == nullptr)
+      Error("cannot open dependency file '%s'", name.c_str());
+    WriteDeps(depsFp, cpp);
+    fclose(depsFp);
+  } else if (deps_only) {
+    WriteDeps(fp, cpp);
+  }
+  if (mem_report) {
+    for (auto iter = ts; !iter.Empty(); iter.Next())
+      ++num_tokens;
+  }
+  if (header_cache_stats) {
+    fprintf(stderr, "%s: header cache: %zu hits, %zu misses, "
+            "%zu skipped\n", filename_in.c_str(),
+            cpp.HeaderCacheHits(), cpp.HeaderCacheMisses(),
+            cpp.HeaderSkips());
+  }
+  if (deps_only) {
+    return 0;
+  } else if (only_preprocess) {
+    PhaseTimer timer(PhaseTimer::OUTPUT);
     ts.Print(fp);
     return 0;
   }
 
-  if (!only_compile || !specified_out_name) {
-    filename_out = GetName(filename_in);
-    filename_out.back() = 's';
+  if (emit_pch) {
+    PhaseTimer timer(PhaseTimer::OUTPUT);
+    if (!specified_out_name)
+      filename_out = GetName(filename_in) + ".pch";
+    fp = fopen(filename_out.c_str(), "wb");
+    if (fp == nullptr)
+      Error("cannot open output file '%s'", filename_out.c_str());
+    PCHWriter(fp).Write(cpp, ts);
+    fclose(fp);
+    return 0;
   }
-  fp = fopen(filename_out.c_str(), "w");
-  
+
+  // '-o' names the object or the assembly only if it is the last output
+  auto ext = UseIntegratedAs() ? 'o': 's';
+  auto last = ext == 'o' ? only_assemble: only_compile;
+  if (!last || !specified_out_name)
+    filename_out = GetOutName(filename_in, ext);
+
+  // A hit skips parsing and code generation
+  std::unique_ptr<CompileCache> cache(CompileCache::Open());
+  if (cache) {
+    PhaseTimer timer(PhaseTimer::CACHE);
+    cache->SetKey(ts, filename_in, ext, debug);
+    if (cache->Fetch(filename_out)) {
+      if (cache_stats)
+        cache->PrintStats(stderr, filename_in);
+      return 0;
+    }
+  }
+
+  // The generator drives the parser, one function at a time.
+  // Only the AST of a function is released after it, not its tokens
   Parser parser(ts);
-  parser.Parse();
-  Generator::SetInOut(&parser, fp);
-  Generator().Gen();
-  fclose(fp);
+
+  if (UseIntegratedAs()) {
+    Assembler as;
+    {
+      PhaseTimer timer(PhaseTimer::CODEGEN);
+      Generator(&parser, &as).Gen(pipeline);
+    }
+    PhaseTimer timer(PhaseTimer::OUTPUT);
+    fp = fopen(filename_out.c_str(), "wb");
+    if (fp == nullptr)
+      Error("cannot open output file '%s'", filename_out.c_str());
+    as.WriteObject(fp);
+    fclose(fp);
+  } else {
+    fp = fopen(filename_out.c_str(), "w");
+    {
+      PhaseTimer timer(PhaseTimer::CODEGEN);
+      Generator(&parser, fp).Gen(pipeline);
+    }
+    PhaseTimer timer(PhaseTimer::OUTPUT);
+    fclose(fp);
+  }
+
+  if (cache) {
+    PhaseTimer timer(PhaseTimer::CACHE);
+    cache->Store(filename_out);
+    if (cache_stats)
+      cache->PrintStats(stderr, filename_in);
+  }
   return 0;
 }
 
 
+// With several input files, 'x.json' becomes 'x.<input>.json' for each
+static std::string GetTraceName() {
+  if (filenames_in.size() <= 1)
+    return trace_out;
+  auto name = GetName(filename_in);
+  name = name.substr(0, name.rfind('.'));
+  auto pos = trace_out.rfind('.');
+  if (pos == std::string::npos || pos < trace_out.rfind('/') + 1)
+    return trace_out + "." + name;
+  return trace_out.substr(0, pos) + "." + name + trace_out.substr(pos);
+}
+
+
+static void PrintReports() {
+  if (time_report)
+    PhaseTimer::Print(stderr, filename_in, json_report);
+  if (mem_report)
+    MemReport::Print(stderr, filename_in, num_tokens, json_report);
+  if (Trace::Enabled())
+    Trace::Write(GetTraceName(), filename_in);
+}
+
+
+// The reports are printed before the state of the compilation is released
+static int Compile() {
+  Compilation comp;
+  UseCompilation use(&comp);
+  comp.filename_ = filename_in;
+  comp.debug_ = debug;
+  auto ret = RunWgtcc();
+  PrintReports();
+  return ret;
+}
+
+
 static int RunGcc() {
   // Froce C11
   bool spec_std = false;
@@ -132,7 +372,7 @@ static int RunGcc() {
     systemArg += " " + arg;
   }
   auto ret = system(systemArg.c_str());
-  return ret;
+  return WIFEXITED(ret) ? WEXITSTATUS(ret): -1;
 }
 
 
@@ -171,6 +411,196 @@ static void ParseOut(int argc, char* argv[], int& i) {
 }
 
 
+// Returns false if the flag is left to gcc
+static bool ParseFlag(const char* flag) {
+  if (strcmp(flag, "-fno-integrated-as") == 0) {
+    no_integrated_as = true;
+  } else if (strcmp(flag, "-fintegrated-as") == 0) {
+    no_integrated_as = false;
+  } else if (strcmp(flag, "-fpipeline") == 0) {
+    pipeline = true;
+  } else if (strcmp(flag, "-fno-pipeline") == 0) {
+    pipeline = false;
+  } else if (strcmp(flag, "-fcache-stats") == 0) {
+    cache_stats = true;
+  } else if (strcmp(flag, "-fheader-cache-stats") == 0) {
+    header_cache_stats = true;
+  } else if (strcmp(flag, "-ftime-report") == 0) {
+    time_report = true;
+  } else if (strcmp(flag, "-ftime-report=json") == 0) {
+    time_report = json_report = true;
+  } else if (strcmp(flag, "-fmem-report") == 0) {
+    mem_report = true;
+  } else if (strcmp(flag, "-fmem-report=json") == 0) {
+    mem_report = json_report = true;
+  } else if (strncmp(flag, "-ftrace=", 8) == 0) {
+    trace_out = flag + 8;
+    if (trace_out.empty())
+      Error("missing trace file name after '-ftrace='");
+  } else {
+    return false;
+  }
+  return true;
+}
+
+
+// Returns false if the option is left to gcc
+static bool ParseDeps(int argc, char* argv[], int& i) {
+  auto opt = &argv[i][2];
+  if (strcmp(opt, "") == 0) {
+    deps_only = only_preprocess = true;
+  } else if (strcmp(opt, "M") == 0) {
+    deps_only = only_preprocess = deps_user_only = true;
+  } else if (strcmp(opt, "D") == 0) {
+    deps_side = true;
+  } else if (strcmp(opt, "MD") == 0) {
+    deps_side = deps_user_only = true;
+  } else if (strcmp(opt, "P") == 0) {
+    deps_phony = true;
+  } else if (opt[0] == 'F') {
+    if (opt[1]) {
+      deps_out = &opt[1];
+    } else {
+      if (i == argc - 1)
+        Error("missing argument to '%s'", argv[i]);
+      deps_out = argv[++i];
+    }
+  } else {
+    return false;
+  }
+  return true;
+}
+
+
+static void ParseIncludePCH(int argc, char* argv[], int& i) {
+  if (i == argc - 1)
+    Error("missing argument to '%s'", argv[i]);
+  pch_in = argv[++i];
+}
+
+
+static void ParseJobs(int argc, char* argv[], int& i) {
+  const char* arg;
+  if (argv[i][2]) {
+    arg = &argv[i][2];
+  } else {
+    if (i == argc - 1)
+      Error("missing argument to '%s'", argv[i]);
+    arg = argv[++i];
+  }
+
+  char* end;
+  max_jobs = strtol(arg, &end, 10);
+  if (*end != 0 || max_jobs <= 0)
+    Error("invalid number of jobs: '%s'", arg);
+}
+
+
+/*
+ * A compilation of one input file in a child process.
+ * The child's stdout and stderr are redirected to temporary files,
+ * so that the outputs are replayed in the order of the input files,
+ * no matter in which order the children finish.
+ */
+struct Job {
+  std::string filename_;
+  pid_t pid_ {-1};
+  FILE* out_ {nullptr};
+  FILE* err_ {nullptr};
+  bool done_ {false};
+  bool failed_ {false};
+};
+
+
+static void Replay(FILE* from, FILE* to) {
+  if (from == nullptr)
+    return;
+  fflush(from);
+  rewind(from);
+  char buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), from)) > 0)
+    fwrite(buf, 1, n, to);
+  fflush(to);
+  fclose(from);
+}
+
+
+static void StartJob(Job& job) {
+  job.out_ = tmpfile();
+  job.err_ = tmpfile();
+  if (job.out_ == nullptr || job.err_ == nullptr)
+    Error("cannot create temporary file");
+
+  // Avoid duplicating buffered output in the child
+  fflush(stdout);
+  fflush(stderr);
+
+  filename_in = job.filename_;
+  job.pid_ = fork();
+  if (job.pid_ < 0) {
+    Error("fork error");
+  } else if (job.pid_ == 0) {
+    // Do work in child process
+    dup2(fileno(job.out_), STDOUT_FILENO);
+    dup2(fileno(job.err_), STDERR_FILENO);
+    exit(Compile());
+  }
+}
+
+
+// Returns true if all files are compiled successfully
+static bool RunJobs() {
+  if (max_jobs <= 0)
+    max_jobs = std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+
+  std::vector<Job> jobs(filenames_in.size());
+  auto iter = filenames_in.begin();
+  for (auto& job: jobs)
+    job.filename_ = *iter++;
+
+  bool has_error = false;
+  size_t started = 0;
+  size_t finished = 0;
+  size_t replayed = 0;
+  long running = 0;
+  while (true) {
+    // Stop starting new jobs after an error
+    while (!has_error && running < max_jobs && started < jobs.size()) {
+      StartJob(jobs[started++]);
+      ++running;
+    }
+    if (running == 0)
+      break;
+
+    int stat;
+    auto pid = wait(&stat);
+    if (pid < 0)
+      Error("wait error");
+    for (size_t i = finished; i < started; ++i) {
+      auto& job = jobs[i];
+      if (job.pid_ != pid)
+        continue;
+      job.done_ = true;
+      job.failed_ = !WIFEXITED(stat) || WEXITSTATUS(stat) != 0;
+      has_error = has_error || job.failed_;
+      --running;
+      break;
+    }
+    while (finished < started && jobs[finished].done_)
+      ++finished;
+
+    // Outputs are replayed in the order of input files
+    while (replayed < finished) {
+      auto& job = jobs[replayed++];
+      Replay(job.out_, stdout);
+      Replay(job.err_, stderr);
+    }
+  }
+  return !has_error;
+}
+
+
 /* Use:
  *   wgtcc: compile
  *   gcc: assemble and link
@@ -194,50 +624,83 @@ int main(int argc, char* argv[]) {
     case 'h': Usage(); break;
     case 'E': only_preprocess = true; break;
     case 'S': only_compile = true; break;
+    case 'c': only_assemble = true; break;
     case 'I': ParseInclude(argc, argv, i); break;
+    case 'e':
+      if (strcmp(argv[i], "-emit-pch") == 0) {
+        gcc_args.pop_back();
+        emit_pch = true;
+      }
+      break;
+    case 'i':
+      if (strcmp(argv[i], "-include-pch") == 0) {
+        gcc_args.pop_back();
+        ParseIncludePCH(argc, argv, i);
+      }
+      break;
     case 'D': ParseDefine(argc, argv, i); break;
     case 'o':
       specified_out_name = true; 
       ParseOut(argc, argv, i); break;
     case 'g': gcc_args.pop_back(); debug = true; break;
+    case 'j': gcc_args.pop_back(); ParseJobs(argc, argv, i); break;
+    case 'f': if (ParseFlag(argv[i])) gcc_args.pop_back(); break;
+    case 'M': if (ParseDeps(argc, argv, i)) gcc_args.pop_back(); break;
     default:;
     }
   }
 
-#ifdef DEBUG
-  RunWgtcc();
-#else
-  for (const auto& filename: filenames_in) {
-    filename_in = filename;
-    bool has_error = false;
-    pid_t pid = fork();
-    if (pid < 0) {
-      Error("fork error");
-    } else if (pid == 0) {
-      // Do work in child process
-      return RunWgtcc();
-    } else {
-      int stat;
-      wait(&stat);
-      has_error = has_error || (WIFEXITED(stat) && WEXITSTATUS(stat) != 0);
-    }
+  for (auto& filename: filenames_in) {
+    if ((GetExtension(filename) == ".h") != emit_pch)
+      Error("'-emit-pch' requires header files: '%s'", filename.c_str());
+  }
+  if (deps_out.size() && filenames_in.size() > 1)
+    Error("cannot specify dependency file with multiple input files");
+
+  if (time_report)
+    PhaseTimer::Enable();
+  if (trace_out.size())
+    Trace::Enable();
+
+  // Intermediate files are removed after gcc finished
+  auto ext = UseIntegratedAs() ? 'o': 's';
+  auto linking = !(only_preprocess || only_compile || emit_pch
+      || (only_assemble && UseIntegratedAs()));
+  std::list<std::string> filenames_tmp;
+  for (auto& filename: filenames_in) {
+    if (linking && GetExtension(filename) == ".c")
+      filenames_tmp.push_back(GetOutName(filename, ext));
+  }
 
-    if (has_error)
-      return 0;
+  if (!RunJobs()) {
+    // Also when a job failed, those of the jobs that succeeded
+    for (auto& filename: filenames_tmp)
+      unlink(filename.c_str());
+    return -1;
   }
-#endif
 
-  if (only_preprocess || only_compile) {
+  if (!linking) {
     if (specified_out_name && filenames_in.size() > 1)
       Error("cannot specifier output filename with multiple input file");
-    return 0;
+    // The integrated assembler takes the C files of '-c', gcc the others
+    if (!only_assemble || only_preprocess || emit_pch)
+      return 0;
+    auto others = false;
+    for (auto& filename: filenames_in) {
+      if (GetExtension(filename) != ".c") {
+        gcc_args.push_back(filename);
+        others = true;
+      }
+    }
+    if (!others)
+      return 0;
+    PhaseTimer timer(PhaseTimer::GCC);
+    return RunGcc();
   }
 
-  std::list<std::string> filenames_out;
   for (auto& filename: filenames_in) {
     if (GetExtension(filename) == ".c") {
-      gcc_args.push_back(GetName(filename));
-      gcc_args.back().back() = 's';
+      gcc_args.push_back(GetOutName(filename, ext));
     } else {
       gcc_args.clear();
       for (int i = 1; i < argc; ++i)
@@ -245,8 +708,16 @@ int main(int argc, char* argv[]) {
       break;
     }
   }
-  auto ret = RunGcc();
-  auto cmd = "rm -f " + filename_out;
-  if (system(cmd.c_str())) {}
+  int ret;
+  {
+    PhaseTimer timer(PhaseTimer::GCC);
+    ret = RunGcc();
+  }
+  if (time_report) {
+    auto out = specified_out_name ? filename_out: std::string("a.out");
+    PhaseTimer::Print(stderr, out, json_report);
+  }
+  for (auto& filename: filenames_tmp)
+    unlink(filename.c_str());
   return ret;
 }
@@ -4,6 +4,7 @@
 #include "encoding.h"
 #include "error.h"
 #include "evaluator.h"
+#include "report.h"
 #include "scope.h"
 #include "type.h"
 
@@ -13,8 +14,6 @@
 #include <climits>
 
 
-FuncType* Parser::vaStartType_ {nullptr};
-FuncType* Parser::vaArgType_ {nullptr};
 
 
 FuncDef* Parser::EnterFunc(Identifier* ident) {
@@ -29,10 +28,10 @@ void Parser::ExitFunc() {
   for (auto iter = unresolvedJumps_.begin();
        iter != unresolvedJumps_.end(); ++iter) {
     auto label = iter->first;
-    auto labelStmt = FindLabel(label->str_);
+    auto labelStmt = FindLabel(label->Str());
     if (labelStmt == nullptr) {
       Error(label, "label '%s' used but not defined",
-          label->str_.c_str());
+          label->Str().c_str());
     }
     
     iter->second->SetLabel(labelStmt);
@@ -46,7 +45,8 @@ void Parser::ExitFunc() {
 
 
 void Parser::EnterBlock(FuncType* funcType) {
-  curScope_ = new Scope(curScope_, S_BLOCK);      
+  auto& arena = ASTNode::CurArena();
+  curScope_ = arena.Own(new (arena) Scope(curScope_, S_BLOCK));
   if (funcType) {
     // Merge elements in param scope into current block scope
     for (auto param: funcType->Params())
@@ -61,8 +61,19 @@ void Parser::Parse() {
 }
 
 
+void Parser::Parse(const ExtDeclConsumer& consumer) {
+  consumer_ = consumer;
+  Parse();
+  consumer_ = nullptr;
+}
+
+
 void Parser::ParseTranslationUnit() {
-  while (!ts_.Peek()->IsEOF()) {            
+  while (true) {
+    if (consumer_)
+      Stream();
+    if (ts_.Peek()->IsEOF())
+      break;
     if (ts_.Try(Token::STATIC_ASSERT)) {
       ParseStaticAssert();
       continue;
@@ -88,23 +99,54 @@ void Parser::ParseTranslationUnit() {
       unit_->Add(ParseFuncDef(ident));
     } else { // Declaration
       auto decl = ParseInitDeclarator(ident);
-      if (decl) unit_->Add(decl);
+      if (decl) AddDecl(decl);
 
       while (ts_.Try(',')) {
         auto ident = ParseDirectDeclarator(declType, storageSpec,
                                            funcSpec, align);
         decl = ParseInitDeclarator(ident);
-        if (decl) unit_->Add(decl);
+        if (decl) AddDecl(decl);
       }
       // GNU extension: function/type/variable attributes
       TryAttributeSpecList();
       ts_.Expect(';');
     }
   }
+
+  for (auto decl: tentatives_)
+    unit_->Add(decl);
+  tentatives_.clear();
+  if (consumer_)
+    Stream();
+}
+
+
+// A tentative definition may get its initializer from a later
+// declaration (C11 6.9.2). The consumer must not see it before.
+void Parser::AddDecl(Declaration* decl) {
+  if (consumer_ && !decl->Obj()->HasInit())
+    tentatives_.push_back(decl);
+  else
+    unit_->Add(decl);
+}
+
+
+void Parser::Stream() {
+  auto& extDecls = unit_->ExtDecls();
+  // A function definition is parsed alone
+  assert(funcArena_ == nullptr || extDecls.size() == 1);
+  for (auto extDecl: extDecls)
+    consumer_(extDecl, funcArena_);
+  extDecls.clear();
+  funcArena_ = nullptr;
 }
 
 
 FuncDef* Parser::ParseFuncDef(Identifier* ident) {
+  TraceSpan span("parse", ident->Name());
+  if (consumer_)
+    funcArena_ = Arena::Acquire();
+  ASTRegion region(consumer_ ? *funcArena_: ASTNode::CurArena());
   auto funcDef = EnterFunc(ident);
 
   if (funcDef->FuncType()->Complete()) {
@@ -158,8 +200,8 @@ Expr* Parser::ParsePrimaryExpr() {
   if (tok->IsIdentifier()) {
     auto ident = curScope_->Find(tok);
     if (ident) return ident;
-    if (IsBuiltin(tok->str_)) return GetBuiltin(tok);
-    Error(tok, "undefined symbol '%s'", tok->str_.c_str());
+    if (IsBuiltin(tok->Str())) return GetBuiltin(tok);
+    Error(tok, "undefined symbol '%s'", tok->Str().c_str());
   } else if (tok->IsConstant()) {
     return ParseConstant(tok);
   } else if (tok->IsLiteral()) {
@@ -168,7 +210,7 @@ Expr* Parser::ParsePrimaryExpr() {
     return ParseGeneric();
   }
 
-  Error(tok, "'%s' unexpected", tok->str_.c_str());
+  Error(tok, "'%s' unexpected", tok->Str().c_str());
   return nullptr; // Make compiler happy
 }
 
@@ -185,7 +227,8 @@ static void ConvertLiteral(std::string& val, Encoding enc) {
 
 
 Constant* Parser::ConcatLiterals(const Token* tok) {
-  auto val = new std::string;
+  // Lives as long as the tokens, the generator may emit it at the end
+  auto val = Arena::Get(Arena::TOKEN).Make<std::string>();
   auto enc = Scanner(tok).ScanLiteral(*val);
   ConvertLiteral(*val, enc);	
   while (ts_.Test(Token::LITERAL)) {
@@ -237,7 +280,7 @@ Constant* Parser::ParseConstant(const Token* tok) {
 
 
 Constant* Parser::ParseFloat(const Token* tok) {
-  const auto& str = tok->str_;
+  const auto& str = tok->Str();
   size_t end = 0;
   double val = 0.0;
   try {
@@ -282,7 +325,7 @@ Constant* Parser::ParseCharacter(const Token* tok) {
 
 
 Constant* Parser::ParseInteger(const Token* tok) {
-  const auto& str = tok->str_;
+  const auto& str = tok->Str();
   size_t end = 0;
   long val = 0;
   try {
@@ -451,7 +494,7 @@ Expr* Parser::ParseSubScripting(Expr* lhs) {
 
 
 BinaryOp* Parser::ParseMemberRef(const Token* tok, int op, Expr* lhs) {
-  auto memberName = ts_.Peek()->str_;
+  auto memberName = ts_.Peek()->Str();
   ts_.Expect(Token::IDENTIFIER);
 
   auto structUnionType = lhs->Type()->ToStruct();
@@ -1133,7 +1176,7 @@ Type* Parser::ParseEnumSpec() {
   std::string tagName;
   auto tok = ts_.Peek();
   if (ts_.Try(Token::IDENTIFIER)) {
-    tagName = tok->str_;
+    tagName = tok->Str();
     if (ts_.Try('{')) {
       //定义enum类型
       auto tagIdent = curScope_->FindTagInCurScope(tok);
@@ -1173,7 +1216,7 @@ Type* Parser::ParseEnumerator(ArithmType* type) {
     // GNU extension: enumerator attributes
     TryAttributeSpecList();
 
-    const auto& enumName = tok->str_;
+    const auto& enumName = tok->Str();
     auto ident = curScope_->FindInCurScope(tok);
     if (ident) {
       Error(tok, "redefinition of enumerator '%s'", enumName.c_str());
@@ -1207,7 +1250,7 @@ Type* Parser::ParseStructUnionSpec(bool isStruct) {
   std::string tagName;
   auto tok = ts_.Peek();
   if (ts_.Try(Token::IDENTIFIER)) {
-    tagName = tok->str_;
+    tagName = tok->Str();
     if (ts_.Try('{')) {
       //看见大括号，表明现在将定义该struct/union类型
       //我们不用关心上层scope是否定义了此tag，如果定义了，那么就直接覆盖定义      
@@ -1312,7 +1355,7 @@ StructType* Parser::ParseStructUnionDecl(StructType* type) {
         }
       }
 
-      const auto& name = tok->str_;                
+      const auto& name = tok->Str();                
       if (type->GetMember(name)) {
         Error(tok, "duplicate member '%s'", name.c_str());
       } else if (!memberType->Complete()) {
@@ -1500,7 +1543,7 @@ Identifier* Parser::ProcessDeclarator(const Token* tok,
   // 如果 storage 是 typedef，那么应该往符号表里面插入 type
   // 定义 void 类型变量是非法的，只能是指向void类型的指针
   // 如果 funcSpec != 0, 那么现在必须是在定义函数，否则出错
-  const auto& name = tok->str_;
+  const auto& name = tok->Str();
   Identifier* ident;
 
   if (storageSpec & S_TYPEDEF) {
@@ -1606,6 +1649,10 @@ Identifier* Parser::ProcessDeclarator(const Token* tok,
     }
   }
 
+  // A block scope extern outlives the function body
+  bool external = linkage == L_EXTERNAL && ident == nullptr;
+  ASTRegion region(external ? Arena::Get(Arena::AST): ASTNode::CurArena());
+
   Identifier* ret;
   // TODO(wgtdkp): Treat function as object ?
   if (type->ToFunc()) {
@@ -1620,7 +1667,7 @@ Identifier* Parser::ProcessDeclarator(const Token* tok,
     ret = obj;
   }
   curScope_->Insert(ret);
-  if (linkage == L_EXTERNAL && ident == nullptr) {
+  if (external) {
       externalSymbols_->Insert(ret);
   }
 
@@ -1641,7 +1688,7 @@ QualType Parser::ParseArrayFuncDeclarator(const Token* ident, QualType base) {
     if (!base->Complete()) {
       // FIXME(wgtdkp): ident could be nullptr
       Error(ident, "'%s' has incomplete element type",
-          ident->str_.c_str());
+          ident->Str().c_str());
     }
     return ArrayType::New(len, base);
   } else if (ts_.Try('(')) {	//function declaration
@@ -1739,7 +1786,7 @@ QualType Parser::ParseAbstractDeclarator(QualType type) {
   auto tok = tokenTypePair.first;
   type = tokenTypePair.second;
   if (tok) { // Not a abstract declarator!
-    Error(tok, "unexpected identifier '%s'", tok->str_.c_str());
+    Error(tok, "unexpected identifier '%s'", tok->Str().c_str());
   }
   return type;
 }
@@ -1749,9 +1796,18 @@ Identifier* Parser::ParseDirectDeclarator(QualType type,
                                           int storageSpec,
                                           int funcSpec,
                                           int align) {
-  auto tokenTypePair = ParseDeclarator(type);
-  auto tok = tokenTypePair.first;
-  type = tokenTypePair.second;
+  // A declarator that may get external linkage, like a function without
+  // storage class, is kept past the body: its parameters and prototype
+  // scope are compared with the later declarations.
+  bool external = (storageSpec & S_EXTERN) ||
+      !(storageSpec & (S_TYPEDEF | S_STATIC | S_AUTO | S_REGISTER));
+  const Token* tok;
+  {
+    ASTRegion region(external ? Arena::Get(Arena::AST): ASTNode::CurArena());
+    auto tokenTypePair = ParseDeclarator(type);
+    tok = tokenTypePair.first;
+    type = tokenTypePair.second;
+  }
   if (tok == nullptr) {
     Error(errTok_, "expect identifier or '('");
   }
@@ -2052,7 +2108,7 @@ void Parser::ParseStructInitializer(Declaration* decl,
     
     if ((designated = ts_.Try('.'))) {
       auto tok = ts_.Expect(Token::IDENTIFIER);
-      const auto& name = tok->str_;
+      const auto& name = tok->Str();
       if (!type->GetMember(name)) {
         Error(tok, "member '%s' not found", name.c_str());
       }
@@ -2526,7 +2582,7 @@ JumpStmt* Parser::ParseGotoStmt() {
   ts_.Expect(Token::IDENTIFIER);
   ts_.Expect(';');
 
-  auto labelStmt = FindLabel(label->str_);
+  auto labelStmt = FindLabel(label->Str());
   if (labelStmt) {
     return JumpStmt::New(labelStmt);
   }
@@ -2539,7 +2595,7 @@ JumpStmt* Parser::ParseGotoStmt() {
 
 
 CompoundStmt* Parser::ParseLabelStmt(const Token* label) {
-  const auto& labelStr = label->str_;
+  const auto& labelStr = label->Str();
   auto stmt = ParseStmt();
   if (nullptr != FindLabel(labelStr)) {
     Error(label, "redefinition of label '%s'", labelStr.c_str());
@@ -2561,7 +2617,7 @@ bool Parser::IsBuiltin(const std::string& name) {
 }
 
 
-bool Parser::IsBuiltin(FuncType* type) {
+bool Parser::IsBuiltin(FuncType* type) const {
   assert(vaStartType_ && vaArgType_);
   return type == vaStartType_ || type == vaArgType_;
 }
@@ -2582,17 +2638,17 @@ void Parser::DefineBuiltins() {
 
 Identifier* Parser::GetBuiltin(const Token* tok) {
   assert(vaStartType_ && vaArgType_);
-  static Identifier* vaStart = nullptr;
-  static Identifier* vaArg = nullptr;
-  const auto& name = tok->str_;
+  // Shared by all functions
+  ASTRegion region(Arena::AST);
+  const auto& name = tok->Str();
   if (name == "__builtin_va_start") {
-    if (!vaStart)
-      vaStart = Identifier::New(tok, vaStartType_, Linkage::L_EXTERNAL);
-    return vaStart;
+    if (!vaStart_)
+      vaStart_ = Identifier::New(tok, vaStartType_, Linkage::L_EXTERNAL);
+    return vaStart_;
   } else if (name == "__builtin_va_arg") {
-    if (!vaArg)
-      vaArg = Identifier::New(tok, vaArgType_, Linkage::L_EXTERNAL);
-    return vaArg;
+    if (!vaArg_)
+      vaArg_ = Identifier::New(tok, vaArgType_, Linkage::L_EXTERNAL);
+    return vaArg_;
   }
   assert(false);
   return nullptr;
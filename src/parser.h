@@ -4,13 +4,14 @@
 #include "ast.h"
 #include "encoding.h"
 #include "error.h"
-#include "mem_pool.h"
 #include "scope.h"
 #include "token.h"
 
 #include <cassert>
+#include <functional>
 #include <memory>
 #include <stack>
+#include <vector>
 
 
 class Preprocessor;
@@ -22,15 +23,18 @@ class Parser {
   typedef std::vector<std::pair<Constant*, LabelStmt*>> CaseLabelList;
   typedef std::list<std::pair<const Token*, JumpStmt*>> LabelJumpList;
   typedef std::map<std::string, LabelStmt*> LabelMap;
+  typedef std::function<void(ExtDecl*, Arena*)> ExtDeclConsumer;
   friend class Generator;
 
 public:
   explicit Parser(const TokenSequence& ts) 
     : unit_(TranslationUnit::New()),
       ts_(ts),
-      externalSymbols_(new Scope(nullptr, S_BLOCK)),
+      externalSymbols_(Arena::Get(Arena::AST).Own(
+          new (Arena::AST) Scope(nullptr, S_BLOCK))),
       errTok_(nullptr),
-      curScope_(new Scope(nullptr, S_FILE)),
+      curScope_(Arena::Get(Arena::AST).Own(
+          new (Arena::AST) Scope(nullptr, S_FILE))),
       curFunc_(nullptr),
       breakDest_(nullptr),
       continueDest_(nullptr),
@@ -50,7 +54,16 @@ public:
   Expr* ParseGeneric();
 
   void Parse();
+  // External declarations are handed to the consumer as soon as
+  // they are parsed. A function definition comes with the arena of
+  // its body, which the consumer recycles when done with it.
+  // Objects without initializer are handed at the end of the unit.
+  // Tokens are not recycled: the preprocessor has produced all of
+  // them before, they live as long as the unit.
+  void Parse(const ExtDeclConsumer& consumer);
   void ParseTranslationUnit();
+  void AddDecl(Declaration* decl);
+  void Stream();
   FuncDef* ParseFuncDef(Identifier* ident);
   
   
@@ -190,7 +203,10 @@ public:
   
   void EnterBlock(FuncType* funcType=nullptr);
   void ExitBlock() { curScope_ = curScope_->Parent(); }
-  void EnterProto() { curScope_ = new Scope(curScope_, S_PROTO); }
+  void EnterProto() {
+    auto& arena = ASTNode::CurArena();
+    curScope_ = arena.Own(new (arena) Scope(curScope_, S_PROTO));
+  }
   void ExitProto() { curScope_ = curScope_->Parent(); }
   FuncDef* EnterFunc(Identifier* ident);
   void ExitFunc();
@@ -210,16 +226,21 @@ public:
   const TokenSequence& ts() const { return ts_; }
 
 private:
-  static bool IsBuiltin(FuncType* type);
+  bool IsBuiltin(FuncType* type) const;
   static bool IsBuiltin(const std::string& name);
-  static Identifier* GetBuiltin(const Token* tok);
-  static void DefineBuiltins();
+  Identifier* GetBuiltin(const Token* tok);
+  void DefineBuiltins();
 
-  static FuncType* vaStartType_;
-  static FuncType* vaArgType_;
+  FuncType* vaStartType_ {nullptr};
+  FuncType* vaArgType_ {nullptr};
+  Identifier* vaStart_ {nullptr};
+  Identifier* vaArg_ {nullptr};
 
   // The root of the AST
   TranslationUnit* unit_;
+  ExtDeclConsumer consumer_;
+  Arena* funcArena_ {nullptr};
+  std::vector<Declaration*> tentatives_;
   
   TokenSequence ts_;
 
@@ -0,0 +1,292 @@
+#include "pch.h"
+
+#include "arena.h"
+#include "error.h"
+
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+static const char pchMagic[8] = {'W', 'G', 'T', 'C', 'C', 'P', 'C', 'H'};
+static const uint32_t pchVersion = 2;
+static const uint32_t none = UINT32_MAX;
+
+
+/*
+ * Writer
+ */
+
+void PCHWriter::U32(uint32_t val) {
+  for (int i = 0; i < 4; ++i)
+    buf_.push_back(val >> (8 * i));
+}
+
+
+void PCHWriter::U64(uint64_t val) {
+  U32(val);
+  U32(val >> 32);
+}
+
+
+uint32_t PCHWriter::String(const std::string& str) {
+  auto iter = stringMap_.find(str);
+  if (iter != stringMap_.end())
+    return iter->second;
+  auto idx = static_cast<uint32_t>(strings_.size());
+  auto res = stringMap_.insert({str, idx});
+  strings_.push_back(&res.first->first);
+  return idx;
+}
+
+
+// The source line printed by diagnostics
+uint32_t PCHWriter::Line(const char* lineBegin) {
+  if (lineBegin == nullptr)
+    return none;
+  auto iter = lineMap_.find(lineBegin);
+  if (iter != lineMap_.end())
+    return iter->second;
+  auto end = lineBegin;
+  while (*end && *end != '\n')
+    ++end;
+  auto idx = String(std::string(lineBegin, end));
+  lineMap_[lineBegin] = idx;
+  return idx;
+}
+
+
+void PCHWriter::WriteToken(const Token* tok) {
+  U32(tok->tag_);
+  U8(tok->ws_);
+  U32(tok->loc_.filename_ ? String(*tok->loc_.filename_): none);
+  U32(Line(tok->loc_.lineBegin_));
+  U32(tok->loc_.line_);
+  U32(tok->loc_.column_);
+  U32(String(tok->Str()));
+}
+
+
+void PCHWriter::WriteTokens(TokenSequence ts) {
+  uint32_t cnt = 0;
+  for (auto iter = ts; !iter.Empty(); iter.Next())
+    ++cnt;
+  U32(cnt);
+  while (!ts.Empty())
+    WriteToken(ts.Next());
+}
+
+
+void PCHWriter::Write(const Preprocessor& cpp, TokenSequence os) {
+  U32(cpp.headerCache_.size());
+  for (const auto& file: cpp.headerCache_) {
+    const auto& cached = file.second;
+    U32(String(file.first));
+    U64(cached.dev_);
+    U64(cached.ino_);
+    U64(cached.mtime_.tv_sec);
+    U64(cached.mtime_.tv_nsec);
+    U32(cached.guard_.size() ? String(cached.guard_): none);
+  }
+
+  U32(cpp.onceFiles_.size());
+  for (const auto& id: cpp.onceFiles_) {
+    U64(id.first);
+    U64(id.second);
+  }
+
+  U32(cpp.macros_.size());
+  for (auto ident: cpp.macros_) {
+    const auto& macro = *ident->macro_;
+    U32(String(ident->Name()));
+    U8(macro.funcLike_);
+    U8(macro.variadic_);
+    U8(macro.preDef_);
+    U32(macro.params_.size());
+    for (const auto& param: macro.params_)
+      U32(String(param));
+    WriteTokens(macro.repSeq_);
+  }
+
+  WriteTokens(os);
+
+  // The string table goes first, so that the reader resolves
+  // indices while reading the records.
+  std::vector<uint8_t> body;
+  body.swap(buf_);
+  for (auto c: pchMagic)
+    U8(c);
+  U32(pchVersion);
+  U32(strings_.size());
+  for (auto str: strings_) {
+    U32(str->size());
+    for (auto c: *str)
+      U8(c);
+    U8(0);
+  }
+  buf_.insert(buf_.end(), body.begin(), body.end());
+
+  if (fwrite(buf_.data(), 1, buf_.size(), fp_) != buf_.size())
+    Error("failed to write precompiled header");
+}
+
+
+/*
+ * Reader
+ */
+
+PCHReader::PCHReader(const std::string& path): path_(path) {
+  auto fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    Error("%s: No such file or directory", path.c_str());
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+    Error("%s: cannot stat precompiled header", path.c_str());
+
+  // The mapping is never unmapped, tokens point into it
+  void* addr = nullptr;
+  if (st.st_size > 0)
+    addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED || addr == nullptr)
+    Error("%s: cannot map precompiled header", path.c_str());
+  p_ = static_cast<const uint8_t*>(addr);
+  end_ = p_ + st.st_size;
+}
+
+
+void PCHReader::Expect(size_t size) {
+  if (static_cast<size_t>(end_ - p_) < size)
+    Error("%s: bad precompiled header", path_.c_str());
+}
+
+
+uint8_t PCHReader::U8() {
+  Expect(1);
+  return *p_++;
+}
+
+
+uint32_t PCHReader::U32() {
+  Expect(4);
+  uint32_t val = 0;
+  for (int i = 0; i < 4; ++i)
+    val |= static_cast<uint32_t>(*p_++) << (8 * i);
+  return val;
+}
+
+
+uint64_t PCHReader::U64() {
+  uint64_t lo = U32();
+  uint64_t hi = U32();
+  return lo | (hi << 32);
+}
+
+
+const char* PCHReader::String(uint32_t idx) {
+  if (idx >= strings_.size())
+    Error("%s: bad precompiled header", path_.c_str());
+  return strings_[idx];
+}
+
+
+const std::string* PCHReader::Filename(uint32_t idx) {
+  if (idx == none)
+    return nullptr;
+  String(idx);
+  if (filenames_[idx] == nullptr)
+    filenames_[idx] =
+        Arena::Get(Arena::TOKEN).Make<std::string>(strings_[idx]);
+  return filenames_[idx];
+}
+
+
+Token* PCHReader::ReadToken() {
+  int tag = U32();
+  bool ws = U8();
+  SourceLocation loc;
+  loc.filename_ = Filename(U32());
+  auto line = U32();
+  loc.lineBegin_ = line == none ? nullptr: String(line);
+  loc.line_ = U32();
+  loc.column_ = U32();
+  return Token::New(tag, loc, String(U32()), ws);
+}
+
+
+TokenSequence PCHReader::ReadTokens() {
+  TokenSequence ts;
+  for (auto cnt = U32(); cnt > 0; --cnt)
+    ts.InsertBack(ReadToken());
+  return ts;
+}
+
+
+void PCHReader::Read(Preprocessor& cpp, TokenSequence& os) {
+  Expect(sizeof(pchMagic));
+  if (memcmp(p_, pchMagic, sizeof(pchMagic)) != 0)
+    Error("%s: not a precompiled header", path_.c_str());
+  p_ += sizeof(pchMagic);
+  if (U32() != pchVersion)
+    Error("%s: precompiled header version mismatch", path_.c_str());
+
+  for (auto cnt = U32(); cnt > 0; --cnt) {
+    auto len = U32();
+    Expect(len + 1);
+    strings_.push_back(reinterpret_cast<const char*>(p_));
+    p_ += len + 1;
+  }
+  filenames_.resize(strings_.size(), nullptr);
+
+  // Any change of the included files invalidates the image
+  for (auto cnt = U32(); cnt > 0; --cnt) {
+    std::string path = String(U32());
+    auto dev = U64();
+    auto ino = U64();
+    auto sec = U64();
+    auto nsec = U64();
+    auto guard = U32();
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0 || st.st_dev != dev
+        || st.st_ino != ino || (uint64_t)st.st_mtim.tv_sec != sec
+        || (uint64_t)st.st_mtim.tv_nsec != nsec) {
+      Error("%s: precompiled header is out of date, '%s' has changed",
+            path_.c_str(), path.c_str());
+    }
+    auto& cached = cpp.headerCache_[path];
+    if (!cached.Match(st))
+      cached.Reset(st);
+    if (guard != none)
+      cached.guard_ = String(guard);
+  }
+
+  for (auto cnt = U32(); cnt > 0; --cnt) {
+    auto dev = U64();
+    auto ino = U64();
+    cpp.onceFiles_.insert({dev, ino});
+  }
+
+  for (auto cnt = U32(); cnt > 0; --cnt) {
+    std::string name = String(U32());
+    bool funcLike = U8();
+    bool variadic = U8();
+    bool preDef = U8();
+    ParamList params;
+    for (auto n = U32(); n > 0; --n)
+      params.push_back(String(U32()));
+    auto repSeq = ReadTokens();
+    if (funcLike)
+      cpp.AddMacro(name, Macro(variadic, params, repSeq, preDef));
+    else
+      cpp.AddMacro(name, Macro(repSeq, preDef));
+  }
+
+  auto ts = ReadTokens();
+  os.InsertBack(ts);
+  if (p_ != end_)
+    Error("%s: bad precompiled header", path_.c_str());
+  cpp.pchIncluded_ = true;
+}
@@ -0,0 +1,74 @@
+#ifndef _WGTCC_PCH_H_
+#define _WGTCC_PCH_H_
+
+#include "cpp.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+/*
+ * Precompiled header.
+ * The image holds the state of the preprocessor after a header has been
+ * preprocessed: the macros, the preprocessed tokens, the identities and
+ * include guards of all files it has included, and '#pragma once' files.
+ * All strings, including the source lines that diagnostics print,
+ * are in one table; the reader maps the image and points into it.
+ */
+class PCHWriter {
+public:
+  explicit PCHWriter(FILE* fp): fp_(fp) {}
+  ~PCHWriter() {}
+  PCHWriter(const PCHWriter& other) = delete;
+  PCHWriter& operator=(const PCHWriter& other) = delete;
+
+  void Write(const Preprocessor& cpp, TokenSequence os);
+
+private:
+  uint32_t String(const std::string& str);
+  uint32_t Line(const char* lineBegin);
+  void WriteToken(const Token* tok);
+  void WriteTokens(TokenSequence ts);
+  void U8(uint8_t val) { buf_.push_back(val); }
+  void U32(uint32_t val);
+  void U64(uint64_t val);
+
+  FILE* fp_;
+  std::vector<uint8_t> buf_;
+  std::vector<const std::string*> strings_;
+  std::unordered_map<std::string, uint32_t> stringMap_;
+  std::unordered_map<const char*, uint32_t> lineMap_;
+};
+
+
+class PCHReader {
+public:
+  explicit PCHReader(const std::string& path);
+  ~PCHReader() {}
+  PCHReader(const PCHReader& other) = delete;
+  PCHReader& operator=(const PCHReader& other) = delete;
+
+  // Restore the state into 'cpp', the tokens are appended to 'os'
+  void Read(Preprocessor& cpp, TokenSequence& os);
+
+private:
+  const char* String(uint32_t idx);
+  const std::string* Filename(uint32_t idx);
+  Token* ReadToken();
+  TokenSequence ReadTokens();
+  uint8_t U8();
+  uint32_t U32();
+  uint64_t U64();
+  void Expect(size_t size);
+
+  std::string path_;
+  const uint8_t* p_;
+  const uint8_t* end_;
+  std::vector<const char*> strings_;
+  std::vector<const std::string*> filenames_;
+};
+
+#endif
@@ -0,0 +1,222 @@
+#include "report.h"
+
+#include "arena.h"
+#include "error.h"
+#include "scanner.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <ctime>
+#include <mutex>
+
+#include <unistd.h>
+#include <sys/resource.h>
+
+
+static const char* phaseNames[PhaseTimer::NUM] = {
+  "read",
+  "scan",
+  "preprocess",
+  "parse",
+  "codegen",
+  "output",
+  "cache",
+  "gcc",
+};
+
+bool PhaseTimer::enabled_ = false;
+thread_local PhaseTimer* PhaseTimer::top_ = nullptr;
+PhaseTimer::Time PhaseTimer::times_[PhaseTimer::NUM];
+size_t PhaseTimer::counts_[PhaseTimer::NUM];
+bool Trace::enabled_ = false;
+std::vector<Trace::Span> Trace::spans_;
+
+// Guards the times of the phases and the spans
+static std::mutex reportMutex;
+
+
+std::string JSONString(const std::string& str) {
+  std::string ret = "\"";
+  for (auto c: str) {
+    if (c == '"' || c == '\\') {
+      ret.push_back('\\');
+      ret.push_back(c);
+    } else if (static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      snprintf(buf, sizeof(buf), "\\u%04x", c);
+      ret += buf;
+    } else {
+      ret.push_back(c);
+    }
+  }
+  ret.push_back('"');
+  return ret;
+}
+
+
+static double Seconds(const timeval& tv) {
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+// CPU time is that of the calling thread and of the waited
+// children, the external gcc
+PhaseTimer::Time PhaseTimer::Now() {
+  Time now;
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  now.wall_ = ts.tv_sec + ts.tv_nsec / 1e9;
+  rusage self, children;
+  getrusage(RUSAGE_THREAD, &self);
+  getrusage(RUSAGE_CHILDREN, &children);
+  now.cpu_ = Seconds(self.ru_utime) + Seconds(self.ru_stime)
+      + Seconds(children.ru_utime) + Seconds(children.ru_stime);
+  return now;
+}
+
+
+void PhaseTimer::Charge(const Time& now) {
+  std::lock_guard<std::mutex> lock(reportMutex);
+  times_[phase_].wall_ += now.wall_ - begin_.wall_;
+  times_[phase_].cpu_ += now.cpu_ - begin_.cpu_;
+  begin_ = now;
+}
+
+
+void PhaseTimer::Start() {
+  begin_ = Now();
+  parent_ = top_;
+  if (parent_)
+    parent_->Charge(begin_);
+  top_ = this;
+  std::lock_guard<std::mutex> lock(reportMutex);
+  ++counts_[phase_];
+}
+
+
+void PhaseTimer::Stop() {
+  auto now = Now();
+  Charge(now);
+  top_ = parent_;
+  if (parent_)
+    parent_->begin_ = now;
+}
+
+
+void PhaseTimer::Print(FILE* fp, const std::string& filename, bool json) {
+  if (json) {
+    fprintf(fp, "{\"file\": %s, \"time\": {", JSONString(filename).c_str());
+  } else {
+    fprintf(fp, "%s: time report:\n", filename.c_str());
+    fprintf(fp, "  %-12s %10s %10s\n", "phase", "wall(s)", "cpu(s)");
+  }
+  Time total;
+  const char* sep = "";
+  for (int i = 0; i < NUM; ++i) {
+    if (counts_[i] == 0)
+      continue;
+    const auto& time = times_[i];
+    total.wall_ += time.wall_;
+    total.cpu_ += time.cpu_;
+    if (json) {
+      fprintf(fp, "%s\"%s\": {\"wall\": %.6f, \"cpu\": %.6f}",
+              sep, phaseNames[i], time.wall_, time.cpu_);
+      sep = ", ";
+    } else {
+      fprintf(fp, "  %-12s %10.6f %10.6f\n",
+              phaseNames[i], time.wall_, time.cpu_);
+    }
+  }
+  if (json) {
+    fprintf(fp, "%s\"total\": {\"wall\": %.6f, \"cpu\": %.6f}}}\n",
+            sep, total.wall_, total.cpu_);
+  } else {
+    fprintf(fp, "  %-12s %10.6f %10.6f\n", "total", total.wall_, total.cpu_);
+  }
+  for (int i = 0; i < NUM; ++i) {
+    times_[i] = Time();
+    counts_[i] = 0;
+  }
+}
+
+
+void MemReport::Print(FILE* fp, const std::string& filename,
+                      size_t tokens, bool json) {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  auto peakRSS = static_cast<size_t>(usage.ru_maxrss) * 1024;
+  auto sourceBytes = SourceManager::MappedBytes()
+                   + SourceManager::ReadBytes();
+
+  if (json) {
+    fprintf(fp, "{\"file\": %s, \"memory\": {\"regions\": [",
+            JSONString(filename).c_str());
+  } else {
+    fprintf(fp, "%s: memory report:\n", filename.c_str());
+    fprintf(fp, "  %-10s %8s %12s %12s %10s\n",
+            "region", "slabs", "bytes", "peak bytes", "objects");
+  }
+  size_t arenaBytes = 0;
+  for (int i = 0; i < Arena::NUM; ++i) {
+    auto region = static_cast<Arena::Region>(i);
+    auto usage = Arena::Usage(region);
+    arenaBytes += usage.bytes_;
+    if (json) {
+      fprintf(fp, "%s{\"region\": \"%s\", \"slabs\": %zu, \"bytes\": %zu, "
+              "\"peak_bytes\": %zu, \"objects\": %zu}", i ? ", ": "",
+              Arena::Name(region), usage.slabs_, usage.bytes_,
+              usage.peakBytes_, usage.objects_);
+    } else {
+      fprintf(fp, "  %-10s %8zu %12zu %12zu %10zu\n", Arena::Name(region),
+              usage.slabs_, usage.bytes_, usage.peakBytes_, usage.objects_);
+    }
+  }
+  if (json) {
+    fprintf(fp, "], \"arena_bytes\": %zu, \"tokens\": %zu, "
+            "\"source_bytes\": %zu, \"peak_rss\": %zu}}\n",
+            arenaBytes, tokens, sourceBytes, peakRSS);
+  } else {
+    fprintf(fp, "  %-10s %8s %12zu\n", "total", "", arenaBytes);
+    fprintf(fp, "  preprocessed tokens: %zu\n", tokens);
+    fprintf(fp, "  source bytes: %zu\n", sourceBytes);
+    fprintf(fp, "  peak RSS: %zu\n", peakRSS);
+  }
+}
+
+
+// CLOCK_MONOTONIC is read through the vDSO, without a system call
+Trace::Time Trace::Now() {
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<Time>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+
+void Trace::AddSpan(const char* cat, const std::string& name,
+                    Time begin, Time end) {
+  static std::atomic<int> threads {0};
+  static thread_local int tid = ++threads;
+  std::lock_guard<std::mutex> lock(reportMutex);
+  spans_.push_back({cat, name, begin, end, tid});
+}
+
+
+void Trace::Write(const std::string& path, const std::string& filename) {
+  auto fp = fopen(path.c_str(), "w");
+  if (fp == nullptr)
+    Error("cannot open trace file '%s'", path.c_str());
+  auto pid = static_cast<int>(getpid());
+  fprintf(fp, "{\"traceEvents\": [\n");
+  fprintf(fp, "{\"name\": \"process_name\", \"ph\": \"M\", "
+          "\"pid\": %d, \"tid\": 1, \"args\": {\"name\": %s}}",
+          pid, JSONString("wgtcc " + filename).c_str());
+  for (const auto& span: spans_) {
+    fprintf(fp, ",\n{\"name\": %s, \"cat\": \"%s\", \"ph\": \"X\", "
+            "\"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d}",
+            JSONString(span.name_).c_str(), span.cat_, span.begin_ / 1e3,
+            (span.end_ - span.begin_) / 1e3, pid, span.tid_);
+  }
+  fprintf(fp, "\n], \"displayTimeUnit\": \"ms\"}\n");
+  fclose(fp);
+  spans_.clear();
+}
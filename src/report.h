@@ -0,0 +1,138 @@
+#ifndef _WGTCC_REPORT_H_
+#define _WGTCC_REPORT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+
+/*
+ * Time spent in the phases of a compilation, for '-ftime-report'.
+ * A timer charges the time to its phase only, the time of timers
+ * nested in it goes to their own phases. Timers nest per thread,
+ * phases on different threads overlap. Disabled timers never read
+ * the clock.
+ */
+class PhaseTimer {
+public:
+  enum Phase {
+    READ,
+    SCAN,
+    PREPROCESS,
+    PARSE,
+    CODEGEN,
+    OUTPUT,
+    CACHE,
+    GCC,
+    NUM,
+  };
+
+  explicit PhaseTimer(Phase phase): phase_(phase) {
+    if (enabled_)
+      Start();
+  }
+  ~PhaseTimer() {
+    if (enabled_)
+      Stop();
+  }
+  PhaseTimer(const PhaseTimer& other) = delete;
+  PhaseTimer& operator=(const PhaseTimer& other) = delete;
+
+  static void Enable() { enabled_ = true; }
+  static bool Enabled() { return enabled_; }
+  // Print the phases timed so far, and start over
+  static void Print(FILE* fp, const std::string& filename, bool json);
+
+private:
+  struct Time {
+    double wall_ {0};
+    double cpu_ {0};
+  };
+
+  static Time Now();
+  void Start();
+  void Stop();
+  void Charge(const Time& now);
+
+  Phase phase_;
+  Time begin_;
+  PhaseTimer* parent_;
+
+  static bool enabled_;
+  static thread_local PhaseTimer* top_;
+  static Time times_[NUM];
+  static size_t counts_[NUM];
+};
+
+
+/*
+ * Memory usage of a compilation, for '-fmem-report':
+ * slabs and objects of every arena region, tokens produced
+ * by the preprocessor, source bytes and the peak RSS.
+ */
+class MemReport {
+public:
+  static void Print(FILE* fp, const std::string& filename,
+                    size_t tokens, bool json);
+};
+
+
+/*
+ * Chrome trace events for '-ftrace=<file.json>', to be loaded by
+ * chrome://tracing or Perfetto. Spans are kept in memory and written
+ * at the end of the compilation, a track per thread. Disabled tracing
+ * never reads the clock.
+ */
+class Trace {
+public:
+  typedef uint64_t Time; // Nanoseconds
+
+  static void Enable() { enabled_ = true; }
+  static bool Enabled() { return enabled_; }
+  static Time Now();
+  static void AddSpan(const char* cat, const std::string& name,
+                      Time begin, Time end);
+  // Write the spans recorded so far, and start over
+  static void Write(const std::string& path, const std::string& filename);
+
+private:
+  struct Span {
+    const char* cat_;
+    std::string name_;
+    Time begin_;
+    Time end_;
+    int tid_;
+  };
+
+  static bool enabled_;
+  static std::vector<Span> spans_;
+};
+
+
+class TraceSpan {
+public:
+  TraceSpan(const char* cat, const std::string& name): cat_(cat) {
+    if (Trace::Enabled()) {
+      name_ = name;
+      begin_ = Trace::Now();
+    }
+  }
+  ~TraceSpan() {
+    if (Trace::Enabled())
+      Trace::AddSpan(cat_, name_, begin_, Trace::Now());
+  }
+  TraceSpan(const TraceSpan& other) = delete;
+  TraceSpan& operator=(const TraceSpan& other) = delete;
+
+private:
+  const char* cat_;
+  std::string name_;
+  Trace::Time begin_;
+};
+
+
+std::string JSONString(const std::string& str);
+
+#endif
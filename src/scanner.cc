@@ -1,29 +1,370 @@
 #include "scanner.h"
 
+#include "compilation.h"
+#include "report.h"
+
 #include <cctype>
+#include <cerrno>
 #include <climits>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+
+/*
+ * Byte classification kernels of the scanner fast paths.
+ * Each returns the first byte at or after 'p' that stops the run:
+ *  RUN_IDENT: a byte that can't be part of an identifier;
+ *  RUN_BLANK: a byte that isn't white space other than newline;
+ *  RUN_UNTIL: 'a', 'b' or NUL.
+ * NUL stops all runs. The SSE2 or AVX2 variant is selected at
+ * startup, the scalar one is for other targets. Those load aligned
+ * blocks, up to 31 bytes before 'p' and after the NUL: they run only
+ * on the texts of 'SourceManager', padded by 'sourcePad' bytes.
+ */
+enum RunKind {
+  RUN_IDENT,
+  RUN_BLANK,
+  RUN_UNTIL,
+};
+
+static inline bool IsIdentChar(int c) {
+  return isalnum(c) || (0x80 <= c && c <= 0xfd) || c == '_' || c == '$';
+}
+
+
+static inline bool IsStop(int c, RunKind kind, int a, int b) {
+  switch (kind) {
+  case RUN_IDENT: return !IsIdentChar(c);
+  case RUN_BLANK: return !isspace(c) || c == '\n';
+  default: return c == a || c == b || c == 0;
+  }
+}
+
+
+static const char* ScalarFind(const char* p, RunKind kind, int a, int b) {
+  while (!IsStop((uint8_t)*p, kind, a, b))
+    ++p;
+  return p;
+}
+
+#if defined(__x86_64__)
+
+static inline __m128i SSE2InRange(__m128i x, int lo, int hi) {
+  auto t = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+  return _mm_cmpeq_epi8(_mm_min_epu8(t, _mm_set1_epi8(hi - lo)), t);
+}
+
+
+static inline uint32_t SSE2StopMask(__m128i x, RunKind kind, int a, int b) {
+  __m128i run;
+  switch (kind) {
+  case RUN_IDENT:
+    run = _mm_or_si128(
+        _mm_or_si128(SSE2InRange(_mm_or_si128(x, _mm_set1_epi8(0x20)),
+                                 'a', 'z'),
+                     SSE2InRange(x, '0', '9')),
+        _mm_or_si128(SSE2InRange(x, 0x80, 0xfd),
+                     _mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('_')),
+                                  _mm_cmpeq_epi8(x, _mm_set1_epi8('$')))));
+    break;
+  case RUN_BLANK:
+    run = _mm_or_si128(
+        _mm_cmpeq_epi8(x, _mm_set1_epi8(' ')),
+        _mm_andnot_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('\n')),
+                         SSE2InRange(x, '\t', '\r')));
+    break;
+  default:
+    return _mm_movemask_epi8(
+        _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8(a)),
+                                  _mm_cmpeq_epi8(x, _mm_set1_epi8(b))),
+                     _mm_cmpeq_epi8(x, _mm_setzero_si128())));
+  }
+  return ~_mm_movemask_epi8(run) & 0xffff;
+}
+
+
+static const char* SSE2Find(const char* p, RunKind kind, int a, int b) {
+  auto offset = reinterpret_cast<uintptr_t>(p) & 15;
+  auto block = p - offset;
+  uint32_t mask = SSE2StopMask(
+      _mm_load_si128(reinterpret_cast<const __m128i*>(block)),
+      kind, a, b) & (~0u << offset);
+  while (mask == 0) {
+    block += 16;
+    mask = SSE2StopMask(
+        _mm_load_si128(reinterpret_cast<const __m128i*>(block)),
+        kind, a, b);
+  }
+  return block + __builtin_ctz(mask);
+}
+
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET
+static inline __m256i AVX2InRange(__m256i x, int lo, int hi) {
+  auto t = _mm256_sub_epi8(x, _mm256_set1_epi8(lo));
+  return _mm256_cmpeq_epi8(_mm256_min_epu8(t, _mm256_set1_epi8(hi - lo)), t);
+}
+
+
+AVX2_TARGET
+static inline uint32_t AVX2StopMask(__m256i x, RunKind kind, int a, int b) {
+  __m256i run;
+  switch (kind) {
+  case RUN_IDENT:
+    run = _mm256_or_si256(
+        _mm256_or_si256(
+            AVX2InRange(_mm256_or_si256(x, _mm256_set1_epi8(0x20)), 'a', 'z'),
+            AVX2InRange(x, '0', '9')),
+        _mm256_or_si256(
+            AVX2InRange(x, 0x80, 0xfd),
+            _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')),
+                            _mm256_cmpeq_epi8(x, _mm256_set1_epi8('$')))));
+    break;
+  case RUN_BLANK:
+    run = _mm256_or_si256(
+        _mm256_cmpeq_epi8(x, _mm256_set1_epi8(' ')),
+        _mm256_andnot_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('\n')),
+                            AVX2InRange(x, '\t', '\r')));
+    break;
+  default:
+    return _mm256_movemask_epi8(_mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8(a)),
+                        _mm256_cmpeq_epi8(x, _mm256_set1_epi8(b))),
+        _mm256_cmpeq_epi8(x, _mm256_setzero_si256())));
+  }
+  return ~_mm256_movemask_epi8(run);
+}
+
+
+AVX2_TARGET
+static const char* AVX2Find(const char* p, RunKind kind, int a, int b) {
+  auto offset = reinterpret_cast<uintptr_t>(p) & 31;
+  auto block = p - offset;
+  uint32_t mask = AVX2StopMask(
+      _mm256_load_si256(reinterpret_cast<const __m256i*>(block)),
+      kind, a, b) & (~0u << offset);
+  while (mask == 0) {
+    block += 32;
+    mask = AVX2StopMask(
+        _mm256_load_si256(reinterpret_cast<const __m256i*>(block)),
+        kind, a, b);
+  }
+  return block + __builtin_ctz(mask);
+}
+
+#undef AVX2_TARGET
+
+
+static const char* (*SelectFind())(const char*, RunKind, int, int) {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return AVX2Find;
+  if (__builtin_cpu_supports("sse2"))
+    return SSE2Find;
+  return ScalarFind;
+}
+
+#else
+
+static const char* (*SelectFind())(const char*, RunKind, int, int) {
+  return ScalarFind;
+}
+
+#endif
+
+static const char* (*const FindRunEnd)(const char*, RunKind, int, int)
+    = SelectFind();
+
+static_assert(SourceManager::sourcePad >= 32, "blocks of AVX2Find()");
+
+
+// Other texts, as spellings of tokens, are scanned a byte at a time
+static inline const char* FindRun(bool padded, const char* p,
+                                  RunKind kind, int a, int b) {
+  return padded ? FindRunEnd(p, kind, a, b): ScalarFind(p, kind, a, b);
+}
+
+
+Scanner::Scanner(const SourceBuffer* src, const char* text,
+                 const std::string* filename, unsigned line)
+    : Scanner(text, filename, line) {
+  padded_ = src != nullptr;
+  splices_ = src == nullptr || src->splices_;
+}
 
 
 void Scanner::Tokenize(TokenSequence& ts) {
+  while (ScanLine(ts))
+    continue;
+}
+
+
+// Scans a line with its newline. Returns false at the end
+// of the text, a newline is then added if there isn't one.
+bool Scanner::ScanLine(TokenSequence& ts) {
   while (true) {
     auto tok = Scan();
     if (tok->tag_ == Token::END) {
       if (ts.Empty() || (ts.Back()->tag_ != Token::NEW_LINE)) {
         auto t = Token::New(*tok);
         t->tag_ = Token::NEW_LINE;
-        t->str_ = "\n";
+        t->SetStr("\n");
         ts.InsertBack(t);
       }
-      break;
+      return false;
+    }
+    if (!ts.Empty() && ts.Back()->tag_ == Token::NEW_LINE)
+      tok->ws_ = true;
+    ts.InsertBack(tok);
+    if (tok->tag_ == Token::NEW_LINE)
+      return true;
+  }
+}
+
+
+/*
+ * The text of a group is only skipped, the preprocessor scans it
+ * by 'TokenizeGroup()' when it is first expanded: inactive groups
+ * are never tokenized. Nesting is left to the preprocessor, it
+ * sees all conditional directives.
+ */
+void Scanner::TokenizeConditionals(TokenSequence& ts) {
+  while (true) {
+    if (AtConditional()) {
+      if (!ScanLine(ts))
+        return;
+    } else if (Empty()) {
+      ScanLine(ts);
+      return;
     } else {
-      if (!ts.Empty() && ts.Back()->tag_ == Token::NEW_LINE)
-        tok->ws_ = true;
-      ts.InsertBack(tok);
+      MakeUnscanned(ts);
     }
   }
 }
 
 
+void Scanner::TokenizeGroup(TokenSequence& ts) {
+  while (ScanLine(ts) && !AtConditional())
+    continue;
+}
+
+
+// The lines up to the next conditional directive, unless they have
+// no token. The token is spelled empty, it has the white space
+// its first token would have.
+void Scanner::MakeUnscanned(TokenSequence& ts) {
+  Mark();
+  bool tokens = false;
+  do {
+    tokens = SkipLine() || tokens;
+  } while (!Empty() && !AtConditional());
+  if (!tokens)
+    return;
+
+  tok_.tag_ = Token::UNSCANNED;
+  tok_.ws_ = !ts.Empty() && ts.Back()->tag_ == Token::NEW_LINE;
+  tok_.SetStr("");
+  ts.InsertBack(Token::New(tok_));
+  Mark();
+  tok_.tag_ = Token::NEW_LINE;
+  tok_.SetStr("\n");
+  ts.InsertBack(Token::New(tok_));
+}
+
+
+// If the line from the current position is '#if', '#ifdef',
+// '#ifndef', '#elif', '#else' or '#endif'. Nothing is consumed.
+bool Scanner::AtConditional() {
+  static const char* const names[] = {
+    "if", "ifdef", "ifndef", "elif", "else", "endif",
+  };
+  auto p = p_;
+  auto loc = loc_;
+  bool ret = false;
+  SkipBlank();
+  if (Try('#') || (Try('%') && Try(':'))) {
+    SkipBlank();
+    char name[8];
+    size_t len = 0;
+    while (len < sizeof(name) && IsIdentChar(Peek()))
+      name[len++] = Next();
+    for (auto n: names)
+      ret = ret || (len == strlen(n) && memcmp(name, n, len) == 0);
+  }
+  p_ = p;
+  loc_ = loc;
+  return ret;
+}
+
+
+// Skips to the start of the next line, through comments, strings and
+// character constants. Unterminated ones end at the newline, as in
+// skipped text they are not errors. Returns if the line has a token.
+bool Scanner::SkipLine() {
+  bool tokens = false;
+  while (true) {
+    auto c = Peek();
+    if (c == 0)
+      return tokens;
+    Next();
+    switch (c) {
+    case '\n':
+      return tokens;
+    case '/':
+      if (Test('/') || Test('*')) {
+        SkipComment();
+        break;
+      }
+      tokens = true;
+      break;
+    case '\"': case '\'': {
+      tokens = true;
+      int d;
+      while ((d = Peek()) != '\n' && d != 0) {
+        Next();
+        if (d == '\\' && Peek() != 0)
+          Next();
+        else if (d == c)
+          break;
+      }
+      break;
+    }
+    default:
+      if (!isspace(c))
+        tokens = true;
+      break;
+    }
+  }
+}
+
+
+// White spaces and comments, not the newline ending the line
+void Scanner::SkipBlank() {
+  while (true) {
+    SkipWhiteSpace();
+    if (Peek() != '/')
+      return;
+    Next();
+    if (!Test('/') && !Test('*')) {
+      PutBack();
+      return;
+    }
+    SkipComment();
+  }
+}
+
+
 std::string Scanner::ScanHeadName(const Token* lhs, const Token* rhs) {
   std::string str;
   const char* begin = lhs->loc_.Begin() + 1;
@@ -141,21 +482,29 @@ void Scanner::SkipWhiteSpace() {
   while (isspace(Peek()) && Peek() != '\n') {
     tok_.ws_ = true;
     Next();
+    // Runs of more than one blank, mostly indentation
+    if (!IsStop((uint8_t)*p_, RUN_BLANK, 0, 0))
+      Advance(FindRun(padded_, p_, RUN_BLANK, 0, 0));
   }
 }
 
 
 void Scanner::SkipComment() {
   if (Try('/')) {
-    // Line comment terminated an newline or eof
-    while (!Empty()) {
-      if (Peek() == '\n')
+    // Line comment terminated an newline or eof,
+    // backslash may splice the next line into it
+    while (true) {
+      Advance(FindRun(padded_, p_, RUN_UNTIL, '\n', '\\'));
+      auto c = Peek();
+      if (c == '\n' || c == 0)
         return;
       Next();
     }
-    return;
   } else if (Try('*')) {
-    while (!Empty()) {
+    while (true) {
+      Advance(FindRun(padded_, p_, RUN_UNTIL, '*', '\n'));
+      if (Peek() == 0)
+        break;
       auto c = Next();
       if (c  == '*' && Peek() == '/') {
         Next();
@@ -185,6 +534,7 @@ std::string Scanner::ScanIdentifier() {
 
 Token* Scanner::SkipIdentifier() {
   PutBack();
+  Advance(FindRun(padded_, p_, RUN_IDENT, 0, 0));
   auto c = Next();
   while (isalnum(c)
        || (0x80 <= c && c <= 0xfd)
@@ -371,40 +721,106 @@ Encoding Scanner::ScanEncoding(int c) {
 }
 
 
-std::string* ReadFile(const std::string& filename) {
-  FILE* f = fopen(filename.c_str(), "r");
-  if (!f) Error("%s: No such file or directory", filename.c_str());
-  auto text = new std::string;
-  int c;
-  while (EOF != (c = fgetc(f)))
-      text->push_back(c);
-  fclose(f);
+size_t SourceManager::MappedBytes() {
+  return Compilation::Current()->mappedBytes_;
+}
+
+
+size_t SourceManager::ReadBytes() {
+  return Compilation::Current()->readBytes_;
+}
+
+
+const char* SourceManager::Load(const std::string& filename) {
+  PhaseTimer timer(PhaseTimer::READ);
+  auto fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd == -1)
+    Error("%s: No such file or directory", filename.c_str());
+
+  const char* text = nullptr;
+  struct stat st;
+  static const long pageSize = sysconf(_SC_PAGESIZE);
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+      && st.st_size % pageSize != 0) {
+    // The whole last page, with the NUL and the pad
+    size_t len = (st.st_size + pageSize - 1) / pageSize * pageSize;
+    auto addr = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+      text = static_cast<const char*>(addr);
+      auto comp = Compilation::Current();
+      comp->mappings_.push_back({addr, len});
+      comp->mappedBytes_ += st.st_size;
+      comp->sources_[text] = {text + st.st_size,
+                              HasSplice(text, text + st.st_size)};
+    }
+  }
+  if (text == nullptr)
+    text = Read(fd, filename);
+  close(fd);
   return text;
 }
 
 
-int Scanner::Next() {
-  int c = Peek();
-  ++p_;
-  if (c == '\n') {
-    ++loc_.line_;
-    loc_.column_ = 1;
-    loc_.lineBegin_ = p_;
-  } else {
-    ++loc_.column_;
+// The text is between two pads, at most 'cap' bytes with the NUL
+const char* SourceManager::Read(int fd, const std::string& filename) {
+  size_t size = 0;
+  size_t cap = 4096;
+  auto buf = static_cast<char*>(malloc(cap + 2 * sourcePad));
+  memset(buf, 0, sourcePad);
+  auto text = buf + sourcePad;
+  while (true) {
+    if (size + 1 == cap) {
+      buf = static_cast<char*>(realloc(buf, (cap *= 2) + 2 * sourcePad));
+      text = buf + sourcePad;
+    }
+    auto len = read(fd, text + size, cap - size - 1);
+    if (len == 0)
+      break;
+    if (len == -1) {
+      if (errno == EINTR)
+        continue;
+      Error("%s: read failed: %s", filename.c_str(), strerror(errno));
+    }
+    size += len;
   }
-  return c;
+  memset(text + size, 0, 1 + sourcePad);
+  auto comp = Compilation::Current();
+  comp->buffers_.push_back(buf);
+  comp->readBytes_ += size;
+  comp->sources_[text] = {text + size, HasSplice(text, text + size)};
+  return text;
+}
+
+
+bool SourceManager::HasSplice(const char* text, const char* end) {
+  auto p = text;
+  while ((p = static_cast<const char*>(memchr(p, '\\', end - p)))) {
+    if (*++p == '\n')
+      return true;
+  }
+  return false;
 }
 
 
-int Scanner::Peek() {
+const SourceBuffer* SourceManager::Find(const char* p) {
+  auto& sources = Compilation::Current()->sources_;
+  auto iter = sources.upper_bound(p);
+  if (iter == sources.begin())
+    return nullptr;
+  --iter;
+  return p <= iter->second.end_ ? &iter->second: nullptr;
+}
+
+
+int Scanner::PeekSplice() {
   int c = (uint8_t)(*p_);
   if (c == '\\' && p_[1] == '\n') {
+    spliced_ = true;
     p_ += 2;
     ++loc_.line_;
     loc_.column_ = 1;
     loc_.lineBegin_ = p_;
-    return Peek();
+    return PeekSplice();
   }
   return c;
 }
@@ -415,7 +831,7 @@ int Scanner::Peek() {
 // we never care about the pos of newline token
 void Scanner::PutBack() {
   int c = *--p_;
-  if (c == '\n' && p_[-1] == '\\') {
+  if (c == '\n' && splices_ && p_ > begin_ && p_[-1] == '\\') {
     --loc_.line_;
     // lineBegin
     --p_;
@@ -430,15 +846,20 @@ void Scanner::PutBack() {
 
 Token* Scanner::MakeToken(int tag) {
   tok_.tag_ = tag;
-  auto& str = tok_.str_;
-  str.resize(0);
+  auto& str = buf_;
   const char* p = tok_.loc_.lineBegin_ + tok_.loc_.column_ - 1;
-  for (; p < p_; ++p) {
-    if (p[0] == '\n' && p[-1] == '\\')
-      str.pop_back();
-    else
-      str.push_back(p[0]);
+  if (!spliced_) {
+    str.assign(p, p_);
+  } else {
+    str.resize(0);
+    for (; p < p_; ++p) {
+      if (p[0] == '\n' && p[-1] == '\\')
+        str.pop_back();
+      else
+        str.push_back(p[0]);
+    }
   }
+  tok_.SetStr(str);
   return Token::New(tok_);
 }
 
@@ -447,6 +868,6 @@ Token* Scanner::MakeToken(int tag) {
 // It is generated before reading the character '\n'
 Token* Scanner::MakeNewLine() {
   tok_.tag_ = '\n';
-  tok_.str_ = std::string(p_, p_ + 1);
+  tok_.SetStr(std::string(p_, p_ + 1));
   return Token::New(tok_);
 }
@@ -8,21 +8,30 @@
 #include <string>
 #include <cassert>
 
+struct SourceBuffer;
 
 class Scanner {
 public:
   explicit Scanner(const Token* tok)
-      : Scanner(&tok->str_, tok->loc_) {}
+      : Scanner(&tok->Str(), tok->loc_) {}
   Scanner(const std::string* text, const SourceLocation& loc)
       : Scanner(text, loc.filename_, loc.line_, loc.column_) {}
   explicit Scanner(const std::string* text,
                    const std::string* filename=nullptr,
                    unsigned line=1, unsigned column=1)
-      : text_(text), tok_(Token::END) {
+      : Scanner(text->c_str(), filename, line, column) {}
+  // 'text' must be terminated by NUL
+  explicit Scanner(const char* text,
+                   const std::string* filename=nullptr,
+                   unsigned line=1, unsigned column=1)
+      : tok_(Token::END), begin_(text), p_(text) {
     // TODO(wgtdkp): initialization
-    p_ = &(*text_)[0];
     loc_ = {filename, p_, line, 1};
   }
+  // 'text' is in 'src', if not null, the fast paths apply and
+  // splices are handled only if the buffer has one
+  Scanner(const SourceBuffer* src, const char* text,
+          const std::string* filename, unsigned line=1);
 
   virtual ~Scanner() {}
   Scanner(const Scanner& other) = delete;
@@ -36,12 +45,22 @@ public:
   // set this param.
   Token* Scan(bool ws=false);
   void Tokenize(TokenSequence& ts);
+  // Scans the lines of conditional directives only. The lines between
+  // them become an 'UNSCANNED' token each, followed by a newline.
+  void TokenizeConditionals(TokenSequence& ts);
+  // Scans the lines of an 'UNSCANNED' token
+  void TokenizeGroup(TokenSequence& ts);
   static std::string ScanHeadName(const Token* lhs, const Token* rhs);
   Encoding ScanCharacter(int& val);
   Encoding ScanLiteral(std::string& val);
   std::string ScanIdentifier();
 
 private:
+  bool ScanLine(TokenSequence& ts);
+  void MakeUnscanned(TokenSequence& ts);
+  bool AtConditional();
+  bool SkipLine();
+  void SkipBlank();
   Token* SkipIdentifier();
   Token* SkipNumber();
   Token* SkipLiteral();
@@ -59,9 +78,24 @@ private:
   bool IsOctal(int c) { return '0' <= c && c <= '7'; }
   int XDigit(int c);
   bool Empty() const { return *p_ == 0; }
-  int Peek();
+  int Peek() {
+    int c = (uint8_t)(*p_);
+    return c == '\\' && splices_ ? PeekSplice(): c;
+  }
+  int PeekSplice();
   bool Test(int c) { return Peek() == c; };
-  int Next();
+  int Next() {
+    int c = Peek();
+    ++p_;
+    if (c == '\n') {
+      ++loc_.line_;
+      loc_.column_ = 1;
+      loc_.lineBegin_ = p_;
+    } else {
+      ++loc_.column_;
+    }
+    return c;
+  }
   void PutBack();
   bool Try(int c) {
     if (Peek() == c) {
@@ -70,15 +104,53 @@ private:
     }
     return false;
   };
-  void Mark() { tok_.loc_ = loc_; };
+  void Mark() {
+    tok_.loc_ = loc_;
+    spliced_ = false;
+  };
+  // Skip to 'end', with no newline in between
+  void Advance(const char* end) {
+    loc_.column_ += end - p_;
+    p_ = end;
+  }
 
-  const std::string* text_;
   SourceLocation loc_;
   Token tok_;
+  const char* begin_;
   const char* p_;
+  // Only tokens that contain a line splice pay for removing it
+  bool spliced_ {false};
+  // The text is padded for the block loads of the fast paths
+  bool padded_ {false};
+  // The text may contain a line splice
+  bool splices_ {true};
+  std::string buf_; // Spelling of the token being made
 };
 
 
-std::string* ReadFile(const std::string& filename);
+/*
+ * Owns the text of all source files, which lives until exit, as
+ * tokens point into it. A regular file is mapped, the zero fill
+ * of its last page terminates the text. Files that exactly fill
+ * their pages, pipes and other special files are read instead.
+ * Either way at least 'sourcePad' bytes before and after the text
+ * are readable: the mapping starts at a page and ends with the
+ * page of the NUL, a read buffer is padded with zeros.
+ */
+class SourceManager {
+public:
+  // Returns the NUL terminated text of the file,
+  // alive until the compilation ends
+  static const char* Load(const std::string& filename);
+  // The buffer that 'p' points into, null if not a source file
+  static const SourceBuffer* Find(const char* p);
+  static const size_t sourcePad = 32;
+  static size_t MappedBytes();
+  static size_t ReadBytes();
+
+private:
+  static const char* Read(int fd, const std::string& filename);
+  static bool HasSplice(const char* text, const char* end);
+};
 
 #endif
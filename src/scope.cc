@@ -7,28 +7,28 @@
 
 
 Identifier* Scope::Find(const Token* tok) {
-  auto ret = Find(tok->str_);
+  auto ret = Find(tok->Str());
   if (ret) ret->SetTok(tok);
   return ret;
 }
 
 
 Identifier* Scope::FindInCurScope(const Token* tok) {
-  auto ret = FindInCurScope(tok->str_);
+  auto ret = FindInCurScope(tok->Str());
   if (ret) ret->SetTok(tok);
   return ret;
 }
 
 
 Identifier* Scope::FindTag(const Token* tok) {
-  auto ret = FindTag(tok->str_);
+  auto ret = FindTag(tok->Str());
   if (ret) ret->SetTok(tok);
   return ret;
 }
 
 
 Identifier* Scope::FindTagInCurScope(const Token* tok) {
-  auto ret = FindTagInCurScope(tok->str_);
+  auto ret = FindTagInCurScope(tok->Str());
   if (ret) ret->SetTok(tok);
   return ret;
 }
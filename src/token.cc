@@ -1,59 +1,167 @@
 #include "token.h"
 
-#include "mem_pool.h"
+#include "arena.h"
+#include "compilation.h"
 #include "parser.h"
 
+#include <algorithm>
 
-static MemPoolImp<Token> TokenPool;
-
-const std::unordered_map<std::string, int> Token::kwTypeMap_ {
-  { "auto", Token::AUTO },
-  { "break", Token::BREAK },
-  { "case", Token::CASE },
-  { "char", Token::CHAR },
-  { "const", Token::CONST },
-  { "continue", Token::CONTINUE },
-  { "default", Token::DEFAULT },
-  { "do", Token::DO },
-  { "double", Token::DOUBLE },
-  { "else", Token::ELSE },
-  { "enum", Token::ENUM },
-  { "extern", Token::EXTERN },
-  { "float", Token::FLOAT },
-  { "for", Token::FOR },
-  { "goto", Token::GOTO },
-  { "if", Token::IF },
-  { "inline", Token::INLINE },
-  { "int", Token::INT },
-  { "long", Token::LONG },
-  { "signed", Token::SIGNED },
-  { "unsigned", Token::UNSIGNED },
-  { "register", Token::REGISTER },
-  { "restrict", Token::RESTRICT },
-  { "return", Token::RETURN },
-  { "short", Token::SHORT },
-  { "sizeof", Token::SIZEOF },
-  { "static", Token::STATIC },
-  { "struct", Token::STRUCT },
-  { "switch", Token::SWITCH },
-  { "typedef", Token::TYPEDEF },
-  { "union", Token::UNION },
-  { "void", Token::VOID },
-  { "volatile", Token::VOLATILE },
-  { "while", Token::WHILE },
-  { "_Alignas", Token::ALIGNAS },
-  { "_Alignof", Token::ALIGNOF },
-  { "_Atomic", Token::ATOMIC },
-  { "__attribute__", Token::ATTRIBUTE },
-  { "_Bool", Token::BOOL },
-  { "_Complex", Token::COMPLEX },
-  { "_Generic", Token::GENERIC },
-  { "_Imaginary", Token::IMAGINARY },
-  { "_Noreturn", Token::NORETURN },
-  { "_Static_assert", Token::STATIC_ASSERT },
-  { "_Thread_local", Token::THREAD },
+
+/*
+ * Keywords and directives are found by a perfect hash of the length
+ * and three bytes of the spelling: one probe and a compare, with no
+ * hashing of the whole string. The table is generated at compile time,
+ * a collision fails the build.
+ */
+struct ReservedWord {
+  const char* name_;
+  int kwTag_;
+  int ppTag_;
 };
 
+static constexpr ReservedWord reservedWords[] = {
+  { "auto", Token::AUTO, Token::PP_NONE },
+  { "break", Token::BREAK, Token::PP_NONE },
+  { "case", Token::CASE, Token::PP_NONE },
+  { "char", Token::CHAR, Token::PP_NONE },
+  { "const", Token::CONST, Token::PP_NONE },
+  { "continue", Token::CONTINUE, Token::PP_NONE },
+  { "default", Token::DEFAULT, Token::PP_NONE },
+  { "do", Token::DO, Token::PP_NONE },
+  { "double", Token::DOUBLE, Token::PP_NONE },
+  { "enum", Token::ENUM, Token::PP_NONE },
+  { "extern", Token::EXTERN, Token::PP_NONE },
+  { "float", Token::FLOAT, Token::PP_NONE },
+  { "for", Token::FOR, Token::PP_NONE },
+  { "goto", Token::GOTO, Token::PP_NONE },
+  { "inline", Token::INLINE, Token::PP_NONE },
+  { "int", Token::INT, Token::PP_NONE },
+  { "long", Token::LONG, Token::PP_NONE },
+  { "signed", Token::SIGNED, Token::PP_NONE },
+  { "unsigned", Token::UNSIGNED, Token::PP_NONE },
+  { "register", Token::REGISTER, Token::PP_NONE },
+  { "restrict", Token::RESTRICT, Token::PP_NONE },
+  { "return", Token::RETURN, Token::PP_NONE },
+  { "short", Token::SHORT, Token::PP_NONE },
+  { "sizeof", Token::SIZEOF, Token::PP_NONE },
+  { "static", Token::STATIC, Token::PP_NONE },
+  { "struct", Token::STRUCT, Token::PP_NONE },
+  { "switch", Token::SWITCH, Token::PP_NONE },
+  { "typedef", Token::TYPEDEF, Token::PP_NONE },
+  { "union", Token::UNION, Token::PP_NONE },
+  { "void", Token::VOID, Token::PP_NONE },
+  { "volatile", Token::VOLATILE, Token::PP_NONE },
+  { "while", Token::WHILE, Token::PP_NONE },
+  { "_Alignas", Token::ALIGNAS, Token::PP_NONE },
+  { "_Alignof", Token::ALIGNOF, Token::PP_NONE },
+  { "_Atomic", Token::ATOMIC, Token::PP_NONE },
+  { "__attribute__", Token::ATTRIBUTE, Token::PP_NONE },
+  { "_Bool", Token::BOOL, Token::PP_NONE },
+  { "_Complex", Token::COMPLEX, Token::PP_NONE },
+  { "_Generic", Token::GENERIC, Token::PP_NONE },
+  { "_Imaginary", Token::IMAGINARY, Token::PP_NONE },
+  { "_Noreturn", Token::NORETURN, Token::PP_NONE },
+  { "_Static_assert", Token::STATIC_ASSERT, Token::PP_NONE },
+  { "_Thread_local", Token::THREAD, Token::PP_NONE },
+  { "if", Token::IF, Token::PP_IF },
+  { "ifdef", Token::NOTOK, Token::PP_IFDEF },
+  { "ifndef", Token::NOTOK, Token::PP_IFNDEF },
+  { "elif", Token::NOTOK, Token::PP_ELIF },
+  { "else", Token::ELSE, Token::PP_ELSE },
+  { "endif", Token::NOTOK, Token::PP_ENDIF },
+  { "include", Token::NOTOK, Token::PP_INCLUDE },
+  // Non-standard GNU extension
+  { "include_next", Token::NOTOK, Token::PP_INCLUDE },
+  { "define", Token::NOTOK, Token::PP_DEFINE },
+  { "undef", Token::NOTOK, Token::PP_UNDEF },
+  { "line", Token::NOTOK, Token::PP_LINE },
+  { "error", Token::NOTOK, Token::PP_ERROR },
+  { "pragma", Token::NOTOK, Token::PP_PRAGMA },
+};
+
+static const size_t reservedMinLen = 2;
+static const size_t reservedMaxLen = 14;
+static const size_t reservedTableSize = 256;
+static const size_t numReservedWords =
+    sizeof(reservedWords) / sizeof(reservedWords[0]);
+
+static constexpr size_t ReservedHash(const char* str, size_t len) {
+  return (len + 3 * static_cast<uint8_t>(str[0])
+      + 13 * static_cast<uint8_t>(str[1])
+      + 8 * static_cast<uint8_t>(str[len - 1])) & (reservedTableSize - 1);
+}
+
+
+static constexpr size_t Length(const char* str) {
+  return *str ? 1 + Length(str + 1): 0;
+}
+
+
+static constexpr size_t SlotOf(size_t i) {
+  return ReservedHash(reservedWords[i].name_, Length(reservedWords[i].name_));
+}
+
+
+// The words from 'i' on hashed to 'slot'
+static constexpr size_t CountSlot(size_t slot, size_t i=0) {
+  return i == numReservedWords ? 0:
+      (SlotOf(i) == slot) + CountSlot(slot, i + 1);
+}
+
+
+static constexpr bool ReservedWordsValid(size_t i=0) {
+  return i == numReservedWords || (CountSlot(SlotOf(i)) == 1
+      && Length(reservedWords[i].name_) >= reservedMinLen
+      && Length(reservedWords[i].name_) <= reservedMaxLen
+      && ReservedWordsValid(i + 1));
+}
+
+static_assert(ReservedWordsValid(),
+              "reserved words collide or are out of the length bounds");
+
+
+static constexpr const ReservedWord* SlotWord(size_t slot, size_t i=0) {
+  return i == numReservedWords ? nullptr:
+      SlotOf(i) == slot ? &reservedWords[i]: SlotWord(slot, i + 1);
+}
+
+#define SLOTS4(i) \
+  SlotWord(i), SlotWord(i + 1), SlotWord(i + 2), SlotWord(i + 3)
+#define SLOTS16(i) SLOTS4(i), SLOTS4(i + 4), SLOTS4(i + 8), SLOTS4(i + 12)
+#define SLOTS64(i) \
+  SLOTS16(i), SLOTS16(i + 16), SLOTS16(i + 32), SLOTS16(i + 48)
+
+static constexpr const ReservedWord* reservedTable[reservedTableSize] = {
+  SLOTS64(0), SLOTS64(64), SLOTS64(128), SLOTS64(192),
+};
+
+#undef SLOTS64
+#undef SLOTS16
+#undef SLOTS4
+
+
+static const ReservedWord* FindReservedWord(const std::string& str) {
+  auto len = str.size();
+  if (len < reservedMinLen || len > reservedMaxLen)
+    return nullptr;
+  auto word = reservedTable[ReservedHash(str.data(), len)];
+  if (word == nullptr || strcmp(word->name_, str.c_str()) != 0)
+    return nullptr;
+  return word;
+}
+
+
+int Token::KeyWordTag(const std::string& key) {
+  auto word = FindReservedWord(key);
+  return word ? word->kwTag_: Token::NOTOK;
+}
+
+
+int Token::DirectiveTag(const std::string& name) {
+  auto word = FindReservedWord(name);
+  return word ? word->ppTag_: Token::PP_NONE;
+}
+
 const std::unordered_map<int, const char*> Token::TagLexemeMap_ {
   { '(', "(" },
   { ')', ")" },
@@ -158,13 +266,26 @@ const std::unordered_map<int, const char*> Token::TagLexemeMap_ {
 };
 
 
+TokenList* TokenList::New() {
+  return Arena::Get(Arena::TOKEN).Make<TokenList>();
+}
+
+
 Token* Token::New(int tag) {
-  return new (TokenPool.Alloc()) Token(tag);
+  return new (Arena::TOKEN) Token(tag);
 }
 
 
+Token::Token(int tag): tag_(tag), ident_(Ident::Get("")) {}
+
+
+Token::Token(int tag, const SourceLocation& loc,
+             const std::string& str, bool ws)
+    : tag_(tag), ws_(ws), loc_(loc), ident_(Ident::Get(str)) {}
+
+
 Token* Token::New(const Token& other) {
-  return new (TokenPool.Alloc()) Token(other);
+  return new (Arena::TOKEN) Token(other);
 }
 
 
@@ -172,14 +293,94 @@ Token* Token::New(int tag,
                   const SourceLocation& loc,
                   const std::string& str,
                   bool ws) {
-  return new (TokenPool.Alloc()) Token(tag, loc, str, ws);
+  return new (Arena::TOKEN) Token(tag, loc, str, ws);
+}
+
+
+Ident::Ident(const std::string& name): name_(name) {
+  auto word = FindReservedWord(name);
+  kwTag_ = word ? word->kwTag_: Token::NOTOK;
+  ppTag_ = word ? word->ppTag_: Token::PP_NONE;
+}
+
+
+Ident* Ident::Get(const std::string& name) {
+  auto& ident = Compilation::Current()->idents_[name];
+  if (ident == nullptr)
+    ident = new (Arena::TOKEN) Ident(name);
+  return ident;
+}
+
+
+Ident* Ident::Find(const std::string& name) {
+  const auto& idents = Compilation::Current()->idents_;
+  auto iter = idents.find(name);
+  if (iter == idents.end())
+    return nullptr;
+  return iter->second;
+}
+
+
+const HideSet* HideSet::Intern(IdentList& idents) {
+  auto& hs = Compilation::Current()->hideSets_[idents];
+  if (hs == nullptr)
+    hs = new (Arena::TOKEN) HideSet(idents);
+  return hs;
+}
+
+
+bool HideSet::Contains(const Ident* ident) const {
+  return std::binary_search(idents_.begin(), idents_.end(), ident,
+                            std::less<const Ident*>());
+}
+
+
+const HideSet* HideSet::Insert(const HideSet* hs, const Ident* ident) {
+  if (hs == nullptr) {
+    IdentList idents {ident};
+    return Intern(idents);
+  }
+  auto& res = hs->insertCache_[ident];
+  if (res == nullptr) {
+    if (hs->Contains(ident)) {
+      res = hs;
+    } else {
+      auto idents = hs->idents_;
+      auto pos = std::lower_bound(idents.begin(), idents.end(), ident,
+                                  std::less<const Ident*>());
+      idents.insert(pos, ident);
+      res = Intern(idents);
+    }
+  }
+  return res;
+}
+
+
+const HideSet* HideSet::Union(const HideSet* lhs, const HideSet* rhs) {
+  if (lhs == nullptr || lhs == rhs)
+    return rhs;
+  if (rhs == nullptr)
+    return lhs;
+  if (lhs->Size() == 1)
+    return Insert(rhs, lhs->idents_[0]);
+  if (rhs->Size() == 1)
+    return Insert(lhs, rhs->idents_[0]);
+  auto& res = lhs->unionCache_[rhs];
+  if (res == nullptr) {
+    IdentList idents;
+    std::set_union(lhs->idents_.begin(), lhs->idents_.end(),
+                   rhs->idents_.begin(), rhs->idents_.end(),
+                   std::back_inserter(idents), std::less<const Ident*>());
+    res = Intern(idents);
+  }
+  return res;
 }
 
 
 TokenSequence TokenSequence::GetLine() {
   auto begin = begin_;
-  while (begin_ != end_ && (*begin_)->tag_ != Token::NEW_LINE)
-    ++begin_;
+  while (begin_ != end_ && tokList_->At(begin_)->tag_ != Token::NEW_LINE)
+    begin_ = tokList_->Next(begin_);
   auto end = begin_;
   return {tokList_, begin, end};
 }
@@ -190,37 +391,41 @@ TokenSequence TokenSequence::GetLine() {
  * Called only after we have saw '#' in the token sequence.
  */ 
 bool TokenSequence::IsBeginOfLine() const {
-  if (begin_ == tokList_->begin())
+  if (begin_ == tokList_->Begin())
     return true;
 
-  auto pre = begin_;
-  --pre;
+  auto pre = tokList_->At(tokList_->Prev(begin_));
+  auto cur = tokList_->At(begin_);
 
   // We do not insert a newline at the end of a source file.
   // Thus if two token have different filename, the second is 
   // the begin of a line.
-  return ((*pre)->tag_ == Token::NEW_LINE ||
-          (*pre)->loc_.filename_ != (*begin_)->loc_.filename_);
+  return (pre->tag_ == Token::NEW_LINE ||
+          pre->loc_.filename_ != cur->loc_.filename_);
 }
 
 const Token* TokenSequence::Peek() const {
-  static auto eof = Token::New(Token::END);
-  if (begin_ != end_ && (*begin_)->tag_ == Token::NEW_LINE) {
-    ++begin_;
+  auto tok = begin_ != end_ ? tokList_->At(begin_): nullptr;
+  if (tok && tok->tag_ == Token::NEW_LINE) {
+    begin_ = tokList_->Next(begin_);
     return Peek();
-  } else if (begin_ == end_) {
-    if (end_ != tokList_->begin())
+  } else if (tok == nullptr) {
+    auto& eof = Compilation::Current()->eof_;
+    if (eof == nullptr)
+      eof = Token::New(Token::END);
+    if (end_ != tokList_->Begin())
       *eof = *Back();
     eof->tag_ = Token::END;
     return eof;
-  } else if (parser_ && (*begin_)->tag_ == Token::IDENTIFIER &&
-             (*begin_)->str_ == "__func__") {
-    auto filename = Token::New(*(*begin_));
+  } else if (parser_ && tok->tag_ == Token::IDENTIFIER &&
+             tok->Str() == "__func__") {
+    auto filename = Token::New(*tok);
     filename->tag_ = Token::LITERAL;
-    filename->str_ = "\"" + parser_->CurFunc()->Name() + "\"";
-    *begin_ = filename;
+    filename->SetStr("\"" + parser_->CurFunc()->Name() + "\"");
+    tokList_->Set(begin_, filename);
+    tok = filename;
   }
-  return *begin_;
+  return tok;
 }
 
 
@@ -228,7 +433,7 @@ const Token* TokenSequence::Expect(int expect) {
   auto tok = Peek();
   if (!Try(expect)) {
     Error(tok, "'%s' expected, but got '%s'",
-        Token::Lexeme(expect), tok->str_.c_str());
+        Token::Lexeme(expect), tok->Str().c_str());
   }
   return tok;
 }
@@ -246,7 +451,7 @@ void TokenSequence::Print(FILE* fp) const {
     } else if (tok->ws_) {
       fputc(' ', fp);
     }
-    fputs(tok->str_.c_str(), fp);
+    fputs(tok->Str().c_str(), fp);
     fflush(fp);
     lastLine = tok->loc_.line_;
   }
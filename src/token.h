@@ -4,23 +4,26 @@
 #include "error.h"
 
 #include <cassert>
+#include <cstdint>
 #include <cstring>
+#include <initializer_list>
 #include <iostream>
-#include <list>
 #include <set>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 
 class Generator;
+class HideSet;
+class Ident;
+class Macro;
 class Parser;
 class Scanner;
 class Token;
+class TokenList;
 class TokenSequence;
 
-typedef std::set<std::string> HideSet;
-typedef std::list<const Token*> TokenList;
-
 
 struct SourceLocation {
   const std::string* filename_;
@@ -186,7 +189,8 @@ public:
     PP_PRAGMA,
     PP_NONE,
     PP_EMPTY,
-    
+    // Lines between conditional directives, not scanned yet
+    UNSCANNED,
 
     IGNORE,
     INVALID,
@@ -204,19 +208,19 @@ public:
     tag_ = other.tag_;
     ws_ = other.ws_;
     loc_ = other.loc_;
-    str_ = other.str_;
-    hs_ = other.hs_ ? new HideSet(*other.hs_): nullptr;
+    hs_ = other.hs_;
+    ident_ = other.ident_;
     return *this;
   }
-  virtual ~Token() {}
+  ~Token() {}
+
+  const std::string& Str() const;
+  void SetStr(const std::string& str);
   
   //Token::NOTOK represents not a kw.
-  static int KeyWordTag(const std::string& key) {
-    auto kwIter = kwTypeMap_.find(key); 
-    if (kwTypeMap_.end() == kwIter)
-      return Token::NOTOK;	//not a key word type
-    return kwIter->second;
-  }
+  static int KeyWordTag(const std::string& key);
+  // Token::PP_NONE if 'name' is not a directive
+  static int DirectiveTag(const std::string& name);
   static bool IsKeyWord(const std::string& name);
   static bool IsKeyWord(int tag) { return CONST <= tag && tag < IDENTIFIER; }
   bool IsKeyWord() const { return IsKeyWord(tag_); }
@@ -241,41 +245,186 @@ public:
 
   // ws_ standards for weither there is preceding white space
   // This is to simplify the '#' operator(stringize) in macro expansion
-  std::string str_;
-  HideSet* hs_ { nullptr };
+
+  // Shared and immutable, null is the empty set
+  const HideSet* hs_ { nullptr };
+
+  // Interned spelling, never null. The token owns no string,
+  // equal spellings are stored once.
+  Ident* ident_;
 
 private:
-  explicit Token(int tag): tag_(tag) {}
+  explicit Token(int tag);
   Token(int tag, const SourceLocation& loc,
-        const std::string& str, bool ws=false)
-      : tag_(tag), ws_(ws), loc_(loc), str_(str) {}
+        const std::string& str, bool ws=false);
 
   Token(const Token& other) {
     *this = other;
   }
 
-  static const std::unordered_map<std::string, int> kwTypeMap_;
   static const std::unordered_map<int, const char*> TagLexemeMap_;
 };
 
 
+/*
+ * Interned spelling of tokens, one for each distinct spelling.
+ * For identifiers, keyword and macro lookups are then pointer
+ * dereferences instead of hashing or comparing the spelling
+ * again and again.
+ */
+class Ident {
+public:
+  static Ident* Get(const std::string& name);
+  // Returns null if the spelling has never been interned
+  static Ident* Find(const std::string& name);
+
+  const std::string& Name() const { return name_; }
+  int KeyWordTag() const { return kwTag_; }
+  int DirectiveTag() const { return ppTag_; }
+
+  // Current definition as macro, owned by the preprocessor
+  Macro* macro_ { nullptr };
+
+private:
+  explicit Ident(const std::string& name);
+  Ident(const Ident& other) = delete;
+  Ident& operator=(const Ident& other) = delete;
+
+  std::string name_;
+  int kwTag_;
+  int ppTag_;
+};
+
+
+inline const std::string& Token::Str() const {
+  return ident_->Name();
+}
+
+
+inline void Token::SetStr(const std::string& str) {
+  ident_ = Ident::Get(str);
+}
+
+
+/*
+ * Hide set of macro expansion, hash-consed.
+ * Equal sets are the same object and are never modified, so tokens
+ * share them by pointer. Results of Insert() and Union() are cached
+ * on the operands, repeated expansions of a macro cost no allocation.
+ * Null represents the empty set.
+ */
+class HideSet {
+public:
+  static const HideSet* Insert(const HideSet* hs, const Ident* ident);
+  static const HideSet* Union(const HideSet* lhs, const HideSet* rhs);
+  static bool Contains(const HideSet* hs, const Ident* ident) {
+    return hs && hs->Contains(ident);
+  }
+
+  bool Contains(const Ident* ident) const;
+  size_t Size() const { return idents_.size(); }
+
+private:
+  typedef std::vector<const Ident*> IdentList;
+  static const HideSet* Intern(IdentList& idents);
+
+  explicit HideSet(const IdentList& idents): idents_(idents) {}
+  HideSet(const HideSet& other) = delete;
+  HideSet& operator=(const HideSet& other) = delete;
+
+  IdentList idents_; // Sorted
+  mutable std::unordered_map<const Ident*, const HideSet*> insertCache_;
+  mutable std::unordered_map<const HideSet*, const HideSet*> unionCache_;
+};
+
+
+/*
+ * Doubly linked list of tokens.
+ * The nodes are in one contiguous array and linked by index, so that
+ * a token costs 16 bytes instead of a heap allocated list node, and
+ * scanning tokens in the order they were appended reads sequential
+ * memory. Node 0 is the sentinel, it is also the end position.
+ * A position stays valid until the list is destroyed, insertion and
+ * removal of other tokens never move it. Lists made by 'New' are
+ * destroyed along with the tokens of the compilation.
+ */
+class TokenList {
+public:
+  typedef uint32_t Pos;
+
+  class Iterator {
+  public:
+    Iterator(const TokenList* list, Pos pos): list_(list), pos_(pos) {}
+    const Token* operator*() const { return list_->At(pos_); }
+    Iterator& operator++() { pos_ = list_->Next(pos_); return *this; }
+    bool operator!=(const Iterator& other) const { return pos_ != other.pos_; }
+
+  private:
+    const TokenList* list_;
+    Pos pos_;
+  };
+
+  static TokenList* New();
+  TokenList(): nodes_(1, Node {nullptr, 0, 0}) {}
+  TokenList(std::initializer_list<const Token*> toks): TokenList() {
+    for (auto tok: toks)
+      Insert(End(), tok);
+  }
+
+  Pos Begin() const { return nodes_[0].next_; }
+  Pos End() const { return 0; }
+  Pos Next(Pos pos) const { return nodes_[pos].next_; }
+  Pos Prev(Pos pos) const { return nodes_[pos].prev_; }
+  const Token* At(Pos pos) const { return nodes_[pos].tok_; }
+  void Set(Pos pos, const Token* tok) { nodes_[pos].tok_ = tok; }
+  bool Empty() const { return Begin() == End(); }
+
+  // Insert before 'pos', returns the position of the new token
+  Pos Insert(Pos pos, const Token* tok) {
+    Pos ret = nodes_.size();
+    auto prev = nodes_[pos].prev_;
+    nodes_.push_back({tok, prev, pos});
+    nodes_[prev].next_ = ret;
+    nodes_[pos].prev_ = ret;
+    return ret;
+  }
+  void PopBack() {
+    auto back = Prev(End());
+    assert(back != End());
+    auto prev = nodes_[back].prev_;
+    nodes_[prev].next_ = End();
+    nodes_[End()].prev_ = prev;
+    if (back + 1 == nodes_.size())
+      nodes_.pop_back();
+  }
+
+  Iterator begin() const { return {this, Begin()}; }
+  Iterator end() const { return {this, End()}; }
+
+private:
+  struct Node {
+    const Token* tok_;
+    Pos prev_;
+    Pos next_;
+  };
+
+  std::vector<Node> nodes_;
+};
+
+
 class TokenSequence {
   friend class Preprocessor;
 
 public:
-  TokenSequence(): tokList_(new TokenList()),
-                   begin_(tokList_->begin()), end_(tokList_->end()) {}
-  explicit TokenSequence(Token* tok) {
-    TokenSequence();
-    InsertBack(tok);
-  }
+  typedef TokenList::Pos Pos;
+
+  TokenSequence(): tokList_(TokenList::New()),
+                   begin_(tokList_->Begin()), end_(tokList_->End()) {}
   explicit TokenSequence(TokenList* tokList)
       : tokList_(tokList),
-        begin_(tokList->begin()),
-        end_(tokList->end()) {}
-  TokenSequence(TokenList* tokList,
-                TokenList::iterator begin,
-                TokenList::iterator end)
+        begin_(tokList->Begin()),
+        end_(tokList->End()) {}
+  TokenSequence(TokenList* tokList, Pos begin, Pos end)
       : tokList_(tokList), begin_(begin), end_(end) {}
   ~TokenSequence() {}
   TokenSequence(const TokenSequence& other) { *this = other; }
@@ -286,25 +435,25 @@ public:
     return *this;
   }
   void Copy(const TokenSequence& other) {
-    tokList_ = new TokenList(other.begin_, other.end_);
-    begin_ = tokList_->begin();
-    end_ = tokList_->end();
-    for (auto iter = begin_; iter != end_; ++iter)
-      *iter = Token::New(**iter);
+    tokList_ = TokenList::New();
+    for (auto pos = other.begin_; pos != other.end_;
+         pos = other.tokList_->Next(pos)) {
+      tokList_->Insert(tokList_->End(),
+                       Token::New(*other.tokList_->At(pos)));
+    }
+    begin_ = tokList_->Begin();
+    end_ = tokList_->End();
   }
   void UpdateHeadLocation(const SourceLocation& loc) {
     assert(!Empty());
     auto tok = const_cast<Token*>(Peek());
     tok->loc_ = loc;
   }
-  void FinalizeSubst(bool leadingWS, const HideSet& hs) {
+  void FinalizeSubst(bool leadingWS, const HideSet* hs) {
     auto ts = *this;
     while (!ts.Empty()) {
       auto tok = const_cast<Token*>(ts.Next());
-      if (!tok->hs_)
-        tok->hs_ = new HideSet(hs);
-      else
-        tok->hs_->insert(hs.begin(), hs.end());
+      tok->hs_ = HideSet::Union(tok->hs_, hs);
     }
     // Even if the token sequence is empty
     const_cast<Token*>(Peek())->ws_ = leadingWS;
@@ -322,7 +471,7 @@ public:
   const Token* Next() {
     auto ret = Peek();
     if (!ret->IsEOF()) {
-      ++begin_;
+      begin_ = tokList_->Next(begin_);
       Peek(); // May skip newline token, but why ?
     } else {
       ++exceed_end;
@@ -330,12 +479,12 @@ public:
     return ret;
   }
   void PutBack() {
-    assert(begin_ != tokList_->begin());
+    assert(begin_ != tokList_->Begin());
     if (exceed_end > 0) {
       --exceed_end;
     } else {
-      --begin_;
-      if ((*begin_)->tag_ == Token::NEW_LINE)
+      begin_ = tokList_->Prev(begin_);
+      if (tokList_->At(begin_)->tag_ == Token::NEW_LINE)
         PutBack();
     }
   }
@@ -349,29 +498,27 @@ public:
     return ret;
   }
   const Token* Back() const {
-    auto back = end_;
-    return *--back;
+    return tokList_->At(tokList_->Prev(end_));
   }
   void PopBack() {
     assert(!Empty());
-    assert(end_ == tokList_->end());
-    auto size_eq1 = tokList_->back() == *begin_;
-    tokList_->pop_back();
-    end_ = tokList_->end();
-    if (size_eq1)
+    assert(end_ == tokList_->End());
+    auto sizeEq1 = tokList_->Prev(end_) == begin_;
+    tokList_->PopBack();
+    if (sizeEq1)
       begin_ = end_;
   }
-  TokenList::iterator Mark() { return begin_; }
-  void ResetTo(TokenList::iterator mark) { begin_ = mark; }
+  Pos Mark() { return begin_; }
+  void ResetTo(Pos mark) { begin_ = mark; }
   bool Empty() const { return Peek()->tag_ == Token::END; }
   void InsertBack(TokenSequence& ts) {
-    auto pos = tokList_->insert(end_, ts.begin_, ts.end_);
+    auto pos = Insert(end_, ts);
     if (begin_ == end_) {
       begin_ = pos;
     }
   }
   void InsertBack(const Token* tok) {
-    auto pos = tokList_->insert(end_, tok);
+    auto pos = tokList_->Insert(end_, tok);
     if (begin_ == end_) {
       begin_ = pos;
     }
@@ -380,11 +527,11 @@ public:
   // If there is preceding newline
   void InsertFront(TokenSequence& ts) {
     auto pos = GetInsertFrontPos();
-    begin_ = tokList_->insert(pos, ts.begin_, ts.end_);
+    begin_ = Insert(pos, ts);
   }
   void InsertFront(const Token* tok) {
     auto pos = GetInsertFrontPos();
-    begin_ = tokList_->insert(pos, tok);
+    begin_ = tokList_->Insert(pos, tok);
   }
   bool IsBeginOfLine() const;
   TokenSequence GetLine();
@@ -392,20 +539,34 @@ public:
   void Print(FILE* fp=stdout) const;
 
 private:
+  // Insert tokens of 'ts' before 'pos', returns position of the first
+  Pos Insert(Pos pos, const TokenSequence& ts) {
+    auto first = pos;
+    for (auto iter = ts.begin_; iter != ts.end_;
+         iter = ts.tokList_->Next(iter)) {
+      auto inserted = tokList_->Insert(pos, ts.tokList_->At(iter));
+      if (first == pos)
+        first = inserted;
+    }
+    return first;
+  }
+
   // Find a insert position with no preceding newline
-  TokenList::iterator GetInsertFrontPos() {
+  Pos GetInsertFrontPos() {
     auto pos = begin_;
-    if (pos == tokList_->begin())
+    if (pos == tokList_->Begin())
       return pos;
-    --pos;
-    while (pos != tokList_->begin() && (*pos)->tag_ == Token::NEW_LINE)
-      --pos;
-    return ++pos;
+    pos = tokList_->Prev(pos);
+    while (pos != tokList_->Begin() &&
+           tokList_->At(pos)->tag_ == Token::NEW_LINE) {
+      pos = tokList_->Prev(pos);
+    }
+    return tokList_->Next(pos);
   }
 
   TokenList* tokList_;
-  mutable TokenList::iterator begin_;
-  TokenList::iterator end_;
+  mutable Pos begin_;
+  Pos end_;
   Parser* parser_ {nullptr};
   int exceed_end {0};
 };
@@ -1,5 +1,6 @@
 #include "type.h"
 
+#include "arena.h"
 #include "ast.h"
 #include "scope.h"
 #include "token.h"
@@ -9,14 +10,6 @@
 #include <iostream>
 
 
-static MemPoolImp<VoidType>     voidTypePool;
-static MemPoolImp<ArrayType>    arrayTypePool;
-static MemPoolImp<FuncType>     funcTypePool;
-static MemPoolImp<PointerType>  pointerTypePool;
-static MemPoolImp<StructType>   structUnionTypePool;
-static MemPoolImp<ArithmType>   arithmTypePool;
-
-
 QualType Type::MayCast(QualType type, bool inProtoScope) {
   auto funcType = type->ToFunc();
   auto arrayType = type->ToArray();
@@ -32,15 +25,16 @@ QualType Type::MayCast(QualType type, bool inProtoScope) {
 }
 
 
+// Basic types are immutable, shared by all compilations of the process
 VoidType* VoidType::New() {
-  static auto ret = new (voidTypePool.Alloc()) VoidType(&voidTypePool);
+  static auto ret = new VoidType();
   return ret;
 }
 
 
 ArithmType* ArithmType::New(int typeSpec) {
 #define NEW_TYPE(tag)                                           \
-  new (arithmTypePool.Alloc()) ArithmType(&arithmTypePool, tag);
+  new ArithmType(tag);
 
   static auto boolType    = NEW_TYPE(T_BOOL);
   static auto charType    = NEW_TYPE(T_CHAR);
@@ -85,14 +79,12 @@ ArithmType* ArithmType::New(int typeSpec) {
 
 
 ArrayType* ArrayType::New(int len, QualType eleType) {
-  return new (arrayTypePool.Alloc())
-         ArrayType(&arrayTypePool, len, eleType);
+  return new (Arena::TYPE) ArrayType(len, eleType);
 }
 
 
 ArrayType* ArrayType::New(Expr* expr, QualType eleType) {
-  return new (arrayTypePool.Alloc())
-         ArrayType(&arrayTypePool, expr, eleType);
+  return new (Arena::TYPE) ArrayType(expr, eleType);
 }
 
 
@@ -100,22 +92,21 @@ FuncType* FuncType::New(QualType derived,
                         int funcSpec,
                         bool variadic,
                         const ParamList& params) {
-  return new (funcTypePool.Alloc())
-         FuncType(&funcTypePool, derived, funcSpec, variadic, params);
+  return Arena::Get(Arena::TYPE).Own(
+      new (Arena::TYPE) FuncType(derived, funcSpec, variadic, params));
 }
 
 
 PointerType* PointerType::New(QualType derived) {
-  return new (pointerTypePool.Alloc())
-         PointerType(&pointerTypePool, derived);
+  return new (Arena::TYPE) PointerType(derived);
 }
 
 
 StructType* StructType::New(bool isStruct,
                               bool hasTag,
                               Scope* parent) {
-  return new (structUnionTypePool.Alloc())
-         StructType(&structUnionTypePool, isStruct, hasTag, parent);
+  return Arena::Get(Arena::TYPE).Own(
+      new (Arena::TYPE) StructType(isStruct, hasTag, parent));
 }
 
 
@@ -326,14 +317,14 @@ std::string FuncType::Str() const {
 }
 
 
-StructType::StructType(MemPool* pool,
-                       bool isStruct,
+StructType::StructType(bool isStruct,
                        bool hasTag,
                        Scope* parent)
-    : Type(pool, false),
+    : Type(false),
       isStruct_(isStruct),
       hasTag_(hasTag),
-      memberMap_(new Scope(parent, S_BLOCK)),
+      memberMap_(ASTNode::CurArena().Own(
+          new (ASTNode::CurArena()) Scope(parent, S_BLOCK))),
       offset_(0),
       width_(0),
       // If a struct type has no member, it gets alignment of 1
@@ -1,7 +1,6 @@
 #ifndef _WGTCC_TYPE_H_
 #define _WGTCC_TYPE_H_
 
-#include "mem_pool.h"
 #include "scope.h"
 
 #include <algorithm>
@@ -142,7 +141,12 @@ public:
 
   static QualType MayCast(QualType type, bool inProtoScope=false);
   bool Complete() const { return complete_; }
-  void SetComplete(bool complete) const { complete_ = complete; }
+  // Basic types are shared by concurrent compilations, and are
+  // only ever read: they are complete, void is never completed
+  void SetComplete(bool complete) const {
+    if (complete_ != complete)
+      complete_ = complete;
+  }
 
   bool IsReal() const { return IsInteger() || IsFloat(); };  
   virtual bool IsScalar() const { return false; }
@@ -168,11 +172,9 @@ public:
   virtual const StructType*   ToStruct() const { return nullptr; }
 
 protected:
-  Type(MemPool* pool, bool complete)
-      : complete_(complete), pool_(pool) {}
+  explicit Type(bool complete): complete_(complete) {}
 
   mutable bool complete_;
-  MemPool* pool_;
 };
 
 
@@ -190,7 +192,7 @@ public:
   virtual std::string Str() const { return "void:1"; }
 
 protected:
-  explicit VoidType(MemPool* pool): Type(pool, false) {}
+  VoidType(): Type(false) {}
 };
 
 
@@ -231,8 +233,8 @@ public:
                                    ArithmType* rhsType);
 
 protected:
-  explicit ArithmType(MemPool* pool, int spec)
-    : Type(pool, true), tag_(Spec2Tag(spec)) {}
+  explicit ArithmType(int spec)
+    : Type(true), tag_(Spec2Tag(spec)) {}
 
 private:
   static int Spec2Tag(int spec);
@@ -249,8 +251,8 @@ public:
   virtual const DerivedType* ToDerived() const { return this; }
 
 protected:
-  DerivedType(MemPool* pool, QualType derived)
-      : Type(pool, true), derived_(derived) {}
+  explicit DerivedType(QualType derived)
+      : Type(true), derived_(derived) {}
 
   QualType derived_;
 };
@@ -271,7 +273,7 @@ public:
   }
 
 protected:
-  PointerType(MemPool* pool, QualType derived): DerivedType(pool, derived) {}
+  explicit PointerType(QualType derived): DerivedType(derived) {}
 };
 
 
@@ -298,15 +300,15 @@ public:
   bool Variadic() const { return lenExpr_ != nullptr; }
 
 protected:
-  ArrayType(MemPool* pool, Expr* lenExpr, QualType derived)
-      : DerivedType(pool, derived),
+  ArrayType(Expr* lenExpr, QualType derived)
+      : DerivedType(derived),
         lenExpr_(lenExpr), len_(0) {
     SetComplete(false);
     //SetQual(QualType::CONST);
   }
   
-  ArrayType(MemPool* pool, int len, QualType derived)
-      : DerivedType(pool, derived),
+  ArrayType(int len, QualType derived)
+      : DerivedType(derived),
         lenExpr_(nullptr), len_(len) {
     SetComplete(len_ >= 0);
     //SetQual(QualType::CONST);
@@ -338,9 +340,9 @@ public:
   bool IsNoReturn() const { return inlineNoReturn_ & F_NORETURN; }
 
 protected:
-  FuncType(MemPool* pool, QualType derived, int inlineReturn,
+  FuncType(QualType derived, int inlineReturn,
            bool variadic, const ParamList& params)
-      : DerivedType(pool, derived), inlineNoReturn_(inlineReturn),
+      : DerivedType(derived), inlineNoReturn_(inlineReturn),
         variadic_(variadic), params_(params) {
     SetComplete(false);
   }
@@ -383,7 +385,7 @@ public:
   
 protected:
   // default is incomplete
-  StructType(MemPool* pool, bool isStruct, bool hasTag, Scope* parent);
+  StructType(bool isStruct, bool hasTag, Scope* parent);
   
   StructType(const StructType& other);
 
@@ -429,7 +431,7 @@ public:
   virtual std::string Str() const { return "enum:4"; }
 
 protected:
-  explicit EnumType(MemPool* pool, bool complete): Type(pool, complete) {}
+  explicit EnumType(bool complete): Type(complete) {}
 };
 */
 
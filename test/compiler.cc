@@ -0,0 +1,123 @@
+// Drives the compiler library, see 'src/compiler.h'.
+// Usage: compiler <test.c>
+
+#include "compiler.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+#define expect(cond, msg)                                         \
+if (!(cond)) {                                                    \
+  fprintf(stderr, "error:%s:%d: failed, %s\n",                    \
+          __FILE__, __LINE__, (msg));                             \
+  ++failures;                                                     \
+};
+
+
+// Resident set size in KB
+static long Rss() {
+  long size = 0, rss = 0;
+  auto fp = fopen("/proc/self/statm", "r");
+  if (fp == nullptr)
+    return 0;
+  if (fscanf(fp, "%ld %ld", &size, &rss) != 2)
+    rss = 0;
+  fclose(fp);
+  return rss * 4;
+}
+
+
+static void Outputs(const std::string& name, const std::string& source) {
+  CompilerOptions options;
+  options.output_ = CompilerOptions::PREPROCESSED;
+  CompilerInstance cpp(options);
+  expect(cpp.Compile(name, source), cpp.Diagnostics().c_str());
+  expect(cpp.Output().find("int main") != std::string::npos, "-E");
+
+  options.output_ = CompilerOptions::ASSEMBLY;
+  CompilerInstance cc(options);
+  expect(cc.Compile(name, source), cc.Diagnostics().c_str());
+  expect(cc.Output().find("main:") != std::string::npos, "-S");
+
+  options.output_ = CompilerOptions::OBJECT;
+  CompilerInstance as(options);
+  expect(as.Compile(name, source), as.Diagnostics().c_str());
+  expect(as.Output().compare(0, 4, "\x7f" "ELF") == 0, "-c");
+}
+
+
+static void Diagnostics() {
+  CompilerInstance cc({});
+  expect(!cc.Compile("bad.c", "int main() { return x; }\n"), "error");
+  const auto& diag = cc.Diagnostics();
+  expect(diag.find("bad.c:1:") == 0, diag.c_str());
+  expect(diag.find("error: ") != std::string::npos, diag.c_str());
+  expect(diag.find('\x1b') == std::string::npos, "colors in diagnostics");
+  expect(cc.Output().empty(), "output after error");
+
+  // An error leaves nothing behind for the next compilation
+  expect(cc.Compile("good.c", "int main() { return 0; }\n"),
+         cc.Diagnostics().c_str());
+  expect(cc.Diagnostics().empty(), cc.Diagnostics().c_str());
+}
+
+
+// Instances on their own threads give the output of a lone one
+static void Threads(const std::string& name, const std::string& source) {
+  CompilerInstance ref({});
+  ref.Compile(name, source);
+
+  std::vector<std::string> outputs(8);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < outputs.size(); ++i) {
+    threads.emplace_back([&, i]() {
+      CompilerOptions options;
+      options.pipeline_ = i % 2;
+      CompilerInstance cc(options);
+      for (int k = 0; k < 4; ++k) {
+        if (cc.Compile(name, source))
+          outputs[i] = cc.Output();
+      }
+    });
+  }
+  for (auto& thread: threads)
+    thread.join();
+  for (const auto& output: outputs)
+    expect(output == ref.Output(), "output of a thread");
+}
+
+
+// Each compilation frees what it allocated
+static void Memory(const std::string& name, const std::string& source) {
+  CompilerInstance cc({});
+  for (int i = 0; i < 50; ++i)
+    cc.Compile(name, source);
+  auto rss = Rss();
+  for (int i = 0; i < 200; ++i)
+    cc.Compile(name, source);
+  expect(Rss() - rss < 16 * 1024, "memory grows with the compilations");
+}
+
+
+int main(int argc, char* argv[]) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s <test.c>\n", argv[0]);
+    return 1;
+  }
+  std::ifstream in(argv[1]);
+  std::stringstream source;
+  source << in.rdbuf();
+
+  Outputs(argv[1], source.str());
+  Diagnostics();
+  Threads(argv[1], source.str());
+  Memory(argv[1], source.str());
+  return failures != 0;
+}
@@ -0,0 +1,12 @@
+// @wgtcc: passed
+
+// The input of 'driver.sh', which checks the dependency output
+#include "test.h"
+#include "once.h"
+
+int main() {
+#ifndef ONCE_INCLUDED
+  fail("#include");
+#endif
+  return 0;
+}
@@ -0,0 +1,157 @@
+#!/bin/sh
+# Checks the options of the driver that the tests can't see from the
+# output of their programs: the dependencies, the include limit, the
+# parallel jobs, the precompiled headers, the output of -fpipeline and
+# the compilation cache.
+# Usage: driver.sh <wgtcc>
+
+W=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+DIR=$(cd "$(dirname "$0")" && pwd)
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+cd "$TMP" || exit 1
+cp "$DIR/driver.c" "$DIR/test.h" "$DIR/once.h" .
+status=0
+
+check() {
+  if [ "$2" != "$3" ]; then
+    printf 'error:driver.sh: %s\nexpect:\n%s\ngot:\n%s\n' "$1" "$2" "$3"
+    status=1
+  fi
+}
+
+# Dependencies
+check "-MM" "driver.o: driver.c test.h once.h" "$($W -MM driver.c)"
+check "-MM -MP" "driver.o: driver.c test.h once.h
+test.h:
+once.h:" "$($W -MM -MP driver.c)"
+case "$($W -M driver.c)" in
+  *"driver.o: driver.c "*stdio.h*) ;;
+  *) check "-M lists system headers" "stdio.h" "$($W -M driver.c)" ;;
+esac
+$W -MMD -c driver.c
+check "-MMD" "driver.o: driver.c test.h once.h" "$(cat driver.d)"
+check "-MMD object" "driver.o" "$(ls driver.o)"
+$W -MMD -MP -MF deps.d -c driver.c -o out.o
+check "-MMD -MP -MF" "out.o: driver.c test.h once.h
+test.h:
+once.h:" "$(cat deps.d)"
+mkdir inc
+echo '#pragma once' > b.h
+echo '#include "b.h"
+#include "inc/../b.h"
+#include "./b.h"' > dup.c
+check "-MM header by several paths" "dup.o: dup.c b.h" "$($W -MM dup.c)"
+
+# Inclusions skipped by a guard or '#pragma once' are not limited
+for i in $(seq 1100); do
+  echo '#include "test.h"'
+  echo '#include "once.h"'
+done > many.c
+echo 'int main() { return 0; }' >> many.c
+check "guarded header included 1100 times" "" "$($W -S many.c 2>&1)"
+echo '#include "r1.h"' > r2.h
+echo '#include "r2.h"' > r1.h
+echo '#include "r1.h"' > r.c
+case "$($W -E r.c 2>&1)" in
+  *"may recursive include"*) ;;
+  *) check "recursive include" "may recursive include" "$($W -E r.c 2>&1)" ;;
+esac
+
+# Parallel jobs: the outputs come in the order of the input files, the
+# intermediate objects are removed also when a job fails
+for f in a b c; do echo "int $f(void) { return 1; }" > $f.c; done
+echo 'int a(void), b(void), c(void);
+int main() { return a() + b() + c() - 3; }' > main.c
+check "-j -E" "int a(void) { return 1; }
+int b(void) { return 1; }
+int c(void) { return 1; }" "$($W -j 3 -E a.c b.c c.c | grep '^ *int' | sed 's/^ *//')"
+$W -j2 -c a.c b.c c.c
+check "-j -c" "a.o b.o c.o" "$(echo $(ls a.o b.o c.o))"
+rm -f a.o b.o c.o
+$W -j 2 -no-pie a.c b.c c.c main.c -o prog && ./prog
+check "-j link" "0 " "$? $(ls a.o b.o c.o main.o 2>/dev/null)"
+echo 'int b(void) { return x; }' > b.c
+$W -j 2 -no-pie a.c b.c c.c main.c -o bad 2>/dev/null
+check "-j failed job" "1 " "$(test -e bad; echo $?) $(ls a.o c.o main.o 2>/dev/null)"
+
+# The integrated assembler leaves the inputs of '-c' that aren't C to gcc
+$W -S a.c -o as.s
+$W -c as.s c.c
+check "-c assembly" "as.o c.o" "$(echo $(ls as.o c.o))"
+echo 'no such instruction' > bad.s
+$W -c bad.s 2>/dev/null
+check "-c bad assembly" "1" "$?"
+
+# Precompiled headers give the code of the included header, and are
+# rejected once a header they were made from has changed
+echo '#pragma once
+enum { SEVEN = 7 };' > inner.h
+echo '#include "inner.h"
+#define TWICE(x) ((x) * 2)
+typedef struct { int v; } box;
+static int get(box b) { return b.v; }' > pch.h
+echo '#include "inner.h"
+int main() { box b = { TWICE(SEVEN) }; return get(b) - 14; }' > pch.c
+cat pch.h pch.c > whole.c
+$W -emit-pch pch.h
+check "-emit-pch" "pch.h.pch" "$(ls pch.h.pch)"
+$W -no-pie -include-pch pch.h.pch pch.c -o pch && ./pch
+check "-include-pch" "0" "$?"
+$W -S whole.c -o whole.s
+$W -S -include-pch pch.h.pch pch.c -o pch.s
+# But for the name of the file on the first line
+check "-include-pch code" "$(tail -n +2 whole.s)" "$(tail -n +2 pch.s)"
+touch -d '2000-01-01' inner.h
+out=$($W -S -include-pch pch.h.pch pch.c -o stale.s 2>&1)
+case "$out" in
+  *"pch.h.pch: precompiled header is out of date, './inner.h' has changed") ;;
+  *) check "stale precompiled header" "out of date" "$out" ;;
+esac
+out=$($W -S -include-pch pch.c pch.c 2>&1)
+case "$out" in
+  *"pch.c: not a precompiled header") ;;
+  *) check "not a precompiled header" "rejected" "$out" ;;
+esac
+
+# -fpipeline generates the same code as the sequential mode
+for test in "$DIR"/*.c; do
+  [ "$(basename "$test")" = util.c ] && continue
+  for g in "" -g; do
+    $W $g -S "$test" -o seq.s && $W $g -fpipeline -S "$test" -o pipe.s
+    cmp -s seq.s pipe.s || check "-fpipeline $g $test" "same as sequential" "different"
+  done
+done
+
+# Compilation cache
+export WGTCC_CACHE_DIR="$TMP/cache"
+stats() {
+  echo "driver.c: compilation cache: $1 hits, $2 misses, $3 stored, $4 evicted"
+}
+check "cache miss" "$(stats 0 1 1 0)" "$($W -c -fcache-stats driver.c 2>&1)"
+mv driver.o miss.o
+check "cache hit" "$(stats 1 0 0 0)" "$($W -c -fcache-stats driver.c 2>&1)"
+cmp -s driver.o miss.o || check "cache hit object" "same as miss.o" "different"
+check "cache hit, unused macro" "$(stats 1 0 0 0)" \
+      "$($W -c -fcache-stats -DUNUSED=1 driver.c 2>&1)"
+check "cache miss, -S" "$(stats 0 1 1 0)" "$($W -S -fcache-stats driver.c 2>&1)"
+check "cache miss, -g" "$(stats 0 1 1 0)" \
+      "$($W -c -g -fcache-stats driver.c 2>&1)"
+echo "int extra;" >> driver.c
+check "cache miss, changed source" "$(stats 0 1 1 0)" \
+      "$($W -c -fcache-stats driver.c 2>&1)"
+check "cache eviction" "$(stats 0 1 1 1)" \
+      "$(WGTCC_CACHE_DIR="$TMP/small" WGTCC_CACHE_SIZE=1 \
+         $W -c -fcache-stats driver.c 2>&1)"
+check "cache size" \
+      "$(find cache -type f ! -name .size -exec cat {} + | wc -c)" \
+      "$(cat cache/.size)"
+rm -f driver.o
+out=$(WGTCC_CACHE_SIZE=1X $W -c -fcache-stats driver.c 2>&1)
+case "$out" in
+  *"warning: "*"invalid WGTCC_CACHE_SIZE: '1X', the cache is not used") ;;
+  *) check "invalid cache size" "warning" "$out" ;;
+esac
+check "invalid cache size object" "driver.o" "$(ls driver.o)"
+
+exit $status
@@ -21,7 +21,27 @@ void test() {
   }
 }
 
+// A block scope extern function outlives the body declaring it
+void test_func_decl() {
+  extern double scale(double a, double b);
+  expectf(scale(2, 3), 6.0);
+}
+
+int test_func_local() {
+  int x = 1;
+  return x;
+}
+
+double scale(double a, double b);
+
+double scale(double a, double b) {
+  return a * b;
+}
+
 int main() {
   test();
+  test_func_decl();
+  expect(test_func_local(), 1);
+  expect((int)scale(1, 2), 2);
   return 0;
 }
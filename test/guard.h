@@ -0,0 +1,11 @@
+#ifndef _WGTCC_GUARD_H_
+#define _WGTCC_GUARD_H_
+
+#ifdef GUARD_INCLUDED
+#error "guarded header included twice"
+#endif
+#define GUARD_INCLUDED
+
+static int guard_times = GUARD_TIMES;
+
+#endif
@@ -0,0 +1,41 @@
+// @wgtcc: passed
+
+#include "test.h"
+
+// Included again by another spelling of the path
+#include "once.h"
+#include "once.h"
+#include "./once.h"
+
+#define GUARD_TIMES 1
+#include "guard.h"
+#include "guard.h"
+
+static void once() {
+#ifndef ONCE_INCLUDED
+    fail("#pragma once");
+#endif
+}
+
+static void guard() {
+    expect(1, guard_times);
+}
+
+// The guard is checked again when the header is included
+#undef _WGTCC_GUARD_H_
+#undef GUARD_INCLUDED
+#undef GUARD_TIMES
+#define GUARD_TIMES 2
+#define guard_times guard_times2
+#include "guard.h"
+
+static void guard_undef() {
+    expect(2, guard_times);
+}
+
+int main() {
+  once();
+  guard();
+  guard_undef();
+  return 0;
+}
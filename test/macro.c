@@ -196,6 +196,83 @@ static void const_expr() {
     expect(12, a);
 }
 
+static void unsigned_expr() {
+    int a = 0;
+#if -1 > 0u
+    a = 1;
+#endif
+    expect(1, a);
+#if -1 < 0
+    a = 2;
+#endif
+    expect(2, a);
+#if (0u - 1) / 2 > 0x7fffffffffffffff - 1
+    a = 3;
+#endif
+    expect(3, a);
+#if (1 ? -1 : 0u) > 0
+    a = 4;
+#endif
+    expect(4, a);
+#if -1 >> 63 == -1
+    a = 5;
+#endif
+    expect(5, a);
+#if 0xffffffffffffffff == -1
+    a = 6;
+#endif
+    expect(6, a);
+}
+
+static void short_circuit() {
+    int a = 0;
+#if 0 && 1 / 0
+#else
+    a = 1;
+#endif
+    expect(1, a);
+#if 1 || 1 % 0
+    a = 2;
+#endif
+    expect(2, a);
+#if 0 ? 1 / 0 : 3
+    a = 3;
+#endif
+    expect(3, a);
+#if 0 && (NO_SUCH_MACRO / 0)
+#elif 1 || (NO_SUCH_MACRO % 0)
+    a = 4;
+#endif
+    expect(4, a);
+}
+
+static void has_include() {
+    int a = 0;
+#if __has_include("test.h")
+    a = 1;
+#endif
+    expect(1, a);
+#if __has_include(<stddef.h>) && defined(__has_include)
+    a = 2;
+#endif
+    expect(2, a);
+#if __has_include("no_such_header.h")
+    a = 3;
+#endif
+    expect(2, a);
+#define HEADER "test.h"
+#if __has_include(HEADER)
+    a = 4;
+#endif
+    expect(4, a);
+#define SYS_HEADER <stddef.h>
+#define QUOTE(x) #x
+#if __has_include(SYS_HEADER) && !__has_include(QUOTE(no_such_header.h))
+    a = 5;
+#endif
+    expect(5, a);
+}
+
 static void defined() {
     int a = 0;
 #if defined ZERO
@@ -412,6 +489,9 @@ int main() {
   undef();
   cond_incl();
   const_expr();
+  unsigned_expr();
+  short_circuit();
+  has_include();
   defined();
   ifdef();
   funclike();
@@ -0,0 +1,6 @@
+#pragma once
+
+#ifdef ONCE_INCLUDED
+#error "header with '#pragma once' included twice"
+#endif
+#define ONCE_INCLUDED
@@ -0,0 +1,43 @@
+// @wgtcc: passed
+
+#include "test.h"
+
+// Tentative definitions (C11 6.9.2) get the initializer of a later
+// definition, after functions have been generated
+int a;
+static int s;
+int arr[3];
+extern int e;
+int twice;
+int zero;
+
+int get_a() {
+  return a;
+}
+
+int get_s() {
+  return s;
+}
+
+int a = 10;
+static int s = 7;
+int arr[3] = {1, 2, 3};
+int e = 4;
+int twice;
+int twice = 20;
+int twice;
+
+int defined = 5;
+int defined;
+
+int main() {
+  expect(10, a);
+  expect(10, get_a());
+  expect(7, get_s());
+  expect(3, arr[2]);
+  expect(4, e);
+  expect(20, twice);
+  expect(0, zero);
+  expect(5, defined);
+  return 0;
+}